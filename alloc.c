@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include "alloc.h"
+
+static const char* subsys_names[MEM_SUBSYS_COUNT] =
+{
+	"symbols",
+	"sections",
+	"relocations",
+	"data",
+	"strings",
+	"lists",
+	"instructions",
+	"work",
+	"other",
+};
+
+static size_t libc_size(void* p)
+{
+	return malloc_usable_size(p);
+}
+
+static mem_allocator allocator = { malloc, calloc, realloc, free, libc_size };
+
+int mem_accounting;
+
+// one extra slot for the total
+static mem_usage usage[MEM_SUBSYS_COUNT + 1];
+
+void mem_set_allocator(const mem_allocator* a)
+{
+	allocator = *a;
+}
+
+void mem_enable_accounting(void)
+{
+	mem_accounting = 1;
+}
+
+// the allocations can come from several threads at once (i.e. the output objects)
+static void count(mem_usage* u, long bytes, int alloc)
+{
+	long live = __atomic_add_fetch(&u->live, bytes, __ATOMIC_RELAXED);
+	long peak = __atomic_load_n(&u->peak, __ATOMIC_RELAXED);
+	while (live > peak && !__atomic_compare_exchange_n(&u->peak, &peak, live, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	if (alloc)
+		__atomic_add_fetch(&u->allocs, 1, __ATOMIC_RELAXED);
+	else
+		__atomic_add_fetch(&u->frees, 1, __ATOMIC_RELAXED);
+}
+
+static void account(mem_subsys s, long bytes, int alloc)
+{
+	count(&usage[s], bytes, alloc);
+	count(&usage[MEM_SUBSYS_COUNT], bytes, alloc);
+}
+
+void* mem_alloc(mem_subsys s, size_t size)
+{
+	void* p = allocator.alloc(size);
+	if (mem_accounting && p)
+		account(s, allocator.size(p), 1);
+	return p;
+}
+
+void* mem_calloc(mem_subsys s, size_t count, size_t size)
+{
+	void* p = allocator.calloc(count, size);
+	if (mem_accounting && p)
+		account(s, allocator.size(p), 1);
+	return p;
+}
+
+void* mem_realloc(mem_subsys s, void* p, size_t size)
+{
+	long old = (mem_accounting && p) ? allocator.size(p) : 0;
+	void* n = allocator.realloc(p, size);
+	if (mem_accounting && n)
+		account(s, (long)allocator.size(n) - old, 1);
+	return n;
+}
+
+char* mem_strdup(mem_subsys s, const char* str)
+{
+	size_t len = strlen(str) + 1;
+	char* p = mem_alloc(s, len);
+	if (p)
+		memcpy(p, str, len);
+	return p;
+}
+
+void mem_free(mem_subsys s, void* p)
+{
+	if (!p)
+		return;
+	if (mem_accounting)
+		account(s, -(long)allocator.size(p), 0);
+	allocator.free(p);
+}
+
+const char* mem_subsys_name(mem_subsys s)
+{
+	if (s >= MEM_SUBSYS_COUNT)
+		return "total";
+	return subsys_names[s];
+}
+
+void mem_get_usage(mem_subsys s, mem_usage* u)
+{
+	u->live = __atomic_load_n(&usage[s].live, __ATOMIC_RELAXED);
+	u->peak = __atomic_load_n(&usage[s].peak, __ATOMIC_RELAXED);
+	u->allocs = __atomic_load_n(&usage[s].allocs, __ATOMIC_RELAXED);
+	u->frees = __atomic_load_n(&usage[s].frees, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,64 @@
+/* Memory allocation
+
+All of the modules allocate through these functions instead of calling malloc() directly, so the
+allocator can be replaced (i.e. by a faster one, or an arena) in one place, and the memory can be
+attributed to the structures that use it. Every allocation names the subsystem it belongs to, and
+must be freed or reallocated with the same subsystem.
+
+With accounting enabled (--stats), the number of live bytes, the peak and the number of
+allocations are counted for each subsystem. The sizes come from the allocator itself (the usable
+size of the block), so nothing is added to the blocks. Accounting must be enabled before anything is
+allocated, and costs nothing when it is off. */
+
+#ifndef _ALLOC__H
+#define _ALLOC__H
+
+#include <stddef.h>
+
+typedef enum mem_subsys
+{
+	MEM_SYMBOLS,			// backend_symbol
+	MEM_SECTIONS,			// backend_section
+	MEM_RELOCATIONS,		// backend_reloc
+	MEM_DATA,				// section contents
+	MEM_STRINGS,			// names and string tables
+	MEM_LISTS,				// linked list heads and nodes
+	MEM_INSNS,				// decoded instructions
+	MEM_WORK,				// working arrays of the analysis and output passes
+	MEM_OTHER,
+	MEM_SUBSYS_COUNT
+} mem_subsys;
+
+// the functions behind the interface - any of them may be replaced
+typedef struct mem_allocator
+{
+	void* (*alloc)(size_t size);
+	void* (*calloc)(size_t count, size_t size);
+	void* (*realloc)(void* p, size_t size);
+	void (*free)(void* p);
+	size_t (*size)(void* p);	// usable size of a block, for the accounting
+} mem_allocator;
+
+typedef struct mem_usage
+{
+	long live;					// bytes currently allocated
+	long peak;					// highest value of 'live'
+	unsigned long allocs;	// number of allocations (including reallocations)
+	unsigned long frees;
+} mem_usage;
+
+extern int mem_accounting;
+
+void mem_set_allocator(const mem_allocator* a); /* must be called before anything is allocated */
+void mem_enable_accounting(void);
+
+void* mem_alloc(mem_subsys s, size_t size);
+void* mem_calloc(mem_subsys s, size_t count, size_t size);
+void* mem_realloc(mem_subsys s, void* p, size_t size);
+char* mem_strdup(mem_subsys s, const char* str);
+void mem_free(mem_subsys s, void* p);
+
+const char* mem_subsys_name(mem_subsys s);
+void mem_get_usage(mem_subsys s, mem_usage* u); /* s == MEM_SUBSYS_COUNT gives the total */
+
+#endif // _ALLOC__H
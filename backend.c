@@ -1,7 +1,11 @@
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include "backend.h"
 #include "ll.h"
+#include "alloc.h"
+#include "instrument.h"
+#include "log.h"
 
 #define DECLARE_BACKEND_INIT_FUNC(_x) extern int _x##_init()
 #define BACKEND_INIT_FUNC(_x) _x##_init
@@ -29,6 +33,11 @@ static int backend_iter;
 
 int backend_init(void)
 {
+	// a program that uses the library may call this more than once, but each backend must only be
+	// registered once
+	if (num_backends)
+		return 0;
+
 	// here we use the macro BACKEND_COUNT to know how many backends exist. This is different
 	// from num_backends which is how many backends have been registered (initialized successfully).
 	for (int i=0; i < BACKEND_COUNT; i++)
@@ -44,17 +53,17 @@ void backend_register(backend_ops* be)
 {
    if (num_backends >= BACKEND_COUNT)
    {
-      printf("Can't accept any more backends - sorry, we're full! (MAX_BACKENDS=%lu)\n", BACKEND_COUNT);
+      log_error("Can't accept any more backends - sorry, we're full! (MAX_BACKENDS=%lu)\n", BACKEND_COUNT);
       return;
    }
 
    if (!be->format)
    {
-      printf("You must implement the format() function\n");
+      log_error("You must implement the format() function\n");
       return;
    }
 
-	printf("registering backend %s\n", be->name());
+	log_debug("registering backend %s\n", be->name());
 
    backend[num_backends++] = be;
    //printf("num backends %i\n", num_backends);
@@ -96,7 +105,7 @@ const char* backend_get_next_target(void)
 
 backend_object* backend_create(void)
 {
-   backend_object* obj = calloc(1, sizeof(backend_object));
+   backend_object* obj = mem_calloc(MEM_OTHER, 1, sizeof(backend_object));
    return obj;
 }
 
@@ -116,6 +125,11 @@ backend_object* backend_read(const char* filename)
 int backend_write(backend_object* obj, const char* filename)
 {
 	//printf("backend_write looking for type %i\n", obj->type);
+
+	// an existing file is replaced instead of written through: it may be a link to (or a read-only copy
+	// of) a file in the result cache
+	unlink(filename);
+
    // run through all backends until we find one that matches the output format
    for (int i=0; i < num_backends; i++)
    {
@@ -146,7 +160,7 @@ backend_type backend_get_type(backend_object* obj)
 
 void backend_set_entry_point(backend_object* obj, unsigned long addr)
 {
-	printf("Setting entry point to 0x%lx\n", addr);
+	log_debug("Setting entry point to 0x%lx\n", addr);
 	obj->entry = addr;
 }
 
@@ -163,7 +177,7 @@ static void dump_symbol_table(backend_object* obj)
    for (const list_node* iter=ll_iter_start(obj->symbol_table); iter != NULL; iter=iter->next)
 	{
 		backend_symbol *bs = iter->val;
-		printf("** %s 0x%lx\n", bs->name, bs->val);
+		log_debug("** %s 0x%lx\n", bs->name, bs->val);
 	}
 }
 
@@ -180,13 +194,14 @@ backend_symbol* backend_add_symbol(backend_object* obj, const char* name, unsign
    if (!obj->symbol_table)
       obj->symbol_table = ll_init();
 
-   backend_symbol* s = malloc(sizeof(backend_symbol));
-   s->name = strdup(name);
+   backend_symbol* s = mem_alloc(MEM_SYMBOLS, sizeof(backend_symbol));
+   s->name = mem_strdup(MEM_STRINGS, name);
    s->val = val;
    s->type = type;
 	s->size = size;
    s->flags = flags;
    s->section = sec;
+	s->_index = (unsigned int)-1;
    //printf("Adding %s type=%i size=0x%lx val=0x%lx\n", s->name, s->type, s->size, s->val);
 
 	if (type == SYMBOL_TYPE_SECTION)
@@ -202,6 +217,8 @@ backend_symbol* backend_get_first_symbol(backend_object* obj)
    if (!obj->symbol_table)
       return NULL;
    obj->iter_symbol = ll_iter_start(obj->symbol_table);
+   if (!obj->iter_symbol)
+      return NULL;
    return obj->iter_symbol->val;
 }
 
@@ -217,11 +234,13 @@ backend_symbol* backend_find_symbol_by_val(backend_object* obj, unsigned long va
 {
 	backend_symbol* bs;
 
+	INSTRUMENT_CALL(LOOKUP_SYMBOL_BY_VAL);
    if (!obj->symbol_table)
       return NULL;
 
    for (const list_node* iter=ll_iter_start(obj->symbol_table); iter != NULL; iter=iter->next)
 	{
+		INSTRUMENT_VISIT(LOOKUP_SYMBOL_BY_VAL);
 		bs = iter->val;
 		//printf("** %s 0x%lx\n", bs->name, bs->val);
 		if (bs->val == val)
@@ -233,11 +252,13 @@ backend_symbol* backend_find_symbol_by_val(backend_object* obj, unsigned long va
 
 backend_symbol* backend_find_symbol_by_name(backend_object* obj, const char* name)
 {
+	INSTRUMENT_CALL(LOOKUP_SYMBOL_BY_NAME);
    if (!obj || !obj->symbol_table)
       return NULL;
 
    for (const list_node* iter=ll_iter_start(obj->symbol_table); iter != NULL; iter=iter->next)
 	{
+		INSTRUMENT_VISIT(LOOKUP_SYMBOL_BY_NAME);
 		backend_symbol *bs = iter->val;
 		//printf("++ %s\n", bs->name);
 		if (bs->name && strcmp(bs->name, name) == 0)
@@ -249,12 +270,14 @@ backend_symbol* backend_find_symbol_by_name(backend_object* obj, const char* nam
 
 backend_symbol* backend_find_symbol_by_index(backend_object* obj, unsigned int index)
 {
+	INSTRUMENT_CALL(LOOKUP_SYMBOL_BY_INDEX);
    if (!obj || !obj->symbol_table)
       return NULL;
 
    const list_node* iter=ll_iter_start(obj->symbol_table);
 	for (unsigned int i=0; i < index; i++)
 	{
+		INSTRUMENT_VISIT(LOOKUP_SYMBOL_BY_INDEX);
 		if (!iter)
 			return NULL;
 		iter=iter->next;
@@ -300,12 +323,14 @@ unsigned int backend_get_symbol_index(backend_object* obj, backend_symbol* s)
 {
 	unsigned int count = 0;
 
+	INSTRUMENT_CALL(LOOKUP_SYMBOL_INDEX);
    if (!obj || !obj->symbol_table || !s)
       return (unsigned int)-1;
 
 	//printf("+ %s\n", s->name);
    for (const list_node* iter=ll_iter_start(obj->symbol_table); iter != NULL; iter=iter->next)
 	{
+		INSTRUMENT_VISIT(LOOKUP_SYMBOL_INDEX);
 		//printf("** %s\n", ((backend_symbol*)(iter->val))->name);
 		if (iter->val == s)
 			return count;
@@ -315,6 +340,17 @@ unsigned int backend_get_symbol_index(backend_object* obj, backend_symbol* s)
 	return (unsigned int)-1;
 }
 
+void backend_index_symbols(backend_object* obj)
+{
+	unsigned int index = 0;
+
+   if (!obj || !obj->symbol_table)
+      return;
+
+   for (const list_node* iter=ll_iter_start(obj->symbol_table); iter != NULL; iter=iter->next)
+		((backend_symbol*)iter->val)->_index = index++;
+}
+
 static int cmp_by_name(void* a, const void* b)
 {
 	backend_symbol* s = a;
@@ -333,8 +369,8 @@ int backend_remove_symbol_by_name(backend_object* obj, const char* name)
 	if (bs)
 	{
 		//printf("removing symbol %s\n", bs->name);
-		free(bs->name);
-		free(bs);
+		mem_free(MEM_STRINGS, bs->name);
+		mem_free(MEM_SYMBOLS, bs);
 		return 0;
 	}
 
@@ -348,38 +384,37 @@ int backend_sort_symbols(backend_object* obj)
    if (!obj || !obj->symbol_table)
       return 0;
 
-	// assume the first symbol is not a section
-	list_node* temp = NULL;
-	list_node* insert = NULL;
-	list_node* prev = obj->symbol_table->head;
-	list_node* n = prev->next;
+	// move the section symbols to the front of the list, keeping everything else in the same order
+	list_node* sections = NULL;
+	list_node* others = NULL;
+	list_node** sections_end = &sections;
+	list_node** others_end = &others;
+	list_node* last_section = NULL;
+	list_node* last_other = NULL;
+	list_node* n = obj->symbol_table->head;
 	while (n)
 	{
+		list_node* next = n->next;
 		if (((backend_symbol*)n->val)->type == SYMBOL_TYPE_SECTION)
 		{
 			//printf("Section symbol %s\n", ((backend_symbol*)n->val)->name);
-
-			// extract the node
-			temp = n;
-			prev->next = n->next;
-
-			// insert it sorted
-			if (!insert)
-			{
-				temp->next = obj->symbol_table->head;
-				obj->symbol_table->head = temp;
-				insert = temp;
-			}
-			else
-			{
-				temp->next = insert->next;
-				insert = temp;
-				insert = insert->next;
-			}
+			*sections_end = n;
+			sections_end = &n->next;
+			last_section = n;
+		}
+		else
+		{
+			*others_end = n;
+			others_end = &n->next;
+			last_other = n;
 		}
-		prev = n;
-		n = n->next;
+		n = next;
 	}
+	*others_end = NULL;
+	*sections_end = others;
+
+	obj->symbol_table->head = sections;
+	obj->symbol_table->tail = last_other ? last_other : last_section;
 
 	//dump_symbol_table(obj);
 	return 0;
@@ -404,17 +439,20 @@ backend_section* backend_add_section(backend_object* obj, char* name, unsigned l
    if (!obj->section_table)
       obj->section_table = ll_init();
 
-   backend_section* s = malloc(sizeof(backend_section));
+   backend_section* s = mem_alloc(MEM_SECTIONS, sizeof(backend_section));
 	if (!s)
 		return NULL;
 
-   s->name = strdup(name);
+   s->name = mem_strdup(MEM_STRINGS, name);
    s->size = size;
    s->address = address;
    s->flags = flags;
 	s->entry_size = entry_size;
    s->data = data;
 	s->alignment = alignment;
+	s->_index = -1;
+	s->_link = NULL;
+	s->_relocs = NULL;
    //printf("Adding section %s size:%i address:0x%lx entry size: %i flags:0x%x alignment %i\n", s->name, s->size, s->address, s->entry_size, s->flags, s->alignment);
    ll_add(obj->section_table, s);
    //printf("There are %i sections\n", backend_section_count(obj));
@@ -424,8 +462,10 @@ backend_section* backend_add_section(backend_object* obj, char* name, unsigned l
 backend_section* backend_get_section_by_index(backend_object* obj, unsigned int index)
 {
 	int i=1;
+	INSTRUMENT_CALL(LOOKUP_SECTION_BY_INDEX);
    for (const list_node* iter=ll_iter_start(obj->section_table); iter != NULL; iter=iter->next)
    {
+		INSTRUMENT_VISIT(LOOKUP_SECTION_BY_INDEX);
       backend_section* sec = iter->val;
 		//printf("++ %i %s\n", sec->index, sec->name);
       if (i++ == index)
@@ -436,8 +476,10 @@ backend_section* backend_get_section_by_index(backend_object* obj, unsigned int
 
 backend_section* backend_find_section_by_val(backend_object* obj, unsigned long val)
 {
+	INSTRUMENT_CALL(LOOKUP_SECTION_BY_VAL);
    for (const list_node* iter=ll_iter_start(obj->section_table); iter != NULL; iter=iter->next)
    {
+		INSTRUMENT_VISIT(LOOKUP_SECTION_BY_VAL);
       backend_section* sec = iter->val;
       if (sec->address <= val && sec->address + sec->size > val)
          return sec;
@@ -447,11 +489,13 @@ backend_section* backend_find_section_by_val(backend_object* obj, unsigned long
 
 backend_section* backend_get_section_by_name(backend_object* obj, const char* name)
 {
+	INSTRUMENT_CALL(LOOKUP_SECTION_BY_NAME);
 	if (!obj || !name || !obj->section_table)
 		return NULL;
 
    for (const list_node* iter=ll_iter_start(obj->section_table); iter != NULL; iter=iter->next)
    {
+		INSTRUMENT_VISIT(LOOKUP_SECTION_BY_NAME);
       backend_section* sec = iter->val;
       //printf(".. %s\n", sec->name);
       if (!strcmp(name, sec->name))
@@ -464,11 +508,13 @@ int backend_get_section_index_by_name(backend_object* obj, const char* name)
 {
 	int index = 0;
 
+	INSTRUMENT_CALL(LOOKUP_SECTION_INDEX_BY_NAME);
 	if (!obj || !name || !obj->section_table)
 		return -1;
 
    for (const list_node* iter=ll_iter_start(obj->section_table); iter != NULL; iter=iter->next)
    {
+		INSTRUMENT_VISIT(LOOKUP_SECTION_INDEX_BY_NAME);
       backend_section* sec = iter->val;
 		//printf("-- %s\n", sec->name);
       if (!strcmp(name, sec->name))
@@ -478,6 +524,17 @@ int backend_get_section_index_by_name(backend_object* obj, const char* name)
    return -1;
 }
 
+void backend_index_sections(backend_object* obj)
+{
+	int index = 1;
+
+	if (!obj || !obj->section_table)
+		return;
+
+   for (const list_node* iter=ll_iter_start(obj->section_table); iter != NULL; iter=iter->next)
+		((backend_section*)iter->val)->_index = index++;
+}
+
 backend_section* backend_get_first_section(backend_object* obj)
 {
    if (!obj->section_table)
@@ -504,11 +561,11 @@ void backend_destructor(backend_object* obj)
       while (s)
       {
          //printf("Popped %s\n", s->name);
-         free(s->name);
-         free(s);
+         mem_free(MEM_STRINGS, s->name);
+         mem_free(MEM_SYMBOLS, s);
          s = ll_pop(obj->symbol_table);
       }
-		free(obj->symbol_table);
+		mem_free(MEM_LISTS, obj->symbol_table);
    }
 
 	if (obj->section_table)
@@ -516,12 +573,18 @@ void backend_destructor(backend_object* obj)
       backend_section* sec = ll_pop(obj->section_table);
 		while (sec)
 		{
-         free(sec->name);
-         free(sec->data);
-			free(sec);
+         mem_free(MEM_STRINGS, sec->name);
+         mem_free(MEM_DATA, sec->data);
+			if (sec->_relocs)
+			{
+				while (ll_pop(sec->_relocs))
+					;
+				mem_free(MEM_LISTS, sec->_relocs);
+			}
+			mem_free(MEM_SECTIONS, sec);
 			sec = ll_pop(obj->section_table);
 		}
-		free(obj->section_table);
+		mem_free(MEM_LISTS, obj->section_table);
    }
 
    if (obj->relocation_table)
@@ -529,10 +592,18 @@ void backend_destructor(backend_object* obj)
 		backend_reloc* r = ll_pop(obj->relocation_table);
 		while (r)
 		{
-			free(r);
+			mem_free(MEM_RELOCATIONS, r);
 			r = ll_pop(obj->relocation_table);
 		}
-		free(obj->relocation_table);
+		mem_free(MEM_LISTS, obj->relocation_table);
+	}
+
+	// the relocations themselves were freed with the relocation table
+	if (obj->text_relocs)
+	{
+		while (ll_pop(obj->text_relocs))
+			;
+		mem_free(MEM_LISTS, obj->text_relocs);
 	}
 
 	if (obj->import_table)
@@ -545,19 +616,21 @@ void backend_destructor(backend_object* obj)
 				backend_symbol* s = ll_pop(i->symbols);
 				while (s)
 				{
-					free(s->name);
-					free(s);
+					mem_free(MEM_STRINGS, s->name);
+					mem_free(MEM_SYMBOLS, s);
 					s = ll_pop(i->symbols);
 				}
-				free(i->symbols);
+				mem_free(MEM_LISTS, i->symbols);
 			}
+			mem_free(MEM_STRINGS, i->name);
+			mem_free(MEM_OTHER, i);
 			i = ll_pop(obj->import_table);
 		}
-		free(obj->import_table);
+		mem_free(MEM_LISTS, obj->import_table);
 	}
 
    // and finally the object itself
-   free(obj);
+   mem_free(MEM_OTHER, obj);
 }
 
 ///////////////////////////////////////////
@@ -570,6 +643,11 @@ unsigned int backend_relocation_count(backend_object* obj)
 }
 
 int backend_add_relocation(backend_object* obj, unsigned long offset, backend_reloc_type t, long addend, backend_symbol* bs)
+{
+	return backend_add_section_relocation(obj, NULL, offset, t, addend, bs);
+}
+
+int backend_add_section_relocation(backend_object* obj, backend_section* sec, unsigned long offset, backend_reloc_type t, long addend, backend_symbol* bs)
 {
    if (!obj)
 		return -1;
@@ -578,22 +656,86 @@ int backend_add_relocation(backend_object* obj, unsigned long offset, backend_re
    if (!obj->relocation_table)
       obj->relocation_table = ll_init();
 
-   backend_reloc* r = malloc(sizeof(backend_reloc));
+   backend_reloc* r = mem_alloc(MEM_RELOCATIONS, sizeof(backend_reloc));
 	r->offset = offset;
 	r->addend = addend;
    r->type = t;
 	r->symbol = bs;
+	r->section = sec;
    ll_add(obj->relocation_table, r);
+
+	// keep the relocations of each section together as well, so writers don't have to search for them
+	linked_list** group = sec ? &sec->_relocs : &obj->text_relocs;
+	if (!*group)
+		*group = ll_init();
+	ll_add(*group, r);
    return 0;
 }
 
+static int is_text(const backend_section* sec)
+{
+	return (strcmp(sec->name, ".text") == 0);
+}
+
+int backend_reloc_in_section(const backend_reloc* r, const backend_section* sec)
+{
+	if (r->section)
+		return r->section == sec;
+	return is_text(sec);
+}
+
+unsigned int backend_section_relocation_count(backend_object* obj, backend_section* sec)
+{
+	unsigned int count = 0;
+
+	if (!obj || !sec)
+		return 0;
+
+	if (sec->_relocs)
+		count += ll_size(sec->_relocs);
+	if (obj->text_relocs && is_text(sec))
+		count += ll_size(obj->text_relocs);
+	return count;
+}
+
+// move on to the list of the section itself when the relocations without a section run out
+static backend_reloc* section_reloc_current(backend_object* obj)
+{
+	if (!obj->iter_section_reloc && obj->iter_section_relocs)
+	{
+		obj->iter_section_reloc = ll_iter_start(obj->iter_section_relocs);
+		obj->iter_section_relocs = NULL;
+	}
+	return obj->iter_section_reloc ? obj->iter_section_reloc->val : NULL;
+}
+
+backend_reloc* backend_get_first_section_reloc(backend_object* obj, backend_section* sec)
+{
+	if (!obj || !sec)
+		return NULL;
+
+	obj->iter_section_reloc = (obj->text_relocs && is_text(sec)) ? ll_iter_start(obj->text_relocs) : NULL;
+	obj->iter_section_relocs = sec->_relocs;
+	return section_reloc_current(obj);
+}
+
+backend_reloc* backend_get_next_section_reloc(backend_object* obj)
+{
+	if (!obj->iter_section_reloc)
+		return NULL;
+	obj->iter_section_reloc = obj->iter_section_reloc->next;
+	return section_reloc_current(obj);
+}
+
 backend_reloc* backend_find_reloc_by_offset(backend_object* obj, unsigned long offset)
 {
+	INSTRUMENT_CALL(LOOKUP_RELOC_BY_OFFSET);
 	if (!obj || !obj->relocation_table)
 		return NULL;
 
    for (const list_node* iter=ll_iter_start(obj->relocation_table); iter != NULL; iter=iter->next)
    {
+		INSTRUMENT_VISIT(LOOKUP_RELOC_BY_OFFSET);
       backend_reloc* rel = iter->val;
 		if (rel->offset == offset)
 			return rel;
@@ -642,8 +784,8 @@ backend_import* backend_add_import_module(backend_object* obj, const char* name)
    if (!obj->import_table)
       obj->import_table = ll_init();
 
-   backend_import* i = malloc(sizeof(backend_import));
-	i->name = strdup(name);
+   backend_import* i = mem_alloc(MEM_OTHER, sizeof(backend_import));
+	i->name = mem_strdup(MEM_STRINGS, name);
 	i->symbols = NULL;
    ll_add(obj->import_table, i);
    return i;
@@ -651,11 +793,13 @@ backend_import* backend_add_import_module(backend_object* obj, const char* name)
 
 backend_import* backend_find_import_module_by_name(backend_object* obj, const char* name)
 {
+	INSTRUMENT_CALL(LOOKUP_IMPORT_MODULE_BY_NAME);
    if (!obj || !obj->import_table)
 		return NULL;
 
    for (const list_node* iter=ll_iter_start(obj->import_table); iter != NULL; iter=iter->next)
    {
+		INSTRUMENT_VISIT(LOOKUP_IMPORT_MODULE_BY_NAME);
       backend_import* i = iter->val;
 		if (strcmp(i->name, name) == 0)
 			return i;
@@ -672,19 +816,21 @@ backend_symbol* backend_add_import_function(backend_import* mod, const char* nam
    if (!mod->symbols)
       mod->symbols = ll_init();
 
-   backend_symbol* s = malloc(sizeof(backend_symbol));
-	s->name = strdup(name);
+   backend_symbol* s = mem_alloc(MEM_SYMBOLS, sizeof(backend_symbol));
+	s->name = mem_strdup(MEM_STRINGS, name);
 	s->val = addr;
 	s->type = SYMBOL_TYPE_FUNCTION;
 	s->flags = SYMBOL_FLAG_GLOBAL | SYMBOL_FLAG_EXTERNAL;
 	s->size = 0;
 	s->section = NULL;
+	s->_index = (unsigned int)-1;
    ll_add(mod->symbols, s);
    return s;
 }
 
 backend_symbol* backend_find_import_by_address(backend_object* obj, unsigned long addr)
 {
+	INSTRUMENT_CALL(LOOKUP_IMPORT_BY_ADDRESS);
    if (!obj || !obj->import_table)
 		return NULL;
 
@@ -695,6 +841,7 @@ backend_symbol* backend_find_import_by_address(backend_object* obj, unsigned lon
 		{
    		for (const list_node* s_iter=ll_iter_start(i->symbols); s_iter != NULL; s_iter=s_iter->next)
 			{
+				INSTRUMENT_VISIT(LOOKUP_IMPORT_BY_ADDRESS);
 				backend_symbol* s = s_iter->val;
 				//printf("++ %s (0x%lx)\n", s->name, s->val);
 				if (s && s->val == addr)
@@ -5,6 +5,9 @@ public functions for talking to backends */
 
 /* To add a new backend, read instructions in backend.c */
 
+#ifndef _BACKEND__H
+#define _BACKEND__H
+
 #include "ll.h"
 
 #define SECTION_FLAG_CODE 			(1<<SECTION_FLAG_SHIFT_CODE)
@@ -75,6 +78,9 @@ typedef struct backend_section
 	unsigned int entry_size;
 ////// private data ///////
 	int _name;					// used to hold the index into the string table when writing
+	int _index;					// index in the section table of the file that is being written - see backend_index_sections()
+	struct backend_section* _link;	// used when writing: a code section and its .rela section point at each other
+	linked_list* _relocs;	// the relocations that were added for this section
 } backend_section;
 
 typedef struct backend_symbol
@@ -85,6 +91,8 @@ typedef struct backend_symbol
    unsigned int flags; // see SYMBOL_FLAGS_
 	unsigned long size;
    backend_section* section;
+////// private data ///////
+	unsigned int _index;		// index in the symbol table of the file that is being written - see backend_index_symbols()
 } backend_symbol;
 
 typedef struct backend_reloc
@@ -93,6 +101,7 @@ typedef struct backend_reloc
 	long addend;
 	backend_reloc_type type;
 	backend_symbol* symbol;
+	backend_section* section;	// the section that is being relocated (NULL = .text)
 } backend_reloc;
 
 // an import is a module containing a name, and a list of function symbols that the code
@@ -114,11 +123,14 @@ typedef struct backend_object
    linked_list* symbol_table;
    linked_list* relocation_table;
    linked_list* import_table;
+   linked_list* text_relocs;	// the relocations that were added without a section, which apply to .text
 
    const list_node* iter_symbol;
    const list_node* iter_symbol_t;
    const list_node* iter_section;
    const list_node* iter_reloc;
+   const list_node* iter_section_reloc;
+   const linked_list* iter_section_relocs;	// the list to carry on with after iter_section_reloc
 } backend_object;
 
 // the interface that must be implemented by a particular backend implementation - mainly for serializing to disk (and deserializing from disk)
@@ -158,6 +170,7 @@ backend_symbol* backend_find_symbol_by_val(backend_object* obj, unsigned long va
 backend_symbol* backend_find_symbol_by_name(backend_object* obj, const char* name);
 backend_symbol* backend_find_symbol_by_index(backend_object* obj, unsigned int index);
 unsigned int backend_get_symbol_index(backend_object* obj, backend_symbol* s); // if the symbol table were to be serialized, what would be the index of this symbol in the table?
+void backend_index_symbols(backend_object* obj); /* store the index of every symbol in the table in its _index, so writers don't have to search for it */
 int backend_remove_symbol_by_name(backend_object* obj, const char* name);
 int backend_sort_symbols(backend_object* obj);
 
@@ -168,12 +181,18 @@ backend_section* backend_find_section_by_val(backend_object* obj, unsigned long
 backend_section* backend_get_section_by_index(backend_object* obj, unsigned int index);
 backend_section* backend_get_section_by_name(backend_object* obj, const char* name);
 int backend_get_section_index_by_name(backend_object* obj, const char* name);
+void backend_index_sections(backend_object* obj); /* store the index of every section (from 1, like backend_get_section_index_by_name) in its _index */
 backend_section* backend_get_first_section(backend_object* obj);
 backend_section* backend_get_next_section(backend_object* obj);
 
 // relocations
 unsigned int backend_relocation_count(backend_object* obj);
 int backend_add_relocation(backend_object* obj, unsigned long offset, backend_reloc_type t, long addend, backend_symbol* bs);
+int backend_add_section_relocation(backend_object* obj, backend_section* sec, unsigned long offset, backend_reloc_type t, long addend, backend_symbol* bs); /* relocation in a section other than .text */
+unsigned int backend_section_relocation_count(backend_object* obj, backend_section* sec); /* number of relocations that apply to one section */
+backend_reloc* backend_get_first_section_reloc(backend_object* obj, backend_section* sec); /* iterate over the relocations that apply to one section */
+backend_reloc* backend_get_next_section_reloc(backend_object* obj);
+int backend_reloc_in_section(const backend_reloc* r, const backend_section* sec); /* does the relocation apply to this section? */
 backend_reloc* backend_find_reloc_by_offset(backend_object* obj, unsigned long val);
 backend_reloc* backend_get_first_reloc(backend_object* obj);
 backend_reloc* backend_get_next_reloc(backend_object* obj);
@@ -184,3 +203,5 @@ backend_import* backend_add_import_module(backend_object* obj, const char* name)
 backend_import* backend_find_import_module_by_name(backend_object* obj, const char* name);
 backend_symbol* backend_add_import_function(backend_import* mod, const char* name, unsigned long val);
 backend_symbol* backend_find_import_by_address(backend_object* obj, unsigned long addr);
+
+#endif // _BACKEND__H
@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "batch.h"
+#include "alloc.h"
+#include "log.h"
+
+// estimated memory for delinking an input, for each byte of the file (measured on ELF64 binaries,
+// where the peak heap use was 9-17 times the size of the file)
+#define BATCH_MEMORY_FACTOR 16
+
+// the inputs that are waiting to be delinked, shared by all of the worker threads
+typedef struct batch_queue
+{
+	batch* b;
+	backend_type target;
+	unsigned int next;			// index of the next input to start
+	unsigned long max_memory;
+	unsigned long in_use;		// estimated memory of the inputs in progress
+	pthread_mutex_t lock;
+	pthread_cond_t done;			// signalled whenever an input is finished
+} batch_queue;
+
+static unsigned long now_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000UL + t.tv_nsec;
+}
+
+int batch_add_file(batch* b, const char* filename)
+{
+	struct stat st;
+
+	if (b->count == b->max)
+	{
+		unsigned int max = b->max ? b->max * 2 : 64;
+		batch_input* inputs = mem_realloc(MEM_WORK, b->inputs, sizeof(batch_input) * max);
+		if (!inputs)
+			return -1;
+		b->inputs = inputs;
+		b->max = max;
+	}
+
+	batch_input* in = &b->inputs[b->count++];
+	memset(in, 0, sizeof(batch_input));
+	in->filename = mem_strdup(MEM_STRINGS, filename);
+	if (stat(filename, &st) == 0)
+		in->memory = st.st_size * BATCH_MEMORY_FACTOR;
+	return 0;
+}
+
+int batch_add_list(batch* b, const char* list_filename)
+{
+	char line[4096];
+
+	FILE* f = fopen(list_filename, "r");
+	if (!f)
+		return -1;
+
+	while (fgets(line, sizeof(line), f))
+	{
+		line[strcspn(line, "\r\n")] = 0;
+		if (line[0] && line[0] != '#')
+			batch_add_file(b, line);
+	}
+	fclose(f);
+	return 0;
+}
+
+int batch_make_dir(const char* dir)
+{
+	char path[4096];
+
+	snprintf(path, sizeof(path), "%s", dir);
+	for (char* p = path + 1; *p; p++)
+	{
+		if (*p != '/')
+			continue;
+		*p = 0;
+		if (mkdir(path, 0777) && errno != EEXIST)
+			return -1;
+		*p = '/';
+	}
+	if (mkdir(path, 0777) && errno != EEXIST)
+		return -1;
+	return 0;
+}
+
+static const char* base_name(const char* filename)
+{
+	const char* slash = strrchr(filename, '/');
+	return slash ? slash + 1 : filename;
+}
+
+static int cmp_input_name(const void* a, const void* b)
+{
+	const batch_input* ia = *(const batch_input**)a;
+	const batch_input* ib = *(const batch_input**)b;
+	int ret = strcmp(base_name(ia->filename), base_name(ib->filename));
+	if (ret)
+		return ret;
+	return (ia > ib) - (ia < ib);
+}
+
+// Name the output directory of each input after the input file. Inputs with the same name (from
+// different directories) get the number of their place in the batch added, except for the first one.
+static void name_output_dirs(batch* b, const char* output_dir)
+{
+	batch_input** sorted = mem_alloc(MEM_WORK, sizeof(batch_input*) * b->count);
+	for (unsigned int i=0; i < b->count; i++)
+		sorted[i] = &b->inputs[i];
+	qsort(sorted, b->count, sizeof(batch_input*), cmp_input_name);
+
+	for (unsigned int i=0; i < b->count; i++)
+	{
+		batch_input* in = sorted[i];
+		const char* name = base_name(in->filename);
+		int duplicate = (i > 0 && strcmp(name, base_name(sorted[i-1]->filename)) == 0);
+		unsigned long len = strlen(output_dir) + strlen(name) + 16;
+
+		in->output_dir = mem_alloc(MEM_STRINGS, len);
+		if (duplicate)
+			snprintf(in->output_dir, len, "%s/%s.%u", output_dir, name, (unsigned int)(in - b->inputs));
+		else
+			snprintf(in->output_dir, len, "%s/%s", output_dir, name);
+	}
+	mem_free(MEM_WORK, sorted);
+}
+
+static unsigned int count_objects(const char* dir)
+{
+	unsigned int count = 0;
+	struct dirent* e;
+
+	DIR* d = opendir(dir);
+	if (!d)
+		return 0;
+	while ((e = readdir(d)))
+	{
+		unsigned long len = strlen(e->d_name);
+		if (len > 2 && strcmp(e->d_name + len - 2, ".o") == 0)
+			count++;
+	}
+	closedir(d);
+	return count;
+}
+
+static void* batch_worker(void* arg)
+{
+	batch_queue* q = arg;
+
+	pthread_mutex_lock(&q->lock);
+	while (q->next < q->b->count)
+	{
+		batch_input* in = &q->b->inputs[q->next];
+
+		// wait for the inputs in progress to make room, unless there are none
+		if (q->max_memory && q->in_use && q->in_use + in->memory > q->max_memory)
+		{
+			pthread_cond_wait(&q->done, &q->lock);
+			continue;
+		}
+		q->next++;
+		q->in_use += in->memory;
+		pthread_mutex_unlock(&q->lock);
+
+		// the input streams within the memory that was set aside for it, so that all of the inputs in
+		// progress stay under the limit together
+		unsigned long share = q->max_memory;
+		if (in->memory && in->memory < share)
+			share = in->memory;
+
+		unsigned long start = now_ns();
+		if (access(in->filename, R_OK))
+		{
+			log_error("Can't open input file %s\n", in->filename);
+			in->ret = -ERR_BAD_FILE;
+		}
+		else if (batch_make_dir(in->output_dir))
+		{
+			log_error("Can't create the output directory %s\n", in->output_dir);
+			in->ret = -ERR_BAD_FILE;
+		}
+		else
+		{
+			log_info("Delinking %s to %s\n", in->filename, in->output_dir);
+			in->ret = unlink_file_limit(in->filename, in->output_dir, q->target, share);
+			in->objects = count_objects(in->output_dir);
+		}
+		in->wall_ns = now_ns() - start;
+
+		pthread_mutex_lock(&q->lock);
+		q->in_use -= in->memory;
+		pthread_cond_broadcast(&q->done);
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return NULL;
+}
+
+int batch_run(batch* b, const char* output_dir, backend_type output_target, int workers, unsigned long max_memory)
+{
+	batch_queue q = { b, output_target, 0, max_memory, 0 };
+	pthread_t* threads;
+	unsigned int started = 0;
+	int failed = 0;
+
+	if (!output_dir)
+		output_dir = ".";
+	name_output_dirs(b, output_dir);
+
+	if (workers <= 0)
+		workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers > (int)b->count)
+		workers = b->count;
+
+	pthread_mutex_init(&q.lock, NULL);
+	pthread_cond_init(&q.done, NULL);
+	threads = mem_alloc(MEM_WORK, sizeof(pthread_t) * (workers + 1));
+	for (int i=1; i < workers; i++)
+	{
+		if (pthread_create(&threads[started], NULL, batch_worker, &q))
+		{
+			log_warn("Can't start thread %i - continuing with %u\n", i, started + 1);
+			break;
+		}
+		started++;
+	}
+
+	// the main thread does its share of the work too
+	batch_worker(&q);
+
+	for (unsigned int i=0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	pthread_cond_destroy(&q.done);
+	pthread_mutex_destroy(&q.lock);
+	mem_free(MEM_WORK, threads);
+
+	for (unsigned int i=0; i < b->count; i++)
+		if (b->inputs[i].ret < 0)
+			failed++;
+	return failed;
+}
+
+void batch_report(const batch* b, FILE* f)
+{
+	unsigned int failed = 0;
+
+	fprintf(f, "%-40s %-32s %8s %10s  %s\n", "input", "result", "objects", "ms", "output");
+	for (unsigned int i=0; i < b->count; i++)
+	{
+		const batch_input* in = &b->inputs[i];
+		if (in->ret < 0)
+			failed++;
+		fprintf(f, "%-40s %-32s %8u %10.1f  %s\n", in->filename, delinker_error_name(in->ret), in->objects,
+			in->wall_ns / 1e6, in->output_dir);
+	}
+	fprintf(f, "%u inputs, %u delinked, %u failed\n", b->count, b->count - failed, failed);
+}
+
+void batch_free(batch* b)
+{
+	for (unsigned int i=0; i < b->count; i++)
+	{
+		mem_free(MEM_STRINGS, b->inputs[i].filename);
+		mem_free(MEM_STRINGS, b->inputs[i].output_dir);
+	}
+	mem_free(MEM_WORK, b->inputs);
+	memset(b, 0, sizeof(batch));
+}
@@ -0,0 +1,44 @@
+/* Batch mode
+
+Delinks many input files in one process, with a pool of worker threads that each run the whole
+pipeline on one input at a time. The objects of each input are written to a directory of their own,
+named after the input file (with a number added when two inputs have the same name), under a common
+output directory. The memory is bounded by estimating the memory of each input from its size: a new
+input is only started when the inputs that are in progress leave enough room for it (one input is
+always allowed, however big it is), and it streams its output within its estimate rather than the
+whole limit. The result of each input is kept for the report at the end. */
+
+#ifndef _BATCH__H
+#define _BATCH__H
+
+#include <stdio.h>
+#include "delinker.h"
+
+typedef struct batch_input
+{
+	char* filename;
+	char* output_dir;			// where its objects are written
+	unsigned long memory;	// estimated memory for delinking it
+	int ret;						// 0 or -ERR_ from unlink_file()
+	unsigned int objects;	// objects in output_dir when it was done
+	unsigned long wall_ns;
+} batch_input;
+
+typedef struct batch
+{
+	batch_input* inputs;
+	unsigned int count;
+	unsigned int max;
+} batch;
+
+int batch_add_file(batch* b, const char* filename);
+int batch_add_list(batch* b, const char* list_filename); /* one input per line - returns -1 if the list can't be read */
+
+/* workers = 0 for one per CPU, max_memory = 0 for no limit - returns the number of inputs that failed */
+int batch_run(batch* b, const char* output_dir, backend_type output_target, int workers, unsigned long max_memory);
+void batch_report(const batch* b, FILE* f);
+void batch_free(batch* b);
+
+int batch_make_dir(const char* dir); /* creates the missing parents too */
+
+#endif // _BATCH__H
@@ -0,0 +1,282 @@
+/* Microbenchmarks for the backend tables
+
+Times the core operations of backend.c on tables of growing size, and counts the memory
+allocations they make, so changes to the object model can be compared on numbers. Each operation
+reports the time and the number of allocations (malloc, calloc, realloc, strdup) and frees per
+operation. The allocation functions are wrapped at link time (-Wl,--wrap), so only the calls made
+by the backend and by this file are counted.
+
+The lookups are run on randomly chosen entries that are known to be in the table, for as many
+operations as fit in the time budget. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include "backend.h"
+
+#define MIN_SIZE 1000
+#define NAME_LEN 32
+#define SECTION_SIZE 0x100
+
+static struct option options[] =
+{
+  {"max-size", required_argument, 0, 'n'},
+  {"time", required_argument, 0, 't'},
+  {"filter", required_argument, 0, 'f'},
+  {0, no_argument, 0, 0}
+};
+
+struct config
+{
+	unsigned long max_size;		// largest table to test
+	unsigned long budget_ms;	// time to spend on each lookup benchmark
+	const char* filter;			// only run the operations whose names contain this
+} config = { 1000000, 200, NULL };
+
+static unsigned long allocs;
+static unsigned long frees;
+static unsigned long rng_state = 1;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* p, size_t size);
+char* __real_strdup(const char* s);
+void __real_free(void* p);
+
+void* __wrap_malloc(size_t size) { allocs++; return __real_malloc(size); }
+void* __wrap_calloc(size_t n, size_t size) { allocs++; return __real_calloc(n, size); }
+void* __wrap_realloc(void* p, size_t size) { allocs++; return __real_realloc(p, size); }
+char* __wrap_strdup(const char* s) { allocs++; return __real_strdup(s); }
+void __wrap_free(void* p) { if (p) frees++; __real_free(p); }
+
+static unsigned long rng(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545F4914F6CDD1DUL;
+}
+
+static unsigned long now_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000UL + t.tv_nsec;
+}
+
+static void symbol_name(char* name, unsigned long i)
+{
+	snprintf(name, NAME_LEN, "sym_%lu", i);
+}
+
+// the value of symbol i - spaced out like functions in a code section
+static unsigned long symbol_val(unsigned long i)
+{
+	return 0x400000 + i * 16;
+}
+
+typedef struct measure
+{
+	unsigned long start;
+	unsigned long allocs;
+	unsigned long frees;
+} measure;
+
+static void measure_start(measure* m)
+{
+	m->allocs = allocs;
+	m->frees = frees;
+	m->start = now_ns();
+}
+
+static void measure_report(measure* m, const char* op, unsigned long size, unsigned long ops)
+{
+	unsigned long ns = now_ns() - m->start;
+	if (!ops)
+		ops = 1;
+	printf("%-32s %10lu %10lu %12.1f %10.2f %10.2f\n", op, size, ops, (double)ns / ops,
+		(double)(allocs - m->allocs) / ops, (double)(frees - m->frees) / ops);
+	fflush(stdout);
+}
+
+static int enabled(const char* op)
+{
+	return !config.filter || strstr(op, config.filter);
+}
+
+// is the time budget for a lookup benchmark used up? 'ops' lookups have been done so far
+static int budget_done(const measure* m, unsigned long ops, unsigned long size)
+{
+	if (ops >= size)
+		return 1;
+	// only look at the clock every few operations, unless the lookups are slow
+	if (ops > 64 && ops % 64)
+		return 0;
+	return now_ns() - m->start >= config.budget_ms * 1000000UL;
+}
+
+static backend_object* make_symbols(unsigned long size)
+{
+	char name[NAME_LEN];
+	backend_object* obj = backend_create();
+	for (unsigned long i=0; i < size; i++)
+	{
+		symbol_name(name, i);
+		backend_add_symbol(obj, name, symbol_val(i), SYMBOL_TYPE_FUNCTION, 16, 0, NULL);
+	}
+	return obj;
+}
+
+static void bench_symbols(unsigned long size)
+{
+	char name[NAME_LEN];
+	measure m;
+	backend_object* obj;
+	unsigned long ops;
+
+	measure_start(&m);
+	obj = make_symbols(size);
+	if (enabled("backend_add_symbol"))
+		measure_report(&m, "backend_add_symbol", size, size);
+
+	if (enabled("backend_find_symbol_by_name"))
+	{
+		measure_start(&m);
+		for (ops=0; !budget_done(&m, ops, size); ops++)
+		{
+			symbol_name(name, rng() % size);
+			if (!backend_find_symbol_by_name(obj, name))
+				fprintf(stderr, "missing symbol %s\n", name);
+		}
+		measure_report(&m, "backend_find_symbol_by_name", size, ops);
+	}
+
+	if (enabled("backend_find_symbol_by_val"))
+	{
+		measure_start(&m);
+		for (ops=0; !budget_done(&m, ops, size); ops++)
+		{
+			if (!backend_find_symbol_by_val(obj, symbol_val(rng() % size)))
+				fprintf(stderr, "missing symbol value\n");
+		}
+		measure_report(&m, "backend_find_symbol_by_val", size, ops);
+	}
+
+	if (enabled("backend_get_symbol_index"))
+	{
+		// collect the symbols first, so the lookups are the only thing that is timed
+		backend_symbol** syms = malloc(sizeof(backend_symbol*) * size);
+		unsigned long i = 0;
+		for (backend_symbol* s = backend_get_first_symbol(obj); s; s = backend_get_next_symbol(obj))
+			syms[i++] = s;
+
+		measure_start(&m);
+		for (ops=0; !budget_done(&m, ops, size); ops++)
+		{
+			if (backend_get_symbol_index(obj, syms[rng() % size]) == (unsigned int)-1)
+				fprintf(stderr, "missing symbol index\n");
+		}
+		measure_report(&m, "backend_get_symbol_index", size, ops);
+		free(syms);
+	}
+
+	measure_start(&m);
+	backend_destructor(obj);
+	if (enabled("backend_destructor (symbols)"))
+		measure_report(&m, "backend_destructor (symbols)", size, size);
+}
+
+static void bench_sections(unsigned long size)
+{
+	char name[NAME_LEN];
+	measure m;
+	unsigned long ops;
+
+	if (!enabled("backend_find_section_by_val"))
+		return;
+
+	backend_object* obj = backend_create();
+	for (unsigned long i=0; i < size; i++)
+	{
+		snprintf(name, sizeof(name), ".text.%lu", i);
+		backend_add_section(obj, name, SECTION_SIZE, 0x400000 + i * SECTION_SIZE, NULL, 0, 4, SECTION_FLAG_CODE);
+	}
+
+	measure_start(&m);
+	for (ops=0; !budget_done(&m, ops, size); ops++)
+	{
+		unsigned long val = 0x400000 + (rng() % size) * SECTION_SIZE + rng() % SECTION_SIZE;
+		if (!backend_find_section_by_val(obj, val))
+			fprintf(stderr, "missing section\n");
+	}
+	measure_report(&m, "backend_find_section_by_val", size, ops);
+	backend_destructor(obj);
+}
+
+static void bench_relocations(unsigned long size)
+{
+	measure m;
+
+	if (!enabled("backend_add_relocation") && !enabled("backend_destructor (relocations)"))
+		return;
+
+	backend_object* obj = backend_create();
+	backend_symbol* sym = backend_add_symbol(obj, "target", 0, SYMBOL_TYPE_FUNCTION, 16, 0, NULL);
+
+	measure_start(&m);
+	for (unsigned long i=0; i < size; i++)
+		backend_add_relocation(obj, i * 8, RELOC_TYPE_PC_RELATIVE, -4, sym);
+	if (enabled("backend_add_relocation"))
+		measure_report(&m, "backend_add_relocation", size, size);
+
+	measure_start(&m);
+	backend_destructor(obj);
+	if (enabled("backend_destructor (relocations)"))
+		measure_report(&m, "backend_destructor (relocations)", size, size);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "bench_backend times the backend table operations on tables of growing size\n");
+	fprintf(stderr, "bench_backend [options]\n");
+	fprintf(stderr, "  -n, --max-size <n>   largest table, from %u up by 10x each time (%lu)\n", MIN_SIZE, config.max_size);
+	fprintf(stderr, "  -t, --time <ms>      time to spend on each lookup benchmark (%lu)\n", config.budget_ms);
+	fprintf(stderr, "  -f, --filter <name>  only run the operations whose names contain this\n");
+}
+
+int
+main (int argc, char *argv[])
+{
+	int c;
+	while ((c = getopt_long(argc, argv, "n:t:f:", options, 0)) != -1)
+	{
+		switch (c)
+		{
+		case 'n':
+			config.max_size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			config.budget_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			config.filter = optarg;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	printf("%-32s %10s %10s %12s %10s %10s\n", "operation", "size", "ops", "ns/op", "allocs/op", "frees/op");
+	for (unsigned long size=MIN_SIZE; size <= config.max_size; size *= 10)
+	{
+		bench_symbols(size);
+		bench_sections(size);
+		bench_relocations(size);
+	}
+
+	return 0;
+}
@@ -0,0 +1,267 @@
+/* Corpus benchmark
+
+Runs the whole delinking pipeline (read, analysis, build_relocations, emit) on every ELF64 file in a
+directory of real binaries, such as /usr/bin, and prints a table with the throughput (MB/s of .text),
+the number of symbols, relocations and objects, and the result of each one. The pipeline is called
+in-process, through unlink_file(), from a child process for each binary, so a crash or a hang is
+recorded as a failure of that binary instead of stopping the run. The objects are written to a
+temporary directory that is removed afterwards. */
+
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <signal.h>
+#include <ftw.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "delinker.h"
+#include "stats.h"
+#include "log.h"
+
+#define STATUS_TIMEOUT	-100
+#define STATUS_CRASH		-101
+
+static struct option options[] =
+{
+  {"reconstruct-symbols", no_argument, 0, 'R'},
+  {"fill-gaps", no_argument, 0, 'G'},
+  {"max-files", required_argument, 0, 'n'},
+  {"timeout", required_argument, 0, 't'},
+  {"verbose", no_argument, 0, 'v'},
+  {0, no_argument, 0, 0}
+};
+
+struct corpus_config
+{
+	unsigned int max_files;		// stop after this many binaries (0 = all of them)
+	unsigned int timeout;		// seconds for each binary before it is counted as a failure
+	int verbose;					// show the output of the delinker
+} corpus = { 0, 60, 0 };
+
+typedef struct result
+{
+	int status;						// 0, -ERR_ or STATUS_
+	int signal;						// for STATUS_CRASH
+	unsigned long text_bytes;
+	unsigned long symbols;
+	unsigned long relocations;
+	unsigned long objects;
+	unsigned long wall_ns;
+} result;
+
+static unsigned long now_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000UL + t.tv_nsec;
+}
+
+static const char* status_name(const result* r)
+{
+	static char buf[32];
+
+	switch (r->status)
+	{
+	case 0: return "ok";
+	case -ERR_BAD_FILE: return "bad file";
+	case -ERR_BAD_FORMAT: return "bad format";
+	case -ERR_NO_SYMS: return "no symbols";
+	case -ERR_NO_SYMS_AFTER_RECONSTRUCT: return "no symbols after -R";
+	case -ERR_NO_TEXT_SECTION: return "no .text";
+	case -ERR_NO_PLT_SECTION: return "no .plt";
+	case STATUS_TIMEOUT: return "timeout";
+	case STATUS_CRASH:
+		snprintf(buf, sizeof(buf), "signal %i", r->signal);
+		return buf;
+	}
+	snprintf(buf, sizeof(buf), "error %i", r->status);
+	return buf;
+}
+
+static int is_elf64(const char* path)
+{
+	unsigned char ident[5];
+	FILE* f = fopen(path, "rb");
+	if (!f)
+		return 0;
+	int ok = (fread(ident, sizeof(ident), 1, f) == 1 && memcmp(ident, "\x7f" "ELF", 4) == 0 && ident[4] == 2);
+	fclose(f);
+	return ok;
+}
+
+static int remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw)
+{
+	remove(path);
+	return 0;
+}
+
+// delink one binary in a child process, with its output going to a temporary directory
+static void run_one(const char* path, result* r)
+{
+	char dir[] = "/tmp/bench_corpus.XXXXXX";
+	int fds[2];
+
+	memset(r, 0, sizeof(result));
+	if (!mkdtemp(dir) || pipe(fds))
+	{
+		r->status = -ERR_BAD_FILE;
+		return;
+	}
+
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		close(fds[0]);
+		if (chdir(dir))
+			_exit(1);
+		if (!corpus.verbose)
+		{
+			freopen("/dev/null", "w", stdout);
+			freopen("/dev/null", "w", stderr);
+		}
+		alarm(corpus.timeout);
+
+		stats_reset();
+		unsigned long start = now_ns();
+		r->status = unlink_file(path, NULL, OBJECT_TYPE_NONE);
+		r->wall_ns = now_ns() - start;
+		r->text_bytes = stats_get(STATS_TEXT_BYTES);
+		r->symbols = stats_get(STATS_SYMBOLS);
+		r->relocations = stats_get(STATS_RELOCATIONS);
+		r->objects = stats_get(STATS_OBJECTS);
+		write(fds[1], r, sizeof(result));
+		_exit(0);
+	}
+
+	close(fds[1]);
+	int status = 0;
+	ssize_t got = (pid > 0) ? read(fds[0], r, sizeof(result)) : 0;
+	close(fds[0]);
+	if (pid > 0)
+		waitpid(pid, &status, 0);
+
+	// nothing came back: the child died before it finished
+	if (got != sizeof(result))
+	{
+		memset(r, 0, sizeof(result));
+		r->status = STATUS_CRASH;
+		if (WIFSIGNALED(status))
+		{
+			r->signal = WTERMSIG(status);
+			if (r->signal == SIGALRM)
+				r->status = STATUS_TIMEOUT;
+		}
+	}
+
+	nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "bench_corpus runs the delinker on every ELF64 binary in a directory\n");
+	fprintf(stderr, "bench_corpus [options] <directory>\n");
+	fprintf(stderr, "  -R, --reconstruct-symbols  rebuild the function symbols (needed for stripped binaries)\n");
+	fprintf(stderr, "  -G, --fill-gaps            only rebuild the symbols that are missing\n");
+	fprintf(stderr, "  -n, --max-files <n>        stop after n binaries\n");
+	fprintf(stderr, "  -t, --timeout <s>          time limit for each binary (%u)\n", corpus.timeout);
+	fprintf(stderr, "  -v, --verbose              show the output of the delinker\n");
+}
+
+int
+main (int argc, char *argv[])
+{
+	int c;
+	while ((c = getopt_long(argc, argv, "RGn:t:v", options, 0)) != -1)
+	{
+		switch (c)
+		{
+		case 'R':
+			config.reconstruct_symbols = 1;
+			break;
+		case 'G':
+			config.reconstruct_symbols = 1;
+			config.fill_gaps = 1;
+			break;
+		case 'n':
+			corpus.max_files = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			corpus.timeout = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			corpus.verbose = 1;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	if (argc <= optind)
+	{
+		usage();
+		return -1;
+	}
+
+	const char* dirname = argv[optind];
+	struct dirent** entries;
+	int count = scandir(dirname, &entries, NULL, alphasort);
+	if (count < 0)
+	{
+		fprintf(stderr, "Can't read directory %s\n", dirname);
+		return -1;
+	}
+
+	delinker_init();
+	log_set_verbosity(corpus.verbose ? LOG_LEVEL_INFO : LOG_LEVEL_ERROR);
+	stats_init(STATS_FORMAT_TEXT);
+
+	unsigned int files = 0, ok = 0;
+	unsigned long total_text = 0, total_ns = 0, total_relocs = 0;
+	char path[4096];
+
+	printf("%-32s %10s %10s %8s %8s %9s %7s  %s\n", "binary", ".text KB", "ms", "MB/s", "symbols", "relocs", "objects", "result");
+	for (int i=0; i < count; i++)
+	{
+		struct stat st;
+		const char* name = entries[i]->d_name;
+		snprintf(path, sizeof(path), "%s/%s", dirname, name);
+
+		// links would only repeat binaries that are already in the list
+		if ((corpus.max_files && files >= corpus.max_files) || lstat(path, &st) || !S_ISREG(st.st_mode) || !is_elf64(path))
+		{
+			free(entries[i]);
+			continue;
+		}
+
+		result r;
+		run_one(path, &r);
+		files++;
+		if (r.status == 0)
+		{
+			ok++;
+			total_text += r.text_bytes;
+			total_ns += r.wall_ns;
+			total_relocs += r.relocations;
+		}
+
+		printf("%-32.32s %10.1f %10.1f %8.2f %8lu %9lu %7lu  %s\n", name, r.text_bytes / 1024.0, r.wall_ns / 1e6,
+			r.wall_ns ? r.text_bytes * 1e3 / r.wall_ns : 0.0, r.symbols, r.relocations, r.objects, status_name(&r));
+		free(entries[i]);
+	}
+	free(entries);
+
+	printf("\n%u binaries, %u delinked, %u failed\n", files, ok, files - ok);
+	if (total_ns)
+		printf("%.1f MB of .text in %.1f s (%.2f MB/s), %lu relocations\n", total_text / 1e6, total_ns / 1e9,
+			total_text * 1e3 / total_ns, total_relocs);
+
+	return 0;
+}
@@ -0,0 +1,627 @@
+/* Synthetic workload generator
+
+Writes a linked x86-64 ELF executable that looks like the output of a compiler and linker, with a
+configurable number of functions, compilation units, call sites, data references and imports, so
+the delinker can be timed on inputs of any size without a toolchain. Each compilation unit has a
+FILE symbol followed by its (local) functions and variables. Each function makes direct calls to
+other functions (mostly in the same unit) or through the PLT to the imports, and loads the
+addresses of variables in .data. With imports, the file has the usual dynamic linking sections
+(.interp, .dynsym, .dynstr, .gnu.version, .gnu.version_r, .rela.plt, .plt, .dynamic, .got.plt).
+The code is never meant to run - it only has to decode and relink like the real thing.
+
+The output only depends on the parameters and the seed, so the same input can be regenerated for
+comparing runs. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <elf.h>
+
+#define BASE_ADDRESS		0x400000
+#define DATA_GAP			0x200000		// the writable segment is mapped this far above the code
+#define PAGE_SIZE			0x1000
+#define FUNCTION_ALIGN	16
+#define VARIABLE_SIZE	8
+#define PLT_ENTRY_SIZE	16
+#define GOT_RESERVED		3				// .got.plt entries used by the dynamic linker
+
+// size of each part of a generated function
+#define PROLOGUE_SIZE	4		// push %rbp; mov %rsp,%rbp
+#define CALL_SIZE			5		// call rel32
+#define LOAD_SIZE			5		// mov $imm32,%eax
+#define EPILOGUE_SIZE	2		// pop %rbp; ret
+
+#define INTERP				"/lib64/ld-linux-x86-64.so.2"
+#define IMPORT_LIBRARY	"libc.so.6"
+#define IMPORT_VERSION	"GLIBC_2.2.5"
+#define IMPORT_VERSION_INDEX 2
+
+static struct option options[] =
+{
+  {"functions", required_argument, 0, 'f'},
+  {"units", required_argument, 0, 'u'},
+  {"calls", required_argument, 0, 'c'},
+  {"data-refs", required_argument, 0, 'd'},
+  {"imports", required_argument, 0, 'i'},
+  {"seed", required_argument, 0, 's'},
+  {"output", required_argument, 0, 'o'},
+  {0, no_argument, 0, 0}
+};
+
+struct config
+{
+	unsigned int functions;
+	unsigned int units;			// compilation units - the functions are divided evenly between them
+	unsigned int calls;			// call sites in each function
+	unsigned int data_refs;		// variable addresses loaded by each function
+	unsigned int imports;		// functions imported from a shared library (0 = static executable)
+	unsigned long seed;
+	const char* output;
+} config = { 1000, 20, 4, 2, 8, 1, "bench.elf" };
+
+enum section_id
+{
+	SEC_NULL,
+	SEC_INTERP,
+	SEC_DYNSYM,
+	SEC_DYNSTR,
+	SEC_VERSYM,
+	SEC_VERNEED,
+	SEC_RELA_PLT,
+	SEC_PLT,
+	SEC_TEXT,
+	SEC_DYNAMIC,
+	SEC_GOT_PLT,
+	SEC_DATA,
+	SEC_SYMTAB,
+	SEC_STRTAB,
+	SEC_SHSTRTAB,
+	SEC_COUNT
+};
+
+typedef struct section
+{
+	const char* name;
+	int present;
+	unsigned int index;		// in the section header table
+	Elf64_Shdr sh;
+	unsigned char* data;
+} section;
+
+typedef struct strtab
+{
+	char* data;
+	unsigned int size;
+	unsigned int max;
+} strtab;
+
+static section sections[SEC_COUNT];
+static unsigned long rng_state;
+
+static unsigned long rng(void)
+{
+	// xorshift64*
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545F4914F6CDD1DUL;
+}
+
+static unsigned int str_add(strtab* t, const char* s)
+{
+	unsigned int len = strlen(s) + 1;
+	unsigned int offset;
+
+	// the first string is always the empty one
+	if (t->size == 0)
+		t->size = 1;
+	if (t->size + len > t->max)
+	{
+		t->max = (t->size + len) * 2;
+		t->data = realloc(t->data, t->max);
+		t->data[0] = 0;
+	}
+	offset = t->size;
+	memcpy(t->data + offset, s, len);
+	t->size += len;
+	return offset;
+}
+
+static unsigned long align(unsigned long val, unsigned long a)
+{
+	return (val + a - 1) & ~(a - 1);
+}
+
+// the standard SysV hash of a version name
+static unsigned int elf_hash(const char* name)
+{
+	unsigned int h = 0, g;
+	while (*name)
+	{
+		h = (h << 4) + (unsigned char)*name++;
+		g = h & 0xf0000000;
+		if (g)
+			h ^= g >> 24;
+		h &= ~g;
+	}
+	return h;
+}
+
+static void add_section(enum section_id id, const char* name, unsigned int type, unsigned long flags, unsigned long size, unsigned long alignment, unsigned long entsize)
+{
+	section* s = &sections[id];
+	s->name = name;
+	s->present = 1;
+	s->sh.sh_type = type;
+	s->sh.sh_flags = flags;
+	s->sh.sh_size = size;
+	s->sh.sh_addralign = alignment;
+	s->sh.sh_entsize = entsize;
+	s->data = calloc(1, size + 1);
+}
+
+static unsigned long addr_of(enum section_id id)
+{
+	return sections[id].sh.sh_addr;
+}
+
+static void put32(unsigned char** p, unsigned int val)
+{
+	memcpy(*p, &val, 4);
+	*p += 4;
+}
+
+// choose a function or a variable to refer to - usually one in the same unit, sometimes any of them
+static unsigned int pick(unsigned int unit, unsigned int count)
+{
+	unsigned long first = (unsigned long)unit * count / config.units;
+	unsigned long last = (unsigned long)(unit + 1) * count / config.units;
+
+	if (last > first && rng() % 4)
+		return first + rng() % (last - first);
+	return rng() % count;
+}
+
+static unsigned int unit_of(unsigned int index, unsigned int count)
+{
+	return ((unsigned long)index * config.units + config.units - 1) / count;
+}
+
+static void write_text(const unsigned long* func_addr)
+{
+	unsigned char* p = sections[SEC_TEXT].data;
+	unsigned long plt = addr_of(SEC_PLT);
+	unsigned long data = addr_of(SEC_DATA);
+
+	for (unsigned int i=0; i < config.functions; i++)
+	{
+		unsigned char* start = p;
+		unsigned int unit = unit_of(i, config.functions);
+		unsigned long pc = func_addr[i];
+
+		// push %rbp; mov %rsp,%rbp
+		memcpy(p, "\x55\x48\x89\xe5", PROLOGUE_SIZE);
+		p += PROLOGUE_SIZE;
+
+		for (unsigned int c=0; c < config.calls; c++)
+		{
+			unsigned long target;
+			if (config.imports && rng() % 8 == 0)
+				target = plt + PLT_ENTRY_SIZE * (1 + rng() % config.imports);
+			else
+				target = func_addr[pick(unit, config.functions)];
+
+			unsigned long next = pc + (p - start) + CALL_SIZE;
+			*p++ = 0xe8;
+			put32(&p, target - next);
+		}
+
+		// mov $var,%eax
+		for (unsigned int d=0; d < config.data_refs; d++)
+		{
+			*p++ = 0xb8;
+			put32(&p, data + VARIABLE_SIZE * pick(unit, config.functions));
+		}
+
+		// pop %rbp; ret
+		memcpy(p, "\x5d\xc3", EPILOGUE_SIZE);
+		p += EPILOGUE_SIZE;
+
+		// int3 padding up to the next function
+		while ((p - sections[SEC_TEXT].data) % FUNCTION_ALIGN)
+			*p++ = 0xcc;
+	}
+}
+
+static void write_plt(void)
+{
+	unsigned char* p = sections[SEC_PLT].data;
+	unsigned long plt = addr_of(SEC_PLT);
+	unsigned long got = addr_of(SEC_GOT_PLT);
+	unsigned long* got_data = (unsigned long*)sections[SEC_GOT_PLT].data;
+
+	// push GOT[1]; jmp *GOT[2]
+	memcpy(p, "\xff\x35", 2);
+	p += 2;
+	put32(&p, got + 8 - (plt + 6));
+	memcpy(p, "\xff\x25", 2);
+	p += 2;
+	put32(&p, got + 16 - (plt + 12));
+	memcpy(p, "\x0f\x1f\x40\x00", 4);
+	p += 4;
+
+	got_data[0] = addr_of(SEC_DYNAMIC);
+	for (unsigned int n=0; n < config.imports; n++)
+	{
+		unsigned long entry = plt + PLT_ENTRY_SIZE * (n + 1);
+		unsigned long slot = got + 8 * (GOT_RESERVED + n);
+
+		// jmp *slot; push $n; jmp PLT0
+		memcpy(p, "\xff\x25", 2);
+		p += 2;
+		put32(&p, slot - (entry + 6));
+		*p++ = 0x68;
+		put32(&p, n);
+		*p++ = 0xe9;
+		put32(&p, plt - (entry + 16));
+
+		// before the symbol is resolved, the slot points back to the push
+		got_data[GOT_RESERVED + n] = entry + 6;
+	}
+}
+
+static void write_dynamic(strtab* dynstr, const unsigned int* import_name, unsigned int lib_name, unsigned int version_name)
+{
+	Elf64_Sym* sym = (Elf64_Sym*)sections[SEC_DYNSYM].data;
+	Elf64_Half* versym = (Elf64_Half*)sections[SEC_VERSYM].data;
+	Elf64_Rela* rela = (Elf64_Rela*)sections[SEC_RELA_PLT].data;
+
+	for (unsigned int n=0; n < config.imports; n++)
+	{
+		sym[n + 1].st_name = import_name[n];
+		sym[n + 1].st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+		versym[n + 1] = IMPORT_VERSION_INDEX;
+
+		rela[n].r_offset = addr_of(SEC_GOT_PLT) + 8 * (GOT_RESERVED + n);
+		rela[n].r_info = ELF64_R_INFO(n + 1, R_X86_64_JUMP_SLOT);
+	}
+
+	Elf64_Verneed* need = (Elf64_Verneed*)sections[SEC_VERNEED].data;
+	Elf64_Vernaux* aux = (Elf64_Vernaux*)(need + 1);
+	need->vn_version = VER_NEED_CURRENT;
+	need->vn_cnt = 1;
+	need->vn_file = lib_name;
+	need->vn_aux = sizeof(Elf64_Verneed);
+	aux->vna_hash = elf_hash(IMPORT_VERSION);
+	aux->vna_other = IMPORT_VERSION_INDEX;
+	aux->vna_name = version_name;
+
+	memcpy(sections[SEC_DYNSTR].data, dynstr->data, dynstr->size);
+	strcpy((char*)sections[SEC_INTERP].data, INTERP);
+
+	Elf64_Dyn dyn[] =
+	{
+		{ DT_NEEDED, { lib_name } },
+		{ DT_STRTAB, { addr_of(SEC_DYNSTR) } },
+		{ DT_SYMTAB, { addr_of(SEC_DYNSYM) } },
+		{ DT_STRSZ, { dynstr->size } },
+		{ DT_SYMENT, { sizeof(Elf64_Sym) } },
+		{ DT_PLTGOT, { addr_of(SEC_GOT_PLT) } },
+		{ DT_PLTRELSZ, { sections[SEC_RELA_PLT].sh.sh_size } },
+		{ DT_PLTREL, { DT_RELA } },
+		{ DT_JMPREL, { addr_of(SEC_RELA_PLT) } },
+		{ DT_VERNEED, { addr_of(SEC_VERNEED) } },
+		{ DT_VERNEEDNUM, { 1 } },
+		{ DT_VERSYM, { addr_of(SEC_VERSYM) } },
+		{ DT_NULL, { 0 } },
+	};
+	memcpy(sections[SEC_DYNAMIC].data, dyn, sizeof(dyn));
+}
+
+#define DYNAMIC_ENTRIES 13
+
+static int generate(void)
+{
+	strtab dynstr = {0}, str = {0}, shstr = {0};
+	unsigned int* import_name = malloc(sizeof(unsigned int) * (config.imports + 1));
+	unsigned int* name = malloc(sizeof(unsigned int) * (config.units + config.functions * 2 + config.imports));
+	unsigned long* func_addr = malloc(sizeof(unsigned long) * config.functions);
+	unsigned int lib_name = 0, version_name = 0;
+	unsigned int sym_count = 1, n = 0;
+	char buf[128];
+
+	rng_state = config.seed ? config.seed : 1;
+
+	// string tables: each unit has a file name, followed by the names of its functions and variables
+	for (unsigned int u=0, f=0; u < config.units; u++)
+	{
+		snprintf(buf, sizeof(buf), "cu%u.c", u);
+		name[n++] = str_add(&str, buf);
+		for (unsigned int i=f; i < config.functions && unit_of(i, config.functions) == u; i++)
+		{
+			snprintf(buf, sizeof(buf), "fn_%u_%u", u, i);
+			name[n++] = str_add(&str, buf);
+			snprintf(buf, sizeof(buf), "var_%u_%u", u, i);
+			name[n++] = str_add(&str, buf);
+			f++;
+		}
+	}
+	sym_count += n;
+	if (config.imports)
+	{
+		lib_name = str_add(&dynstr, IMPORT_LIBRARY);
+		version_name = str_add(&dynstr, IMPORT_VERSION);
+	}
+	for (unsigned int i=0; i < config.imports; i++)
+	{
+		snprintf(buf, sizeof(buf), "import_%u", i);
+		import_name[i] = str_add(&dynstr, buf);
+		snprintf(buf, sizeof(buf), "import_%u@@%s", i, IMPORT_VERSION);
+		name[n++] = str_add(&str, buf);
+	}
+	sym_count += config.imports;
+
+	unsigned long func_size = align(PROLOGUE_SIZE + CALL_SIZE * config.calls + LOAD_SIZE * config.data_refs + EPILOGUE_SIZE, FUNCTION_ALIGN);
+
+	// the sections, in the order they are laid out in the file
+	if (config.imports)
+	{
+		add_section(SEC_INTERP, ".interp", SHT_PROGBITS, SHF_ALLOC, sizeof(INTERP), 1, 0);
+		add_section(SEC_DYNSYM, ".dynsym", SHT_DYNSYM, SHF_ALLOC, sizeof(Elf64_Sym) * (config.imports + 1), 8, sizeof(Elf64_Sym));
+		add_section(SEC_DYNSTR, ".dynstr", SHT_STRTAB, SHF_ALLOC, dynstr.size, 1, 0);
+		add_section(SEC_VERSYM, ".gnu.version", SHT_GNU_versym, SHF_ALLOC, sizeof(Elf64_Half) * (config.imports + 1), 2, sizeof(Elf64_Half));
+		add_section(SEC_VERNEED, ".gnu.version_r", SHT_GNU_verneed, SHF_ALLOC, sizeof(Elf64_Verneed) + sizeof(Elf64_Vernaux), 8, 0);
+		add_section(SEC_RELA_PLT, ".rela.plt", SHT_RELA, SHF_ALLOC | SHF_INFO_LINK, sizeof(Elf64_Rela) * config.imports, 8, sizeof(Elf64_Rela));
+		add_section(SEC_PLT, ".plt", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, PLT_ENTRY_SIZE * (config.imports + 1), 16, PLT_ENTRY_SIZE);
+	}
+	add_section(SEC_TEXT, ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, func_size * config.functions, FUNCTION_ALIGN, 0);
+	if (config.imports)
+	{
+		add_section(SEC_DYNAMIC, ".dynamic", SHT_DYNAMIC, SHF_ALLOC | SHF_WRITE, sizeof(Elf64_Dyn) * DYNAMIC_ENTRIES, 8, sizeof(Elf64_Dyn));
+		add_section(SEC_GOT_PLT, ".got.plt", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, 8 * (GOT_RESERVED + config.imports), 8, 8);
+	}
+	add_section(SEC_DATA, ".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, VARIABLE_SIZE * config.functions, 16, 0);
+	add_section(SEC_SYMTAB, ".symtab", SHT_SYMTAB, 0, sizeof(Elf64_Sym) * sym_count, 8, sizeof(Elf64_Sym));
+	add_section(SEC_STRTAB, ".strtab", SHT_STRTAB, 0, str.size, 1, 0);
+	add_section(SEC_SHSTRTAB, ".shstrtab", SHT_STRTAB, 0, 0, 1, 0);
+	sections[SEC_NULL].present = 1;
+
+	unsigned int shnum = 0;
+	for (int i=0; i < SEC_COUNT; i++)
+	{
+		if (!sections[i].present)
+			continue;
+		sections[i].index = shnum++;
+		if (sections[i].name)
+			sections[i].sh.sh_name = str_add(&shstr, sections[i].name);
+	}
+	free(sections[SEC_SHSTRTAB].data);
+	sections[SEC_SHSTRTAB].data = (unsigned char*)shstr.data;
+	sections[SEC_SHSTRTAB].sh.sh_size = shstr.size;
+
+	// lay out the file: the read-only and code sections go in the first segment, right after the
+	// headers, and the writable sections in the second one, which starts on a new page
+	unsigned int phnum = config.imports ? 4 : 2;
+	unsigned long off = sizeof(Elf64_Ehdr) + sizeof(Elf64_Phdr) * phnum;
+	unsigned long code_end = 0, data_off = 0, data_end = 0;
+	for (int i=1; i < SEC_COUNT; i++)
+	{
+		Elf64_Shdr* sh = &sections[i].sh;
+		if (!sections[i].present)
+			continue;
+		if ((sh->sh_flags & SHF_WRITE) && !data_off)
+			off = data_off = align(off, PAGE_SIZE);
+		off = align(off, sh->sh_addralign);
+		sh->sh_offset = off;
+		if (sh->sh_flags & SHF_ALLOC)
+			sh->sh_addr = BASE_ADDRESS + off + (data_off ? DATA_GAP : 0);
+		off += sh->sh_size;
+		if ((sh->sh_flags & SHF_ALLOC) && !data_off)
+			code_end = off;
+		if (sh->sh_flags & SHF_WRITE)
+			data_end = off;
+	}
+	unsigned long shoff = align(off, 8);
+
+	for (unsigned int i=0; i < config.functions; i++)
+		func_addr[i] = addr_of(SEC_TEXT) + func_size * i;
+
+	// section contents
+	if (config.imports)
+	{
+		write_plt();
+		write_dynamic(&dynstr, import_name, lib_name, version_name);
+	}
+	write_text(func_addr);
+	for (unsigned int i=0; i < config.functions; i++)
+		memcpy(sections[SEC_DATA].data + VARIABLE_SIZE * i, &(unsigned long){ i + 1 }, VARIABLE_SIZE);
+	memcpy(sections[SEC_STRTAB].data, str.data, str.size);
+
+	// symbol table: the local symbols of each unit, then the undefined imports
+	Elf64_Sym* sym = (Elf64_Sym*)sections[SEC_SYMTAB].data + 1;
+	n = 0;
+	for (unsigned int u=0, f=0; u < config.units; u++)
+	{
+		sym->st_name = name[n++];
+		sym->st_info = ELF64_ST_INFO(STB_LOCAL, STT_FILE);
+		sym->st_shndx = SHN_ABS;
+		sym++;
+		for (; f < config.functions && unit_of(f, config.functions) == u; f++)
+		{
+			sym->st_name = name[n++];
+			sym->st_info = ELF64_ST_INFO(STB_LOCAL, STT_FUNC);
+			sym->st_shndx = sections[SEC_TEXT].index;
+			sym->st_value = func_addr[f];
+			sym->st_size = func_size;
+			sym++;
+
+			sym->st_name = name[n++];
+			sym->st_info = ELF64_ST_INFO(STB_LOCAL, STT_OBJECT);
+			sym->st_shndx = sections[SEC_DATA].index;
+			sym->st_value = addr_of(SEC_DATA) + VARIABLE_SIZE * f;
+			sym->st_size = VARIABLE_SIZE;
+			sym++;
+		}
+	}
+	sections[SEC_SYMTAB].sh.sh_info = sym - (Elf64_Sym*)sections[SEC_SYMTAB].data;
+	for (unsigned int i=0; i < config.imports; i++)
+	{
+		sym->st_name = name[n++];
+		sym->st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+		sym++;
+	}
+
+	// links between the sections
+	sections[SEC_DYNSYM].sh.sh_link = sections[SEC_DYNSTR].index;
+	sections[SEC_DYNSYM].sh.sh_info = 1;
+	sections[SEC_VERSYM].sh.sh_link = sections[SEC_DYNSYM].index;
+	sections[SEC_VERNEED].sh.sh_link = sections[SEC_DYNSTR].index;
+	sections[SEC_VERNEED].sh.sh_info = 1;
+	sections[SEC_RELA_PLT].sh.sh_link = sections[SEC_DYNSYM].index;
+	sections[SEC_RELA_PLT].sh.sh_info = sections[SEC_GOT_PLT].index;
+	sections[SEC_DYNAMIC].sh.sh_link = sections[SEC_DYNSTR].index;
+	sections[SEC_SYMTAB].sh.sh_link = sections[SEC_STRTAB].index;
+
+	// headers
+	unsigned long size = shoff + sizeof(Elf64_Shdr) * shnum;
+	unsigned char* image = calloc(1, size);
+	Elf64_Ehdr* eh = (Elf64_Ehdr*)image;
+	memcpy(eh->e_ident, ELFMAG, SELFMAG);
+	eh->e_ident[EI_CLASS] = ELFCLASS64;
+	eh->e_ident[EI_DATA] = ELFDATA2LSB;
+	eh->e_ident[EI_VERSION] = EV_CURRENT;
+	eh->e_type = ET_EXEC;
+	eh->e_machine = EM_X86_64;
+	eh->e_version = EV_CURRENT;
+	eh->e_entry = config.functions ? func_addr[0] : addr_of(SEC_TEXT);
+	eh->e_phoff = sizeof(Elf64_Ehdr);
+	eh->e_shoff = shoff;
+	eh->e_ehsize = sizeof(Elf64_Ehdr);
+	eh->e_phentsize = sizeof(Elf64_Phdr);
+	eh->e_phnum = phnum;
+	eh->e_shentsize = sizeof(Elf64_Shdr);
+	eh->e_shnum = shnum;
+	eh->e_shstrndx = sections[SEC_SHSTRTAB].index;
+
+	Elf64_Phdr* ph = (Elf64_Phdr*)(image + sizeof(Elf64_Ehdr));
+	if (config.imports)
+	{
+		ph->p_type = PT_INTERP;
+		ph->p_flags = PF_R;
+		ph->p_offset = sections[SEC_INTERP].sh.sh_offset;
+		ph->p_vaddr = ph->p_paddr = addr_of(SEC_INTERP);
+		ph->p_filesz = ph->p_memsz = sections[SEC_INTERP].sh.sh_size;
+		ph->p_align = 1;
+		ph++;
+	}
+	ph->p_type = PT_LOAD;
+	ph->p_flags = PF_R | PF_X;
+	ph->p_vaddr = ph->p_paddr = BASE_ADDRESS;
+	ph->p_filesz = ph->p_memsz = code_end;
+	ph->p_align = PAGE_SIZE;
+	ph++;
+	ph->p_type = PT_LOAD;
+	ph->p_flags = PF_R | PF_W;
+	ph->p_offset = data_off;
+	ph->p_vaddr = ph->p_paddr = BASE_ADDRESS + data_off + DATA_GAP;
+	ph->p_filesz = ph->p_memsz = data_end - data_off;
+	ph->p_align = PAGE_SIZE;
+	ph++;
+	if (config.imports)
+	{
+		ph->p_type = PT_DYNAMIC;
+		ph->p_flags = PF_R | PF_W;
+		ph->p_offset = sections[SEC_DYNAMIC].sh.sh_offset;
+		ph->p_vaddr = ph->p_paddr = addr_of(SEC_DYNAMIC);
+		ph->p_filesz = ph->p_memsz = sections[SEC_DYNAMIC].sh.sh_size;
+		ph->p_align = 8;
+	}
+
+	Elf64_Shdr* sh = (Elf64_Shdr*)(image + shoff);
+	for (int i=0; i < SEC_COUNT; i++)
+	{
+		if (!sections[i].present)
+			continue;
+		*sh++ = sections[i].sh;
+		if (sections[i].data)
+			memcpy(image + sections[i].sh.sh_offset, sections[i].data, sections[i].sh.sh_size);
+		free(sections[i].data);
+	}
+
+	int ret = 0;
+	FILE* f = fopen(config.output, "wb");
+	if (!f || fwrite(image, size, 1, f) != 1)
+	{
+		fprintf(stderr, "Can't write %s\n", config.output);
+		ret = -1;
+	}
+	if (f)
+		fclose(f);
+
+	free(image);
+	free(func_addr);
+	free(name);
+	free(import_name);
+	free(dynstr.data);
+	free(str.data);
+	return ret;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "gen_elf writes a synthetic x86-64 executable for benchmarking the delinker\n");
+	fprintf(stderr, "gen_elf [options]\n");
+	fprintf(stderr, "  -f, --functions <n>   number of functions (%u)\n", config.functions);
+	fprintf(stderr, "  -u, --units <n>       number of compilation units (%u)\n", config.units);
+	fprintf(stderr, "  -c, --calls <n>       call sites in each function (%u)\n", config.calls);
+	fprintf(stderr, "  -d, --data-refs <n>   data references in each function (%u)\n", config.data_refs);
+	fprintf(stderr, "  -i, --imports <n>     imported functions, 0 for a static executable (%u)\n", config.imports);
+	fprintf(stderr, "  -s, --seed <n>        random seed (%lu)\n", config.seed);
+	fprintf(stderr, "  -o, --output <file>   output file name (%s)\n", config.output);
+}
+
+int
+main (int argc, char *argv[])
+{
+	int c;
+	while ((c = getopt_long(argc, argv, "f:u:c:d:i:s:o:", options, 0)) != -1)
+	{
+		switch (c)
+		{
+		case 'f':
+			config.functions = strtoul(optarg, NULL, 0);
+			break;
+		case 'u':
+			config.units = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			config.calls = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			config.data_refs = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			config.imports = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			config.seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			config.output = optarg;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	if (!config.functions || !config.units || config.units > config.functions)
+	{
+		fprintf(stderr, "Need at least one function in each unit\n");
+		return -1;
+	}
+
+	return generate();
+}
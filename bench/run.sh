@@ -0,0 +1,77 @@
+#!/bin/sh
+# Scaling benchmark: time the delinker on generated inputs of growing size, and report the time of
+# each phase at each size. A phase that grows much faster than the input is flagged, so anything
+# quadratic shows up long before it is run on a real binary.
+#
+# Settings (environment):
+#   DELINKER  the delinker to time (./delinker)
+#   GEN       the input generator (bench/gen_elf)
+#   SIZES     numbers of functions to generate ("1000 2000 4000 8000")
+#   FUNCS_PER_UNIT, CALLS, DATA_REFS, IMPORTS   shape of the generated code
+#   ARGS      extra arguments for the delinker (i.e. "-j4" or "-F")
+
+DELINKER=$(realpath "${DELINKER:-./delinker}")
+GEN=$(realpath "${GEN:-bench/gen_elf}")
+SIZES=${SIZES:-"1000 2000 4000 8000"}
+FUNCS_PER_UNIT=${FUNCS_PER_UNIT:-50}
+CALLS=${CALLS:-4}
+DATA_REFS=${DATA_REFS:-2}
+IMPORTS=${IMPORTS:-8}
+
+# a phase is flagged when its time grows this many times faster than the input
+LIMIT=1.5
+# phases faster than this (in ms) are too noisy to judge
+MIN_MS=5
+
+PHASES="read analyze reconstruct relocations sort partition copy fixup write total"
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+printf "%8s" "funcs"
+for p in $PHASES; do printf " %11s" "$p"; done
+printf " %10s %8s\n" "rss (KB)" "objs/s"
+
+for n in $SIZES; do
+	units=$((n / FUNCS_PER_UNIT))
+	[ $units -lt 1 ] && units=1
+	"$GEN" -f $n -u $units -c $CALLS -d $DATA_REFS -i $IMPORTS -o "$WORK/input" || exit 1
+
+	rm -rf "$WORK/out" && mkdir "$WORK/out"
+	(cd "$WORK/out" && "$DELINKER" -q --stats $ARGS "$WORK/input") > "$WORK/stats.$n" || exit 1
+
+	printf "%8s" $n
+	for p in $PHASES; do
+		ms=$(awk -v p=$p '$1 == p { print $2; exit }' "$WORK/stats.$n")
+		printf " %11s" "${ms:--}"
+	done
+	rss=$(awk '$1 == "total" { print $4 }' "$WORK/stats.$n")
+	rate=$(awk '$1 == "objects/s" { print $2 }' "$WORK/stats.$n")
+	printf " %10s %8s\n" "$rss" "$rate"
+done
+
+# compare each size with the previous one (the phase rows come before the counters, which can have
+# the same names)
+status=0
+prev=
+for n in $SIZES; do
+	if [ -n "$prev" ]; then
+		for p in $PHASES; do
+			msg=$(awk -v p=$p -v n=$n -v prev=$prev -v limit=$LIMIT -v min=$MIN_MS '
+				$1 == p && !(FILENAME in t) { t[FILENAME] = $2 }
+				END {
+					a = t[ARGV[1]]; b = t[ARGV[2]]
+					if (a >= min && b >= min && (b / a) > limit * (n / prev))
+						printf "%s: %.1fx slower for %.1fx the functions (%d -> %d)\n", p, b / a, n / prev, prev, n
+				}' "$WORK/stats.$prev" "$WORK/stats.$n")
+			if [ -n "$msg" ]; then
+				echo "WARNING $msg"
+				status=1
+			fi
+		done
+	fi
+	prev=$n
+done
+
+[ -n "$STRICT" ] && exit $status
+exit 0
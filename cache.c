@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "alloc.h"
+#include "log.h"
+
+#define CACHE_MAGIC "DLCACHE"
+#define CACHE_VERSION 1
+#define NO_FUNCS ((unsigned int)-1)
+
+typedef struct cache_header
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int func_count;	// NO_FUNCS if the functions were not discovered
+	unsigned int site_count;
+	unsigned int reserved;
+	unsigned long key;
+	unsigned long func_offset;	// file offset of the function array
+	unsigned long site_offset;	// file offset of the relocation site array
+} cache_header;
+
+// an entry kept in memory, in one block with its arrays
+typedef struct cache_entry
+{
+	unsigned long key;
+	code_func* funcs;
+	unsigned int func_count;
+	int has_funcs;				// 0 if the functions were not discovered
+	reloc_site* sites;
+	unsigned int site_count;
+	unsigned int refs;		// lookups that haven't been released yet - the entry can't be evicted
+	unsigned long size;
+	unsigned long last_use;
+} cache_entry;
+
+static struct
+{
+	cache_entry** entries;
+	unsigned int count;
+	unsigned int max;
+	unsigned long size;		// total size of the entries
+	unsigned long max_size;	// 0 = entries are not kept in memory
+	unsigned long clock;
+	pthread_mutex_t lock;
+} memory = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+void cache_memory_init(unsigned long max_bytes)
+{
+	memory.max_size = max_bytes;
+}
+
+int cache_enabled(const char* dir)
+{
+	return dir || memory.max_size;
+}
+
+// the caller must hold the lock
+static cache_entry* memory_find(unsigned long key)
+{
+	for (unsigned int i=0; i < memory.count; i++)
+		if (memory.entries[i]->key == key)
+			return memory.entries[i];
+	return NULL;
+}
+
+static int memory_lookup(unsigned long key, decode_cache* c)
+{
+	pthread_mutex_lock(&memory.lock);
+	cache_entry* e = memory_find(key);
+	if (e)
+	{
+		e->refs++;
+		e->last_use = ++memory.clock;
+		c->entry = e;
+		c->funcs = e->has_funcs ? e->funcs : NULL;
+		c->func_count = e->func_count;
+		c->sites = e->sites;
+		c->site_count = e->site_count;
+	}
+	pthread_mutex_unlock(&memory.lock);
+	return e ? 0 : -1;
+}
+
+// make room for size more bytes by evicting the least recently used entries - the caller must hold the lock
+static int memory_evict(unsigned long size)
+{
+	while (memory.size + size > memory.max_size)
+	{
+		unsigned int victim = memory.count;
+		for (unsigned int i=0; i < memory.count; i++)
+			if (!memory.entries[i]->refs && (victim == memory.count || memory.entries[i]->last_use < memory.entries[victim]->last_use))
+				victim = i;
+		if (victim == memory.count)
+			return -1;
+
+		memory.size -= memory.entries[victim]->size;
+		mem_free(MEM_OTHER, memory.entries[victim]);
+		memory.entries[victim] = memory.entries[--memory.count];
+	}
+	return 0;
+}
+
+static void memory_store(unsigned long key, const code_func* funcs, unsigned int func_count, const reloc_site* sites, unsigned int site_count)
+{
+	if (!funcs)
+		func_count = 0;
+	unsigned long size = sizeof(cache_entry) + func_count * sizeof(code_func) + site_count * sizeof(reloc_site);
+	if (size > memory.max_size)
+		return;
+
+	pthread_mutex_lock(&memory.lock);
+	cache_entry* e = memory_find(key);
+	// an entry without the functions is replaced when they are found, unless it is in use
+	if (e && (e->has_funcs || !funcs || e->refs))
+		goto done;
+	if (e)
+	{
+		unsigned int i = 0;
+		while (memory.entries[i] != e)
+			i++;
+		memory.size -= e->size;
+		mem_free(MEM_OTHER, e);
+		memory.entries[i] = memory.entries[--memory.count];
+	}
+	if (memory_evict(size))
+		goto done;
+
+	if (memory.count == memory.max)
+	{
+		memory.max = memory.max ? memory.max * 2 : 64;
+		memory.entries = mem_realloc(MEM_OTHER, memory.entries, memory.max * sizeof(cache_entry*));
+	}
+
+	e = mem_alloc(MEM_OTHER, size);
+	e->key = key;
+	e->funcs = (code_func*)(e + 1);
+	e->func_count = func_count;
+	e->has_funcs = (funcs != NULL);
+	e->sites = (reloc_site*)(e->funcs + func_count);
+	e->site_count = site_count;
+	e->refs = 0;
+	e->size = size;
+	e->last_use = ++memory.clock;
+	memcpy(e->funcs, funcs, func_count * sizeof(code_func));
+	memcpy(e->sites, sites, site_count * sizeof(reloc_site));
+	memory.entries[memory.count++] = e;
+	memory.size += size;
+
+done:
+	pthread_mutex_unlock(&memory.lock);
+}
+
+static void cache_path(char* path, unsigned int len, const char* dir, unsigned long key)
+{
+	snprintf(path, len, "%s/%016lx.dlc", dir, key);
+}
+
+// does an array of count elements at offset lie inside of a file of file_size bytes, aligned for its
+// element type? The sizes come from the file, so this must not overflow for any of them.
+static int array_in_file(unsigned long offset, unsigned long count, unsigned long elem_size, unsigned long align, unsigned long file_size)
+{
+	if (offset % align || offset < sizeof(cache_header) || offset > file_size)
+		return 0;
+	return count <= (file_size - offset) / elem_size;
+}
+
+int cache_lookup(const char* dir, unsigned long key, decode_cache* c)
+{
+	char path[1024];
+	struct stat st;
+
+	memset(c, 0, sizeof(decode_cache));
+	if (memory.max_size && memory_lookup(key, c) == 0)
+		return 0;
+	if (!dir)
+		return -1;
+	cache_path(path, sizeof(path), dir, key);
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) || st.st_size < sizeof(cache_header))
+	{
+		close(fd);
+		return -2;
+	}
+
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -3;
+
+	// make sure the file is what we expect before trusting any of the offsets
+	const cache_header* h = map;
+	unsigned long funcs = (h->func_count == NO_FUNCS) ? 0 : h->func_count;
+	if (memcmp(h->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || h->version != CACHE_VERSION || h->key != key ||
+		!array_in_file(h->func_offset, funcs, sizeof(code_func), __alignof__(code_func), st.st_size) ||
+		!array_in_file(h->site_offset, h->site_count, sizeof(reloc_site), __alignof__(reloc_site), st.st_size))
+	{
+		log_warn("Ignoring invalid cache file %s\n", path);
+		munmap(map, st.st_size);
+		return -4;
+	}
+
+	c->map = map;
+	c->map_size = st.st_size;
+	if (h->func_count != NO_FUNCS)
+	{
+		c->funcs = (const code_func*)((const char*)map + h->func_offset);
+		c->func_count = h->func_count;
+	}
+	c->sites = (const reloc_site*)((const char*)map + h->site_offset);
+	c->site_count = h->site_count;
+
+	// keep a copy, so the next lookup doesn't have to go to the file
+	if (memory.max_size)
+		memory_store(key, c->funcs, c->func_count, c->sites, c->site_count);
+
+	return 0;
+}
+
+int cache_store(const char* dir, unsigned long key, const code_func* funcs, unsigned int func_count, const reloc_site* sites, unsigned int site_count)
+{
+	char path[1024];
+	char tmp[1060];
+	cache_header h = {0};
+
+	if (memory.max_size)
+		memory_store(key, funcs, func_count, sites, site_count);
+	if (!dir)
+		return 0;
+
+	mkdir(dir, 0777);
+	cache_path(path, sizeof(path), dir, key);
+	// in batch mode, two threads of the same process may store the same key
+	snprintf(tmp, sizeof(tmp), "%s.%u.%lx", path, getpid(), (unsigned long)pthread_self());
+
+	FILE* f = fopen(tmp, "wb");
+	if (!f)
+	{
+		log_warn("Can't create cache file %s\n", tmp);
+		return -1;
+	}
+
+	memcpy(h.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	h.version = CACHE_VERSION;
+	h.key = key;
+	h.func_count = funcs ? func_count : NO_FUNCS;
+	h.site_count = site_count;
+	h.func_offset = sizeof(cache_header);
+	h.site_offset = h.func_offset + (funcs ? func_count * sizeof(code_func) : 0);
+
+	int err = (fwrite(&h, sizeof(h), 1, f) != 1);
+	if (funcs && func_count)
+		err |= (fwrite(funcs, sizeof(code_func), func_count, f) != func_count);
+	if (site_count)
+		err |= (fwrite(sites, sizeof(reloc_site), site_count, f) != site_count);
+	err |= fclose(f);
+
+	// write to a temporary file and rename it, so another process never sees a partial file
+	if (err || rename(tmp, path))
+	{
+		log_warn("Can't write cache file %s\n", path);
+		unlink(tmp);
+		return -2;
+	}
+
+	return 0;
+}
+
+void cache_release(decode_cache* c)
+{
+	if (c->entry)
+	{
+		pthread_mutex_lock(&memory.lock);
+		c->entry->refs--;
+		pthread_mutex_unlock(&memory.lock);
+	}
+	if (c->map)
+		munmap(c->map, c->map_size);
+	memset(c, 0, sizeof(decode_cache));
+}
@@ -0,0 +1,49 @@
+/* Decode cache
+
+The results of disassembling a code section (function boundaries and relocation sites) are saved
+in a cache directory, so running the delinker again on the same code can skip the disassembly. Each
+code section has its own cache file, named by a hash of the section contents and the decoder mode.
+The file is a fixed header followed by the raw arrays, so it can be mapped straight into memory.
+A process that delinks many files (i.e. the daemon) can also keep the entries in memory, up to a
+limit, so that code it has already seen is found without any file access, with or without a cache
+directory. */
+
+#ifndef _CACHE__H
+#define _CACHE__H
+
+// a function found by the discovery pass
+typedef struct code_func
+{
+	unsigned long start;	// offset from the beginning of the section
+	unsigned long end;	// one past the last byte of the last decoded instruction
+} code_func;
+
+// an instruction operand that refers to an absolute address, and may need a relocation
+typedef struct reloc_site
+{
+	unsigned long target;	// the absolute address that is referenced
+	unsigned int offset;		// offset of the operand from the beginning of the section
+	unsigned char kind;		// see INSN_OP_
+	unsigned char cls;		// see INSN_CLASS_
+	unsigned short reserved;
+} reloc_site;
+
+typedef struct decode_cache
+{
+	void* map;
+	unsigned long map_size;
+	struct cache_entry* entry;	// the entry in memory that is in use, instead of a mapped file
+	const code_func* funcs;	// NULL if the functions were not discovered when the cache was written
+	unsigned int func_count;
+	const reloc_site* sites;
+	unsigned int site_count;
+} decode_cache;
+
+void cache_memory_init(unsigned long max_bytes); /* keep the entries in memory as well, up to max_bytes */
+int cache_enabled(const char* dir); /* is there a cache, either in dir or in memory */
+/* dir = NULL to use only the entries in memory */
+int cache_lookup(const char* dir, unsigned long key, decode_cache* c); /* map an entry - returns 0 on a hit */
+int cache_store(const char* dir, unsigned long key, const code_func* funcs, unsigned int func_count, const reloc_site* sites, unsigned int site_count);
+void cache_release(decode_cache* c);
+
+#endif // _CACHE__H
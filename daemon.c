@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "daemon.h"
+#include "batch.h"
+#include "cache.h"
+#include "manifest.h"
+#include "alloc.h"
+#include "log.h"
+
+#define DAEMON_MANIFEST "delinker.manifest"
+#define DAEMON_CACHE_MEMORY (256UL << 20)	// analysis results kept in memory between jobs
+#define DAEMON_MAX_LINE 8192
+
+static volatile sig_atomic_t stop;
+
+// a connection, with the part of a job line that has arrived so far
+typedef struct client
+{
+	int fd;
+	FILE* out;
+	unsigned int len;
+	char line[DAEMON_MAX_LINE];
+} client;
+
+// the open connections, in the order they were accepted
+static struct
+{
+	client** list;
+	unsigned int count;
+	unsigned int max;
+} clients;
+
+static void handle_stop(int sig)
+{
+	stop = 1;
+}
+
+// set the options of one job on top of the defaults - returns the name of a bad option, or NULL
+static const char* parse_job_options(char* options, backend_type* target)
+{
+	char* save;
+
+	for (char* opt = strtok_r(options, "\t", &save); opt; opt = strtok_r(NULL, "\t", &save))
+	{
+		char* val = strchr(opt, '=');
+		if (val)
+			*val++ = 0;
+
+		if (!val && strcmp(opt, "reconstruct-symbols") == 0)
+			config.reconstruct_symbols = 1;
+		else if (!val && strcmp(opt, "fill-gaps") == 0)
+			config.reconstruct_symbols = config.fill_gaps = 1;
+		else if (!val && strcmp(opt, "shared-data") == 0)
+			config.shared_data = 1;
+		else if (!val && strcmp(opt, "slice-data") == 0)
+			config.slice_data = 1;
+		else if (!val && strcmp(opt, "function-sections") == 0)
+			config.function_sections = 1;
+		else if (!val && strcmp(opt, "stream") == 0)
+			config.stream = 1;
+		else if (val && strcmp(opt, "jobs") == 0)
+			config.jobs = atoi(val);
+		else if (val && strcmp(opt, "output-target") == 0)
+		{
+			*target = backend_lookup_target(val);
+			if (*target == OBJECT_TYPE_NONE)
+				return opt;
+		}
+		else if (strcmp(opt, "incremental") == 0)
+			config.manifest = val ? val : DAEMON_MANIFEST;
+		else
+			return opt;
+	}
+	return NULL;
+}
+
+static void reply_entries(FILE* out, const manifest* m)
+{
+	fprintf(out, "ok %u\n", m->count);
+	for (unsigned int i=0; i < m->count; i++)
+		fprintf(out, "%c %016lx %s\n", m->entries[i].kind, m->entries[i].hash, m->entries[i].name);
+}
+
+// in incremental mode the reply is the manifest that the job wrote, with the hashes of the functions too
+static void reply_manifest(FILE* out, const char* output_dir)
+{
+	char path[4096];
+
+	if (config.manifest[0] == '/')
+		snprintf(path, sizeof(path), "%s", config.manifest);
+	else
+		snprintf(path, sizeof(path), "%s/%s", output_dir, config.manifest);
+
+	manifest* m = manifest_load(path);
+	reply_entries(out, m);
+	manifest_free(m);
+}
+
+static void run_job(char* line, FILE* out, backend_type default_target)
+{
+	struct config defaults = config;
+	backend_type target = default_target;
+	char* options = NULL;
+	const char* bad;
+
+	line[strcspn(line, "\r\n")] = 0;
+	char* input = line;
+	char* output_dir = strchr(line, '\t');
+	if (output_dir)
+	{
+		*output_dir++ = 0;
+		options = strchr(output_dir, '\t');
+		if (options)
+			*options++ = 0;
+	}
+	if (!input[0] || !output_dir || !output_dir[0])
+	{
+		fprintf(out, "error expected <input>\\t<output dir>[\\t<option>...]\n");
+		return;
+	}
+
+	if (options && (bad = parse_job_options(options, &target)))
+	{
+		fprintf(out, "error unknown option %s\n", bad);
+		config = defaults;
+		return;
+	}
+
+	log_info("Job: delinking %s to %s\n", input, output_dir);
+	if (batch_make_dir(output_dir))
+		fprintf(out, "error can't create the output directory %s\n", output_dir);
+	else if (access(input, R_OK))
+		fprintf(out, "error %s\n", delinker_error_name(-ERR_BAD_FILE));
+	else
+	{
+		manifest* outputs = manifest_init();
+		int ret = unlink_file_outputs(input, output_dir, target, outputs);
+		if (ret)
+			fprintf(out, "error %s\n", delinker_error_name(ret));
+		else if (config.manifest)
+			reply_manifest(out, output_dir);
+		else
+			reply_entries(out, outputs);
+		manifest_free(outputs);
+	}
+
+	config = defaults;
+}
+
+static void add_client(int fd)
+{
+	FILE* out = fdopen(dup(fd), "w");
+	if (!out)
+	{
+		log_warn("Can't open the client connection\n");
+		close(fd);
+		return;
+	}
+
+	if (clients.count == clients.max)
+	{
+		clients.max = clients.max ? clients.max * 2 : 16;
+		clients.list = mem_realloc(MEM_OTHER, clients.list, clients.max * sizeof(client*));
+	}
+	client* c = mem_alloc(MEM_OTHER, sizeof(client));
+	c->fd = fd;
+	c->out = out;
+	c->len = 0;
+	clients.list[clients.count++] = c;
+}
+
+static void close_client(client* c)
+{
+	fclose(c->out);
+	close(c->fd);
+	mem_free(MEM_OTHER, c);
+}
+
+// run the jobs of the lines that have arrived - returns -1 when the connection should be closed
+static int serve_client(client* c, backend_type default_target)
+{
+	char* end;
+
+	long n = read(c->fd, c->line + c->len, DAEMON_MAX_LINE - c->len);
+	if (n <= 0)
+		return (n < 0 && errno == EINTR) ? 0 : -1;
+	c->len += n;
+
+	char* start = c->line;
+	while (!stop && (end = memchr(start, '\n', c->line + c->len - start)))
+	{
+		*end = 0;
+		run_job(start, c->out, default_target);
+		if (fflush(c->out))
+			return -1;
+		start = end + 1;
+	}
+
+	c->len -= start - c->line;
+	memmove(c->line, start, c->len);
+	if (c->len == DAEMON_MAX_LINE)
+	{
+		fprintf(c->out, "error the job is longer than %u bytes\n", DAEMON_MAX_LINE - 1);
+		fflush(c->out);
+		return -1;
+	}
+	return 0;
+}
+
+// wait until there is a new connection or a job line, and serve it
+static void serve_ready(int fd, backend_type default_target)
+{
+	struct pollfd* fds = mem_alloc(MEM_OTHER, (clients.count + 1) * sizeof(struct pollfd));
+
+	fds[0].fd = fd;
+	fds[0].events = POLLIN;
+	for (unsigned int i=0; i < clients.count; i++)
+	{
+		fds[i+1].fd = clients.list[i]->fd;
+		fds[i+1].events = POLLIN;
+	}
+
+	if (poll(fds, clients.count + 1, -1) < 0)
+	{
+		if (errno != EINTR)
+			log_warn("poll failed: %s\n", strerror(errno));
+		mem_free(MEM_OTHER, fds);
+		return;
+	}
+
+	// the closed connections are removed, and the others keep their order
+	unsigned int count = 0;
+	for (unsigned int i=0; i < clients.count; i++)
+	{
+		client* c = clients.list[i];
+		if (fds[i+1].revents && serve_client(c, default_target))
+			close_client(c);
+		else
+			clients.list[count++] = c;
+	}
+	clients.count = count;
+
+	if (fds[0].revents & POLLIN)
+	{
+		int client = accept(fd, NULL, NULL);
+		if (client >= 0)
+			add_client(client);
+		else if (errno != EINTR)
+			log_warn("accept failed: %s\n", strerror(errno));
+	}
+	mem_free(MEM_OTHER, fds);
+}
+
+int daemon_serve(const char* socket_path, backend_type default_target)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct sigaction sa = { .sa_handler = handle_stop };
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path))
+	{
+		log_error("Socket path %s is too long\n", socket_path);
+		return -1;
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+	{
+		log_error("Can't create a socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	// a socket file that nobody answers on is left over from a daemon that didn't exit cleanly
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0)
+	{
+		log_error("Another daemon is already listening on %s\n", socket_path);
+		close(fd);
+		return -1;
+	}
+	unlink(socket_path);
+
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) || listen(fd, 16))
+	{
+		log_error("Can't listen on %s: %s\n", socket_path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	// no SA_RESTART, so that a signal interrupts the poll() that is waiting
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+	cache_memory_init(DAEMON_CACHE_MEMORY);
+
+	log_info("Listening on %s\n", socket_path);
+	while (!stop)
+		serve_ready(fd, default_target);
+
+	for (unsigned int i=0; i < clients.count; i++)
+		close_client(clients.list[i]);
+	mem_free(MEM_OTHER, clients.list);
+	clients.list = NULL;
+	clients.count = clients.max = 0;
+	close(fd);
+	unlink(socket_path);
+	return 0;
+}
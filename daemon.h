@@ -0,0 +1,30 @@
+/* Daemon
+
+Runs the delinker as a service on a Unix domain socket. The backends are only initialized once, and
+the analysis of the code is kept in memory between jobs (see cache_memory_init), so a job that
+delinks code the daemon has already seen only pays for writing the objects.
+
+A job is one line of tab-separated fields: the input file, the output directory, and then any
+options, which have the names of the long command line options: reconstruct-symbols, fill-gaps,
+shared-data, slice-data, function-sections, stream, jobs=<n>, output-target=<name> and
+incremental[=<manifest>]. The options given on the daemon's command line are the defaults of every job.
+A job with incremental runs in incremental mode, with its manifest in the output directory
+(delinker.manifest unless a name is given), so the objects that haven't changed since the last job for
+that directory are not written again; the other jobs write the same objects as a normal run. The reply
+is "ok <n>" followed by n lines in the format of the manifest file (kind, hash, name): the result
+manifest in incremental mode, otherwise the files that were written, with a hash of 0. An error is
+"error <message>". Paths are taken from the daemon's working directory. A client can send any number of
+jobs on one connection. The options of a job are set in the global configuration, so the daemon runs
+one job at a time, on a single thread: it waits on all of the connections at once and runs each job
+as soon as its line has arrived, so a client that keeps its connection open doesn't hold up the others,
+but a job waits for the one that is running (the jobs of each connection run in the order they arrive). */
+
+#ifndef _DAEMON__H
+#define _DAEMON__H
+
+#include "delinker.h"
+
+/* serve jobs until SIGINT or SIGTERM - returns -1 if the socket can't be opened */
+int daemon_serve(const char* socket_path, backend_type default_target);
+
+#endif // _DAEMON__H
@@ -0,0 +1,64 @@
+/* Delinker
+
+The public interface of libdelinker (libdelinker.a / libdelinker.so), for programs that want to run
+the delinking pipeline without going through the command line, i.e. to delink many binaries in one
+process. The pipeline has three steps over a backend_object: read the input file, analyze the code
+(find the functions and turn the absolute addresses into relocations), and emit the output objects
+to a directory. unlink_file() runs all three and destroys the object. The settings are the same ones
+that the command line options change, and must be set before the pipeline runs. Several files may
+be delinked at the same time from different threads, as long as they are written to different
+directories. */
+
+#ifndef _DELINKER__H
+#define _DELINKER__H
+
+#include "backend.h"
+
+enum error_codes
+{
+   ERR_NONE,
+   ERR_BAD_FILE,
+   ERR_BAD_FORMAT,
+   ERR_NO_SYMS,
+   ERR_NO_SYMS_AFTER_RECONSTRUCT,
+   ERR_NO_TEXT_SECTION,
+   ERR_NO_PLT_SECTION
+};
+
+struct config
+{
+   int reconstruct_symbols;
+   int fill_gaps;				// trust the existing function symbols, and only reconstruct what they don't cover
+   const char* cache_dir;	// where to keep the decode cache (NULL = don't cache)
+   const char* result_cache;	// where to keep the outputs of whole runs, to copy them for the same input (NULL = don't)
+   const char* manifest;	// manifest of the previous run for incremental mode (NULL = write everything)
+   int shared_data;			// write the data sections once to their own object, instead of into every object
+   int slice_data;			// only copy the parts of the data sections that each object refers to
+   int jobs;					// number of threads that write the output objects (0 = one per CPU)
+   int stream;				// release the input data as soon as the units that need it are written
+   unsigned long max_memory;	// memory limit for streaming mode, in bytes (0 = no limit) - it bounds estimates of the memory in use, not the real use - see unlink_file_limit()
+   int function_sections;	// put each function in its own code section, so the linker can drop or reorder them
+};
+
+extern struct config config;
+
+int delinker_init(void); /* must be called first - calling it again does nothing */
+backend_object* delinker_read(const char* input_filename); /* NULL if the file can't be read or its format is unknown */
+int delinker_analyze(backend_object* obj); /* returns 0 or -ERR_ */
+/* output_dir = NULL for the current directory (it must exist), output_target = OBJECT_TYPE_NONE for the
+same type as the input. A relative manifest path (incremental mode) is taken from output_dir too. */
+int delinker_emit(backend_object* obj, const char* output_dir, backend_type output_target);
+
+/* read the input file, and write the output objects to output_dir - returns 0 or -ERR_ */
+int unlink_file(const char* input_filename, const char* output_dir, backend_type output_target);
+/* the same, with its own memory limit for streaming instead of config.max_memory (i.e. its share of a
+limit for several files that are delinked at the same time) */
+int unlink_file_limit(const char* input_filename, const char* output_dir, backend_type output_target, unsigned long max_memory);
+/* the same as unlink_file, and add the names of the files that make up the output (MANIFEST_OBJECT
+entries, with a hash of 0) to outputs, which is from manifest_init() in manifest.h */
+struct manifest;
+int unlink_file_outputs(const char* input_filename, const char* output_dir, backend_type output_target, struct manifest* outputs);
+
+const char* delinker_error_name(int ret); /* short description of a result of the functions above */
+
+#endif // _DELINKER__H
@@ -8,8 +8,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
-#include <udis86.h> // X86 and X86_64 disassembler - probably should be in a separate .c file
 #include "backend.h"
+#include "alloc.h"
+#include "trace.h"
+#include "log.h"
 
 #pragma pack(1)
 
@@ -429,41 +431,41 @@ void dump_elf_header(const char* buf)
 
    if (e64->size == 1)
    {
-      printf("32-bit ELF header\n");
+      log_debug("32-bit ELF header\n");
    }
    else if (e64->size == 2)
    {
-      printf("64-bit ELF header\n");
+      log_debug("64-bit ELF header\n");
       if (e64->endian == 1)
-         printf("Little endian\n");
+         log_debug("Little endian\n");
       else if (e64->endian == 2)
-         printf("Big endian\n");
+         log_debug("Big endian\n");
       else
-         printf("Unknown endian %i\n", e64->endian);
-      printf("Version: %i\n", e64->version);
+         log_warn("Unknown endian %i\n", e64->endian);
+      log_debug("Version: %i\n", e64->version);
    }
    else
    {
-      printf("%i is not a known ELF size\n", e64->size);
+      log_error("%i is not a known ELF size\n", e64->size);
    }
 
-   printf("OS: %s\n", elf_lookup_os(e64->os));
-   printf("Type: %s\n", elf_lookup_type(e64->type));
-   printf("Machine: %s (%i)\n", elf_lookup_machine(e64->machine), e64->machine);
-   printf("Entry point: 0x%lx\n", e64->entry);
-   printf("Number of program headers: %i\n", e64->ph_num); 
+   log_debug("OS: %s\n", elf_lookup_os(e64->os));
+   log_debug("Type: %s\n", elf_lookup_type(e64->type));
+   log_debug("Machine: %s (%i)\n", elf_lookup_machine(e64->machine), e64->machine);
+   log_debug("Entry point: 0x%lx\n", e64->entry);
+   log_debug("Number of program headers: %i\n", e64->ph_num); 
 }
 
 void dump_elf64_section(elf64_section* s, const char* strtab)
 {
-   printf("Name: %s\n", strtab + s->name);
-   printf("Type: %s\n", elf_lookup_section_type(s->type));
-   printf("Flags: 0x%lx\n", s->flags);
-   printf("Load address: 0x%lx\n", s->addr);
-   printf("File Offset: 0x%lx\n", s->offset);
-   printf("Size: 0x%lx\n", s->size);
-   printf("Alignment: %i (%lu)\n", 2 << s->addralign, s->addralign);
-   printf("Entry size: %lu\n\n", s->entsize);
+   log_debug("Name: %s\n", strtab + s->name);
+   log_debug("Type: %s\n", elf_lookup_section_type(s->type));
+   log_debug("Flags: 0x%lx\n", s->flags);
+   log_debug("Load address: 0x%lx\n", s->addr);
+   log_debug("File Offset: 0x%lx\n", s->offset);
+   log_debug("Size: 0x%lx\n", s->size);
+   log_debug("Alignment: %i (%lu)\n", 2 << s->addralign, s->addralign);
+   log_debug("Entry size: %lu\n\n", s->entsize);
 }
 
 const char* elf32_name(void)
@@ -559,50 +561,6 @@ int elf_reloc_addend(elf_x86_64_reloc_type t)
    return 0;
 }
 
-static long decode_plt_entry(elf_machine m, const char* plt_entry)
-{
-   ud_t ud_obj;
-   ud_init(&ud_obj);
-
-   //printf("Looking up at %p\n", plt_entry);
-   switch(m)
-   {
-   case ELF_ISA_X86:
-      ud_set_mode(&ud_obj, 32); // decode in 32 bit mode
-      break;
-
-   case ELF_ISA_X86_64:
-      ud_set_mode(&ud_obj, 64);
-      break;
-
-   default:
-      return -1;
-   }
-
-   // decode that entry
-   enum ud_mnemonic_code mnem;
-   unsigned bytes;
-   ud_set_input_buffer(&ud_obj, plt_entry, 0x10);
-   bytes = ud_disassemble(&ud_obj); // the 'jump' to the GOT
-   //bytes = ud_disassemble(&ud_obj); // the 'push'
-   //bytes = ud_disassemble(&ud_obj); // then the 'jump'to PLT start
-   mnem = ud_insn_mnemonic(&ud_obj);
-   if (mnem != UD_Ijmp)
-   {
-      printf("PLT instruction is not jump\n");
-      return -1;
-   }
-
-   const struct ud_operand* op = ud_insn_opr(&ud_obj, 0);
-   if (!op)
-      return -2;
-
-   //printf("%lx: %s\n", plt_addr, ud_lookup_mnemonic(mnem));
-   //printf("OP: %x %p %x\n", op->lval.sdword, plt_entry, bytes);
-   
-   return op->lval.sdword;
-}
-
 // read the section headers sequentially from the file, looking for a specific section name
 int elf64_find_section(FILE* f, const elf64_header* h, const char* name, const char* strtab, elf64_section* s)
 {
@@ -630,22 +588,26 @@ static backend_object* elf32_read_file(FILE* f, elf32_header* h)
 static backend_object* elf64_read_file(FILE* f, elf64_header* h)
 {
    elf64_section in_sec;
+   trace_span span;
+   unsigned long data_size = 0;
 
    backend_object* obj = backend_create();
    if (!obj)
       return 0;
 
    backend_set_type(obj, OBJECT_TYPE_ELF64);
+   backend_set_entry_point(obj, h->entry);
 
-   printf("Number of section headers: %i\n", h->sh_num); 
-   printf("Size of section headers: %i\n", h->shent_size); 
-   printf("String table index: %i\n", h->sh_str_index);
+   log_debug("Number of section headers: %i\n", h->sh_num); 
+   log_debug("Size of section headers: %i\n", h->shent_size); 
+   log_debug("String table index: %i\n", h->sh_str_index);
 
    // first, preload the section header string table
+   trace_begin(&span);
    fseek(f, h->sh_off + h->shent_size * h->sh_str_index, SEEK_SET);
    fread(&in_sec, h->shent_size, 1, f);
 
-   char* section_strtab = malloc(in_sec.size);
+   char* section_strtab = mem_alloc(MEM_STRINGS, in_sec.size);
    fseek(f, in_sec.offset, SEEK_SET);
    fread(section_strtab, in_sec.size, 1, f);
    
@@ -660,10 +622,16 @@ static backend_object* elf64_read_file(FILE* f, elf64_header* h)
       if (!backend_get_section_by_name(obj, name))
       {
          unsigned long flags=0;
-         char* data = malloc(in_sec.size);
+         char* data = NULL;
 
-         fseek(f, in_sec.offset, SEEK_SET);
-         fread(data, in_sec.size, 1, f);
+         // uninitialized data (.bss) has no contents in the file
+         if (in_sec.type != SHT_NOBITS)
+         {
+            data = mem_alloc(MEM_DATA, in_sec.size);
+            fseek(f, in_sec.offset, SEEK_SET);
+            fread(data, in_sec.size, 1, f);
+            data_size += in_sec.size;
+         }
 
          // set flags for known sections by name
          if (strcmp(name, ".text") == 0)
@@ -678,30 +646,30 @@ static backend_object* elf64_read_file(FILE* f, elf64_header* h)
             flags = SECTION_FLAG_UNINIT_DATA;
          else
          {
-            if (in_sec.flags & SHF_EXECINSTR)
+            if (in_sec.flags & (1<<SHF_EXECINSTR))
                flags = SECTION_FLAG_CODE;
-            if (in_sec.flags & SHF_ALLOC && !(in_sec.flags & SHF_EXECINSTR) && (!in_sec.flags & SHF_WRITE))
-               flags = SECTION_FLAG_INIT_DATA;
-            if (in_sec.flags & SHF_ALLOC && !(in_sec.flags & SHF_EXECINSTR)) // not exactly accurate - better to set these flags according to section name
-               flags = SECTION_FLAG_UNINIT_DATA;
+            else if (in_sec.flags & (1<<SHF_ALLOC))
+               flags = (in_sec.type == SHT_NOBITS) ? SECTION_FLAG_UNINIT_DATA : SECTION_FLAG_INIT_DATA;
          }
          backend_add_section(obj, name, in_sec.size, in_sec.addr, data, in_sec.entsize, in_sec.addralign, flags);
       }
    }
+   trace_end(&span, "read_sections", NULL, "sections", (unsigned long)backend_section_count(obj), "bytes", data_size, NULL);
 
    // now that we have the raw data, try to format it as objects the backend can understand (strings, symbols, sections, relocs, etc)
    backend_section* sec_strtab = backend_get_section_by_name(obj, ".strtab");
    if (!sec_strtab)
    {
-      printf("Can't find string table section!\n");
+      log_info("Can't find string table section!\n");
       goto done;
    }
 
    // create symbols
+   trace_begin(&span);
    backend_section* sec_symtab = backend_get_section_by_name(obj, ".symtab");
    if (!sec_symtab)
    {
-      printf("Can't find symbol table section!\n");
+      log_info("Can't find symbol table section!\n");
       goto done;
    }
    elf64_symbol* sym = (elf64_symbol*)sec_symtab->data;
@@ -727,47 +695,49 @@ static backend_object* elf64_read_file(FILE* f, elf64_header* h)
       }
       sym++;
    }
+   trace_end(&span, "read_symbols", NULL, "symbols", (unsigned long)backend_symbol_count(obj), NULL);
+   trace_begin(&span);
 
    // since we are dealing with dynamic symbols, we will need access to the dynamic symbol table, dynamic string table and version tables
    backend_section* sec_dynsym = backend_get_section_by_name(obj, ".dynsym");
    if (!sec_dynsym)
    {
-      printf("Can't find .dynsym\n");
+      log_debug("Can't find .dynsym\n");
       goto done;
    }
 
    backend_section* sec_dynstr = backend_get_section_by_name(obj, ".dynstr");
    if (!sec_dynstr)
    {
-      printf("Can't find .dynstr\n");
+      log_debug("Can't find .dynstr\n");
       goto done;
    }
 
    backend_section* sec_versym = backend_get_section_by_name(obj, ".gnu.version");
    if (!sec_versym)
    {
-      printf("Can't find .gnu.version\n");
+      log_debug("Can't find .gnu.version\n");
       goto done;
    }
 
    backend_section* sec_versymr = backend_get_section_by_name(obj, ".gnu.version_r");
    if (!sec_versymr)
    {
-      printf("Can't find .gnu.version_r\n");
+      log_debug("Can't find .gnu.version_r\n");
       goto done;
    }
 
    backend_section* sec_text = backend_get_section_by_name(obj, ".text");
    if (!sec_text)
    {
-      printf("Can't find code section!\n");
+      log_warn("Can't find code section!\n");
       goto done;
    }
 
    backend_section* sec_plt = backend_get_section_by_name(obj, ".plt");
    if (!sec_plt)
    {
-      printf("Can't find PLT section!\n");
+      log_debug("Can't find PLT section!\n");
       goto done;
    }
 
@@ -777,7 +747,7 @@ static backend_object* elf64_read_file(FILE* f, elf64_header* h)
    backend_section* sec_rela = backend_get_section_by_name(obj, ".rela.plt");
    if (!sec_rela)
    {
-      printf("Can't find PLT reloc section!\n");
+      log_debug("Can't find PLT reloc section!\n");
       goto done;
    }
 
@@ -796,7 +766,7 @@ static backend_object* elf64_read_file(FILE* f, elf64_header* h)
       dsym = (elf64_symbol*)sec_dynsym->data + index;
       //printf("dynsym @ %p dsym @ %p\n", sec_dynsym->data, dsym);
       strcpy(sym_name, sec_dynstr->data + dsym->name);
-      printf("Found symbol name %s at offset 0x%lx\n", sym_name, rela->addr);
+      log_debug("Found symbol name %s at offset 0x%lx\n", sym_name, rela->addr);
 
       backend_add_symbol(obj, sym_name, rela->addr, SYMBOL_TYPE_FUNCTION, 0, SYMBOL_FLAG_EXTERNAL, sec_text);
       
@@ -823,28 +793,27 @@ static backend_object* elf64_read_file(FILE* f, elf64_header* h)
             //printf("Address: 0x%lx\n", sym_addr);
             //sec = backend_find_section_by_val(obj, plt_addr);
             //printf("0x%lx is in section %s\n", plt_addr, sec->name);
-            //long sym_addr = decode_plt_entry(ELF_ISA_X86_64, (char*)(sec->data + (plt_addr - sec->address) - 6)) + plt_addr;
-            printf("Adding import function %s @ 0x%lx\n", sym_name, sym_addr);
+            log_debug("Adding import function %s @ 0x%lx\n", sym_name, sym_addr);
             backend_add_import_function(mod, sym_name, sym_addr);
          }
 
          // now get the corresponding symbol from the main table and delete it
          strcat(sym_name, "@@");
          strcat(sym_name, module_name);
-         printf("Removing original PLT symbol %s (%i)\n", sym_name, backend_symbol_count(obj));
+         log_debug("Removing original PLT symbol %s (%i)\n", sym_name, backend_symbol_count(obj));
          backend_remove_symbol_by_name(obj, sym_name);
-         printf("After: %i\n", backend_symbol_count(obj));
+         log_debug("After: %i\n", backend_symbol_count(obj));
       }
 
       rela++;
    }
-   
+   trace_end(&span, "read_imports", NULL, "imports", (unsigned long)(sec_rela->size/sec_rela->entry_size), NULL);
 
 done:
-   free(section_strtab);
+   mem_free(MEM_STRINGS, section_strtab);
 
-   printf("ELF64 loading done (%i symbols, %i relocs)\n", backend_symbol_count(obj), backend_relocation_count(obj));
-   printf("-----------------------------------------\n");
+   log_info("ELF64 loading done (%i symbols, %i relocs)\n", backend_symbol_count(obj), backend_relocation_count(obj));
+   log_debug("-----------------------------------------\n");
 
    return obj;
 }
@@ -852,12 +821,12 @@ done:
 static backend_object* elf_read_file(const char* filename)
 {
    backend_object* obj = NULL;
-   char* buff = malloc(sizeof(elf64_header));
+   char* buff = mem_alloc(MEM_OTHER, sizeof(elf64_header));
 
    FILE* f = fopen(filename, "rb");
    if (!f)
    {
-      printf("can't open file\n");
+      log_error("can't open file\n");
       goto done;
    }
 
@@ -881,14 +850,96 @@ static backend_object* elf_read_file(const char* filename)
    else if (h->size == 2)
       obj = elf64_read_file(f, (elf64_header*)buff);
    else
-      printf("Unknown ELF size: %i (not 32-bit, not 64-bit)\n", h->size);
+      log_error("Unknown ELF size: %i (not 32-bit, not 64-bit)\n", h->size);
 
 done:
-   free(buff);
+   mem_free(MEM_OTHER, buff);
    
    return obj;
 }
 
+// the first symbol that is not local - used when there are no function symbols
+static backend_symbol* first_global_symbol(backend_object* obj)
+{
+   backend_symbol* sym = backend_get_first_symbol(obj);
+   while (sym)
+   {
+      if (sym->flags & SYMBOL_FLAG_GLOBAL)
+         return sym;
+      sym = backend_get_next_symbol(obj);
+   }
+   return NULL;
+}
+
+// which section a symbol belongs to (symbols that don't know their section belong to .text)
+static int symbol_section_index(backend_object* obj, const backend_symbol* sym, int text_index)
+{
+   if (!sym->section || sym->section->_index == -1)
+      return text_index;
+   return sym->section->_index;
+}
+
+// space needed for all of the section names in the section header string table
+static unsigned int section_names_size(backend_object* obj)
+{
+   unsigned int size = 1; // the initial empty string
+   backend_section* bs = backend_get_first_section(obj);
+   while (bs)
+   {
+      size += strlen(bs->name) + 1;
+      bs = backend_get_next_section(obj);
+   }
+   return size;
+}
+
+// every code section that has relocations needs a matching .rela section. Each code section and its
+// .rela section are linked to each other (through _link), so the writer doesn't have to look them up.
+static void add_rela_sections(backend_object* obj)
+{
+   char name[256];
+
+   if (!obj->section_table)
+      return;
+
+   for (const list_node* iter=ll_iter_start(obj->section_table); iter != NULL; iter=iter->next)
+      ((backend_section*)iter->val)->_link = NULL;
+
+   // .rela sections that are already there (i.e. the object was read from a file) are used as they are
+   for (const list_node* iter=ll_iter_start(obj->section_table); iter != NULL; iter=iter->next)
+   {
+      backend_section* rela = iter->val;
+      if (strncmp(".rela", rela->name, 5) != 0)
+         continue;
+      backend_section* target = backend_get_section_by_name(obj, rela->name + 5);
+      if (target && !target->_link)
+      {
+         target->_link = rela;
+         rela->_link = target;
+      }
+   }
+
+   if (backend_relocation_count(obj) == 0)
+      return;
+
+   // the new sections are added at the end of the list, and aren't code, so they are just skipped
+   for (const list_node* iter=ll_iter_start(obj->section_table); iter != NULL; iter=iter->next)
+   {
+      backend_section* sec = iter->val;
+      if (strcmp(".text", sec->name) != 0 && !(sec->flags & SECTION_FLAG_CODE))
+         continue;
+      if (sec->_link || backend_section_relocation_count(obj, sec) == 0)
+         continue;
+
+      snprintf(name, sizeof(name), ".rela%s", sec->name);
+      backend_section* rela = backend_add_section(obj, name, 0, 0, 0, 0, 0, 0);
+      if (rela)
+      {
+         sec->_link = rela;
+         rela->_link = sec;
+      }
+   }
+}
+
 static int elf32_write_file(backend_object* obj, const char* filename)
 {
    backend_section *bs;
@@ -902,18 +953,14 @@ static int elf32_write_file(backend_object* obj, const char* filename)
    FILE* f = fopen(filename, "wb");
    if (!f)
    {
-      printf("can't open file\n");
+      log_error("can't open file\n");
       return -1;
    }
 
    // before anything, ensure the backend object isn't missing anything, and is ready to be written
    
-   // if there are any relocations, we must have a .rela.text section
-   if (backend_relocation_count(obj) > 0)
-   {
-      if (!backend_get_section_by_name(obj, ".rela.text"))
-         bs = backend_add_section(obj, ".rela.text", 0, 0, 0, 0, 0, 0);
-   }
+   // if there are any relocations, we must have a .rela section for each code section they apply to
+   add_rela_sections(obj);
 
    // if there are any sections, we must have a section header string table
    if (backend_section_count(obj) > 0)
@@ -931,6 +978,14 @@ static int elf32_write_file(backend_object* obj, const char* filename)
          bs = backend_add_section(obj, ".strtab", 0, 0, 0, 0, 0, 0);
    }
 
+   // the headers and relocations refer to the sections and symbols by index
+   backend_index_sections(obj);
+   backend_index_symbols(obj);
+
+   // there can be many sections (i.e. one per function) so make sure all of the names fit
+   if (section_names_size(obj) > shstrtab_size)
+      shstrtab_size = section_names_size(obj);
+
    // write file header
    memset(&fh, 0, sizeof(elf32_header));
    memcpy(fh.magic, ELF_MAGIC, MAGIC_SIZE);
@@ -951,10 +1006,11 @@ static int elf32_write_file(backend_object* obj, const char* filename)
 
    // so we know where to write the next object
    int fpos_cur;
+   int symtab_index = backend_get_section_index_by_name(obj, ".symtab");
    int fpos_data = fh.sh_off + fh.shent_size*fh.sh_num;
 
    // build the section header string table with the names we need
-   char* shstrtab = malloc(shstrtab_size); // just need enough space for a few strings
+   char* shstrtab = mem_alloc(MEM_STRINGS, shstrtab_size); // just need enough space for a few strings
    char* shstrtab_entry = shstrtab+1;
    shstrtab[0] = 0; // the initial entry is always 0
    bs = backend_get_first_section(obj);
@@ -966,13 +1022,13 @@ static int elf32_write_file(backend_object* obj, const char* filename)
       shstrtab_entry += strlen(shstrtab_entry) + 1;
       if (shstrtab_entry - shstrtab > shstrtab_size)
       {
-         printf("Exceeded section header string table size\n");
+         log_error("Exceeded section header string table size\n");
       }
       bs = backend_get_next_section(obj);
    }
 
    // build the symbol string table as well
-   char* strtab = malloc(strtab_size);
+   char* strtab = mem_alloc(MEM_STRINGS, strtab_size);
    char* strtab_entry = strtab+1;
    strtab[0] = 0; // the initial entry is always 0
 
@@ -992,12 +1048,14 @@ static int elf32_write_file(backend_object* obj, const char* filename)
       sh.link = 0;
       sh.info = 0;
       sh.entsize = 0;
+      sh.type = SHT_NULL;
+      sh.flags = 0;
       sh.name = bs->_name;
 
-      if (strcmp(".text", bs->name) == 0)
+      if (strcmp(".text", bs->name) == 0 || bs->flags & SECTION_FLAG_CODE)
       {
-         // write the .text section & header
-         printf("Writing .text section\n");
+         // write the code section & header
+         log_debug("Writing %s section\n", bs->name);
          sh.type = SHT_PROGBITS;
          sh.flags = (1<<SHF_ALLOC) | (1<<SHF_EXECINSTR);
          sh.addr = bs->address;
@@ -1013,37 +1071,38 @@ static int elf32_write_file(backend_object* obj, const char* filename)
             fpos_data += sh.size;
          }
       }
-      else if (strcmp(".rela.text", bs->name) == 0)
+      else if (strncmp(".rela", bs->name, 5) == 0)
       {
-         // write the .rela section header
-         printf("Writing .rela.text section\n");
+         // write the .rela section header - add_rela_sections() linked it to the section that is relocated
+         backend_section* target = bs->_link;
+         log_debug("Writing %s section\n", bs->name);
          sh.type = SHT_RELA;
          sh.flags = (1<<SHF_INFO);
-         sh.link = backend_get_section_index_by_name(obj, ".symtab"); // which symbol table to use
+         sh.link = symtab_index; // which symbol table to use
          if (sh.link == -1)
-            printf("Error getting .symtab index\n");
-         sh.info = backend_get_section_index_by_name(obj, ".text"); // which code is relevant
+            log_error("Error getting .symtab index\n");
+         sh.info = target ? target->_index : -1; // which code is relevant
          if (sh.info == -1)
-            printf("Error getting .text index\n");
+            log_error("Error getting %s index\n", bs->name + 5);
          sh.entsize = sizeof(elf32_rela);
-         sh.size = backend_relocation_count(obj) * sizeof(elf32_rela);
+         sh.size = target ? backend_section_relocation_count(obj, target) * sizeof(elf32_rela) : 0;
          sh.addralign = 8;
          if (sh.size)
          {
             sh.offset = ALIGN(fpos_data, sh.addralign);
             fpos_cur = ftell(f);
             fseek(f, sh.offset, SEEK_SET);
-            backend_reloc* r = backend_get_first_reloc(obj);
+            backend_reloc* r = backend_get_first_section_reloc(obj, target);
             while (r)
             {
                elf32_rela rela;
                rela.addr = r->offset;
                unsigned int reloc_type = backend_to_elf32_reloc_type(r->type);
-               rela.info = ELF32_R_INFO(backend_get_symbol_index(obj, r->symbol)+1, reloc_type); // elf has 1 null symbol at the beginning
+               rela.info = ELF32_R_INFO(r->symbol->_index+1, reloc_type); // elf has 1 null symbol at the beginning
                rela.addend = r->addend;
-               //printf("writing reloc for 0x%x symbol: %s (%u) addend: 0x%x type=%u\n", rela.addr, r->symbol->name, backend_get_symbol_index(obj, r->symbol)+1, rela.addend, reloc_type);
+               //printf("writing reloc for 0x%x symbol: %s (%u) addend: 0x%x type=%u\n", rela.addr, r->symbol->name, r->symbol->_index+1, rela.addend, reloc_type);
                fwrite(&rela, sizeof(elf32_rela), 1, f);
-               r = backend_get_next_reloc(obj);
+               r = backend_get_next_section_reloc(obj);
             }
             fpos_data = ftell(f);
             fseek(f, fpos_cur, SEEK_SET);
@@ -1052,7 +1111,7 @@ static int elf32_write_file(backend_object* obj, const char* filename)
       else if (strcmp(".data", bs->name) == 0)
       {
          // write the .data section header
-         printf("Writing .data section\n");
+         log_debug("Writing .data section\n");
          sh.type = SHT_PROGBITS;
          sh.flags = (1<<SHF_ALLOC) | (1<<SHF_WRITE);
          sh.addr = bs->address;
@@ -1070,13 +1129,24 @@ static int elf32_write_file(backend_object* obj, const char* filename)
       }
       else if (strcmp(".bss", bs->name) == 0)
       {
-         // write the .bss section header
-         printf("Writing .bss section\n");
+         // write the .bss section header (there is no data in the file)
+         log_debug("Writing .bss section\n");
          sh.type = SHT_NOBITS;
          sh.flags = (1<<SHF_ALLOC) | (1<<SHF_WRITE);
          sh.addr = bs->address;
          sh.size = bs->size;
          sh.addralign = bs->alignment;
+         sh.offset = fpos_data;
+      }
+      else if (strcmp(".rodata", bs->name) == 0)
+      {
+         // write the .rodata section header
+         log_debug("Writing .rodata section\n");
+         sh.type = SHT_PROGBITS;
+         sh.flags = (1<<SHF_ALLOC);
+         sh.addr = bs->address;
+         sh.size = bs->size;
+         sh.addralign = bs->alignment;
          if (sh.size)
          {
             sh.offset = fpos_data;
@@ -1087,16 +1157,16 @@ static int elf32_write_file(backend_object* obj, const char* filename)
             fpos_data += sh.size;
          }
       }
-      else if (strcmp(".rodata", bs->name) == 0)
+      else if (strcmp(".symtab", bs->name) != 0 && bs->flags & (SECTION_FLAG_INIT_DATA | SECTION_FLAG_UNINIT_DATA))
       {
-         // write the .rodata section header
-         printf("Writing .rodata section\n");
-         sh.type = SHT_PROGBITS;
-         sh.flags = (1<<SHF_ALLOC);
+         // any other data section
+         log_debug("Writing %s section\n", bs->name);
+         sh.type = (bs->flags & SECTION_FLAG_UNINIT_DATA) ? SHT_NOBITS : SHT_PROGBITS;
+         sh.flags = (1<<SHF_ALLOC) | (1<<SHF_WRITE);
          sh.addr = bs->address;
          sh.size = bs->size;
          sh.addralign = bs->alignment;
-         if (sh.size)
+         if (sh.size && sh.type == SHT_PROGBITS)
          {
             sh.offset = fpos_data;
             fpos_cur = ftell(f);
@@ -1111,17 +1181,19 @@ static int elf32_write_file(backend_object* obj, const char* filename)
          backend_symbol* sym;
          int text_index = backend_get_section_index_by_name(obj, ".text");
          // write the .symtab section header
-         printf("Writing .symtab section\n");
+         log_debug("Writing .symtab section\n");
          sh.type = SHT_SYMTAB;
          sh.link = backend_get_section_index_by_name(obj, ".strtab"); // which string table to use
          if (sh.link == -1)
-            printf("Error getting .symtab index\n");
+            log_error("Error getting .symtab index\n");
          // info contains the index of the first non-local symbol
          sym = backend_get_symbol_by_type_first(obj, SYMBOL_TYPE_FUNCTION);
+         if (!sym)
+            sym = first_global_symbol(obj);
          if (sym)
          {
             sh.info = backend_get_symbol_index(obj, sym) + 1; // add 1 for the null symbol
-            printf("First global symbol index %i\n", sh.info);
+            log_debug("First global symbol index %i\n", sh.info);
          }
 
          //printf("symtab index=%i\n", sh.link);
@@ -1134,7 +1206,7 @@ static int elf32_write_file(backend_object* obj, const char* filename)
             fpos_data = ALIGN(fpos_data, sh.addralign);
             sh.offset = fpos_data;
             fpos_cur = ftell(f);
-            printf("We have %u symbols\n", backend_symbol_count(obj)+1);
+            log_debug("We have %u symbols\n", backend_symbol_count(obj)+1);
             fseek(f, sh.offset, SEEK_SET);
       
             // write an empty symbol first
@@ -1147,7 +1219,7 @@ static int elf32_write_file(backend_object* obj, const char* filename)
                s.name = strtab_entry - strtab;
                s.info = backend_to_elf_sym_type(sym->type);
                s.other = 0;
-               s.section_index = text_index; // link the symbol to the .text section
+               s.section_index = symbol_section_index(obj, sym, text_index); // link the symbol to its section
                s.value = sym->val;
                s.size = sym->size;
 
@@ -1171,7 +1243,7 @@ static int elf32_write_file(backend_object* obj, const char* filename)
                   s.section_index = backend_get_section_index_by_name(obj, sym->name); // which section does this symbol relate to
                   if (s.section_index == -1)
                   {
-                     printf("Error getting %s index\n", sym->name);
+                     log_error("Error getting %s index\n", sym->name);
                      sym = backend_get_next_symbol(obj);
                      continue;
                   }
@@ -1184,12 +1256,12 @@ static int elf32_write_file(backend_object* obj, const char* filename)
 
                if (sym->name)
                {
-                  if (strtab_entry - strtab + strlen(sym->name) > strtab_size)
+                  if (strtab_entry - strtab + strlen(sym->name) + 1 > strtab_size)
                   {
                      unsigned int offset = strtab_entry - strtab;
                      strtab_size += 4096;
-                     printf("Exceeded string table size - extending to %u\n", strtab_size);
-                     strtab = realloc(strtab, strtab_size);
+                     log_debug("Exceeded string table size - extending to %u\n", strtab_size);
+                     strtab = mem_realloc(MEM_STRINGS, strtab, strtab_size);
                      strtab_entry = strtab + offset;
                   }
                   strcpy(strtab_entry, sym->name);
@@ -1207,7 +1279,7 @@ static int elf32_write_file(backend_object* obj, const char* filename)
          // write the .strtab section header
          sh.type = SHT_STRTAB;
          sh.size = strtab_entry - strtab;
-         printf("Writing .strtab section (%u)\n", sh.size);
+         log_debug("Writing .strtab section (%u)\n", sh.size);
          if (sh.size)
          {
             // align fpos_data
@@ -1223,7 +1295,7 @@ static int elf32_write_file(backend_object* obj, const char* filename)
       else if (strcmp(".shstrtab", bs->name) == 0)
       {
          // write the .shstrtab section header
-         printf("Writing .shstrtab section\n");
+         log_debug("Writing .shstrtab section\n");
          sh.type = SHT_STRTAB;
          sh.offset = fpos_data;
          sh.size = shstrtab_entry - shstrtab;
@@ -1246,8 +1318,8 @@ static int elf32_write_file(backend_object* obj, const char* filename)
    }
 
 done:
-   free(shstrtab);
-   free(strtab);
+   mem_free(MEM_STRINGS, shstrtab);
+   mem_free(MEM_STRINGS, strtab);
    fclose(f);
    return 0;
 }
@@ -1265,18 +1337,14 @@ static int elf64_write_file(backend_object* obj, const char* filename)
    FILE* f = fopen(filename, "wb");
    if (!f)
    {
-      printf("can't open file\n");
+      log_error("can't open file\n");
       return -1;
    }
 
    // before anything, ensure the backend object isn't missing anything, and is ready to be written
    
-   // if there are any relocations, we must have a .rela.text section
-   if (backend_relocation_count(obj) > 0)
-   {
-      if (!backend_get_section_by_name(obj, ".rela.text"))
-         bs = backend_add_section(obj, ".rela.text", 0, 0, 0, 0, 0, 0);
-   }
+   // if there are any relocations, we must have a .rela section for each code section they apply to
+   add_rela_sections(obj);
 
    // if there are any sections, we must have a section header string table
    if (backend_section_count(obj) > 0)
@@ -1294,6 +1362,14 @@ static int elf64_write_file(backend_object* obj, const char* filename)
          bs = backend_add_section(obj, ".strtab", 0, 0, 0, 0, 0, 0);
    }
 
+   // the headers and relocations refer to the sections and symbols by index
+   backend_index_sections(obj);
+   backend_index_symbols(obj);
+
+   // there can be many sections (i.e. one per function) so make sure all of the names fit
+   if (section_names_size(obj) > shstrtab_size)
+      shstrtab_size = section_names_size(obj);
+
    // write file header
    memset(&fh, 0, sizeof(elf64_header));
    memcpy(fh.magic, ELF_MAGIC, MAGIC_SIZE);
@@ -1314,10 +1390,11 @@ static int elf64_write_file(backend_object* obj, const char* filename)
 
    // so we know where to write the next object
    int fpos_cur;
+   int symtab_index = backend_get_section_index_by_name(obj, ".symtab");
    int fpos_data = fh.sh_off + fh.shent_size*fh.sh_num;
 
    // build the section header string table with the names we need
-   char* shstrtab = malloc(shstrtab_size); // just need enough space for a few strings
+   char* shstrtab = mem_alloc(MEM_STRINGS, shstrtab_size); // just need enough space for a few strings
    char* shstrtab_entry = shstrtab+1;
    shstrtab[0] = 0; // the initial entry is always 0
    bs = backend_get_first_section(obj);
@@ -1329,13 +1406,13 @@ static int elf64_write_file(backend_object* obj, const char* filename)
       shstrtab_entry += strlen(shstrtab_entry) + 1;
       if (shstrtab_entry - shstrtab > shstrtab_size)
       {
-         printf("Exceeded section header string table size\n");
+         log_error("Exceeded section header string table size\n");
       }
       bs = backend_get_next_section(obj);
    }
 
    // build the symbol string table as well
-   char* strtab = malloc(strtab_size);
+   char* strtab = mem_alloc(MEM_STRINGS, strtab_size);
    char* strtab_entry = strtab+1;
    strtab[0] = 0; // the initial entry is always 0
 
@@ -1355,12 +1432,14 @@ static int elf64_write_file(backend_object* obj, const char* filename)
       sh.link = 0;
       sh.info = 0;
       sh.entsize = 0;
+      sh.type = SHT_NULL;
+      sh.flags = 0;
       sh.name = bs->_name;
 
-      if (strcmp(".text", bs->name) == 0)
+      if (strcmp(".text", bs->name) == 0 || bs->flags & SECTION_FLAG_CODE)
       {
-         // write the .text section & header
-         printf("Writing .text section\n");
+         // write the code section & header
+         log_debug("Writing %s section\n", bs->name);
          sh.type = SHT_PROGBITS;
          sh.flags = (1<<SHF_ALLOC) | (1<<SHF_EXECINSTR);
          sh.addr = bs->address;
@@ -1376,37 +1455,38 @@ static int elf64_write_file(backend_object* obj, const char* filename)
             fpos_data += sh.size;
          }
       }
-      else if (strcmp(".rela.text", bs->name) == 0)
+      else if (strncmp(".rela", bs->name, 5) == 0)
       {
-         // write the .rela section header
-         printf("Writing .rela.text section\n");
+         // write the .rela section header - add_rela_sections() linked it to the section that is relocated
+         backend_section* target = bs->_link;
+         log_debug("Writing %s section\n", bs->name);
          sh.type = SHT_RELA;
          sh.flags = (1<<SHF_INFO);
-         sh.link = backend_get_section_index_by_name(obj, ".symtab"); // which symbol table to use
+         sh.link = symtab_index; // which symbol table to use
          if (sh.link == -1)
-            printf("Error getting .symtab index\n");
-         sh.info = backend_get_section_index_by_name(obj, ".text"); // which code is relevant
+            log_error("Error getting .symtab index\n");
+         sh.info = target ? target->_index : -1; // which code is relevant
          if (sh.info == -1)
-            printf("Error getting .text index\n");
+            log_error("Error getting %s index\n", bs->name + 5);
          sh.entsize = sizeof(elf64_rela);
-         sh.size = backend_relocation_count(obj) * sizeof(elf64_rela);
+         sh.size = target ? backend_section_relocation_count(obj, target) * sizeof(elf64_rela) : 0;
          sh.addralign = 8;
          if (sh.size)
          {
             sh.offset = ALIGN(fpos_data, sh.addralign);
             fpos_cur = ftell(f);
             fseek(f, sh.offset, SEEK_SET);
-            backend_reloc* r = backend_get_first_reloc(obj);
+            backend_reloc* r = backend_get_first_section_reloc(obj, target);
             while (r)
             {
                elf64_rela rela;
                rela.addr = r->offset;
                unsigned int reloc_type = backend_to_elf64_reloc_type(r->type);
-               rela.info = ELF64_R_INFO(backend_get_symbol_index(obj, r->symbol)+1, reloc_type); // elf has 1 null symbol at the beginning
+               rela.info = ELF64_R_INFO(r->symbol->_index+1, reloc_type); // elf has 1 null symbol at the beginning
                rela.addend = r->addend;
-               //printf("writing reloc for 0x%lx symbol: %s (%u) addend: 0x%lx\n", rela.addr, r->symbol->name, backend_get_symbol_index(obj, r->symbol)+1, rela.addend);
+               //printf("writing reloc for 0x%lx symbol: %s (%u) addend: 0x%lx\n", rela.addr, r->symbol->name, r->symbol->_index+1, rela.addend);
                fwrite(&rela, sizeof(elf64_rela), 1, f);
-               r = backend_get_next_reloc(obj);
+               r = backend_get_next_section_reloc(obj);
             }
             fpos_data = ftell(f);
             fseek(f, fpos_cur, SEEK_SET);
@@ -1415,7 +1495,7 @@ static int elf64_write_file(backend_object* obj, const char* filename)
       else if (strcmp(".data", bs->name) == 0)
       {
          // write the .data section header
-         printf("Writing .data section\n");
+         log_debug("Writing .data section\n");
          sh.type = SHT_PROGBITS;
          sh.flags = (1<<SHF_ALLOC) | (1<<SHF_WRITE);
          sh.addr = bs->address;
@@ -1433,13 +1513,24 @@ static int elf64_write_file(backend_object* obj, const char* filename)
       }
       else if (strcmp(".bss", bs->name) == 0)
       {
-         // write the .bss section header
-         printf("Writing .bss section\n");
+         // write the .bss section header (there is no data in the file)
+         log_debug("Writing .bss section\n");
          sh.type = SHT_NOBITS;
          sh.flags = (1<<SHF_ALLOC) | (1<<SHF_WRITE);
          sh.addr = bs->address;
          sh.size = bs->size;
          sh.addralign = bs->alignment;
+         sh.offset = fpos_data;
+      }
+      else if (strcmp(".rodata", bs->name) == 0)
+      {
+         // write the .rodata section header
+         log_debug("Writing .rodata section\n");
+         sh.type = SHT_PROGBITS;
+         sh.flags = (1<<SHF_ALLOC);
+         sh.addr = bs->address;
+         sh.size = bs->size;
+         sh.addralign = bs->alignment;
          if (sh.size)
          {
             sh.offset = fpos_data;
@@ -1450,16 +1541,16 @@ static int elf64_write_file(backend_object* obj, const char* filename)
             fpos_data += sh.size;
          }
       }
-      else if (strcmp(".rodata", bs->name) == 0)
+      else if (strcmp(".symtab", bs->name) != 0 && bs->flags & (SECTION_FLAG_INIT_DATA | SECTION_FLAG_UNINIT_DATA))
       {
-         // write the .rodata section header
-         printf("Writing .rodata section\n");
-         sh.type = SHT_PROGBITS;
-         sh.flags = (1<<SHF_ALLOC);
+         // any other data section
+         log_debug("Writing %s section\n", bs->name);
+         sh.type = (bs->flags & SECTION_FLAG_UNINIT_DATA) ? SHT_NOBITS : SHT_PROGBITS;
+         sh.flags = (1<<SHF_ALLOC) | (1<<SHF_WRITE);
          sh.addr = bs->address;
          sh.size = bs->size;
          sh.addralign = bs->alignment;
-         if (sh.size)
+         if (sh.size && sh.type == SHT_PROGBITS)
          {
             sh.offset = fpos_data;
             fpos_cur = ftell(f);
@@ -1474,17 +1565,19 @@ static int elf64_write_file(backend_object* obj, const char* filename)
          backend_symbol* sym;
          int text_index = backend_get_section_index_by_name(obj, ".text");
          // write the .symtab section header
-         printf("Writing .symtab section\n");
+         log_debug("Writing .symtab section\n");
          sh.type = SHT_SYMTAB;
          sh.link = backend_get_section_index_by_name(obj, ".strtab"); // which string table to use
          if (sh.link == -1)
-            printf("Error getting .symtab index\n");
+            log_error("Error getting .symtab index\n");
          // info contains the index of the first non-local symbol
          sym = backend_get_symbol_by_type_first(obj, SYMBOL_TYPE_FUNCTION);
+         if (!sym)
+            sym = first_global_symbol(obj);
          if (sym)
          {
             sh.info = backend_get_symbol_index(obj, sym) + 1; // add 1 for the null symbol
-            printf("First global symbol index %i\n", sh.info);
+            log_debug("First global symbol index %i\n", sh.info);
          }
 
          //printf("symtab index=%i\n", sh.link);
@@ -1497,7 +1590,7 @@ static int elf64_write_file(backend_object* obj, const char* filename)
             fpos_data = ALIGN(fpos_data, sh.addralign);
             sh.offset = fpos_data;
             fpos_cur = ftell(f);
-            printf("We have %u symbols\n", backend_symbol_count(obj)+1);
+            log_debug("We have %u symbols\n", backend_symbol_count(obj)+1);
             fseek(f, sh.offset, SEEK_SET);
       
             // write an empty symbol first
@@ -1510,7 +1603,7 @@ static int elf64_write_file(backend_object* obj, const char* filename)
                s.name = strtab_entry - strtab;
                s.info = backend_to_elf_sym_type(sym->type);
                s.other = 0;
-               s.section_index = text_index; // link the symbol to the .text section
+               s.section_index = symbol_section_index(obj, sym, text_index); // link the symbol to its section
                s.value = sym->val;
                s.size = sym->size;
 
@@ -1534,7 +1627,7 @@ static int elf64_write_file(backend_object* obj, const char* filename)
                   s.section_index = backend_get_section_index_by_name(obj, sym->name); // which section does this symbol relate to
                   if (s.section_index == -1)
                   {
-                     printf("Error getting %s index\n", sym->name);
+                     log_error("Error getting %s index\n", sym->name);
                      sym = backend_get_next_symbol(obj);
                      continue;
                   }
@@ -1547,12 +1640,12 @@ static int elf64_write_file(backend_object* obj, const char* filename)
 
                if (sym->name)
                {
-                  if (strtab_entry - strtab + strlen(sym->name) > strtab_size)
+                  if (strtab_entry - strtab + strlen(sym->name) + 1 > strtab_size)
                   {
                      unsigned int offset = strtab_entry - strtab;
                      strtab_size += 4096;
-                     printf("Exceeded string table size - extending to %u\n", strtab_size);
-                     strtab = realloc(strtab, strtab_size);
+                     log_debug("Exceeded string table size - extending to %u\n", strtab_size);
+                     strtab = mem_realloc(MEM_STRINGS, strtab, strtab_size);
                      strtab_entry = strtab + offset;
                   }
                   strcpy(strtab_entry, sym->name);
@@ -1570,7 +1663,7 @@ static int elf64_write_file(backend_object* obj, const char* filename)
          // write the .strtab section header
          sh.type = SHT_STRTAB;
          sh.size = strtab_entry - strtab;
-         printf("Writing .strtab section (%lu)\n", sh.size);
+         log_debug("Writing .strtab section (%lu)\n", sh.size);
          if (sh.size)
          {
             // align fpos_data
@@ -1586,7 +1679,7 @@ static int elf64_write_file(backend_object* obj, const char* filename)
       else if (strcmp(".shstrtab", bs->name) == 0)
       {
          // write the .shstrtab section header
-         printf("Writing .shstrtab section\n");
+         log_debug("Writing .shstrtab section\n");
          sh.type = SHT_STRTAB;
          sh.offset = fpos_data;
          sh.size = shstrtab_entry - shstrtab;
@@ -1609,8 +1702,8 @@ static int elf64_write_file(backend_object* obj, const char* filename)
    }
 
 done:
-   free(shstrtab);
-   free(strtab);
+   mem_free(MEM_STRINGS, shstrtab);
+   mem_free(MEM_STRINGS, strtab);
    fclose(f);
    return 0;
 }
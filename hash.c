@@ -0,0 +1,126 @@
+#include <string.h>
+#include "hash.h"
+
+#define FNV_PRIME 0x100000001b3UL
+
+unsigned long hash_buffer(const void* data, unsigned long size, unsigned long seed)
+{
+	const unsigned char* p = data;
+	unsigned long h = seed;
+
+	for (unsigned long i=0; i < size; i++)
+	{
+		h ^= p[i];
+		h *= FNV_PRIME;
+	}
+
+	return h;
+}
+
+static const unsigned int sha256_k[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(unsigned int state[8], const unsigned char* p)
+{
+	unsigned int w[64];
+	unsigned int s[8];
+
+	for (int i=0; i < 16; i++)
+		w[i] = (unsigned int)p[i*4] << 24 | p[i*4+1] << 16 | p[i*4+2] << 8 | p[i*4+3];
+	for (int i=16; i < 64; i++)
+	{
+		unsigned int s0 = ROR(w[i-15], 7) ^ ROR(w[i-15], 18) ^ (w[i-15] >> 3);
+		unsigned int s1 = ROR(w[i-2], 17) ^ ROR(w[i-2], 19) ^ (w[i-2] >> 10);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+
+	for (int i=0; i < 8; i++)
+		s[i] = state[i];
+	for (int i=0; i < 64; i++)
+	{
+		unsigned int t1 = s[7] + (ROR(s[4], 6) ^ ROR(s[4], 11) ^ ROR(s[4], 25)) + ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256_k[i] + w[i];
+		unsigned int t2 = (ROR(s[0], 2) ^ ROR(s[0], 13) ^ ROR(s[0], 22)) + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+		s[7] = s[6];
+		s[6] = s[5];
+		s[5] = s[4];
+		s[4] = s[3] + t1;
+		s[3] = s[2];
+		s[2] = s[1];
+		s[1] = s[0];
+		s[0] = t1 + t2;
+	}
+	for (int i=0; i < 8; i++)
+		state[i] += s[i];
+}
+
+void sha256_init(sha256_ctx* ctx)
+{
+	static const unsigned int init[8] =
+		{ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+	for (int i=0; i < 8; i++)
+		ctx->state[i] = init[i];
+	ctx->length = 0;
+}
+
+void sha256_update(sha256_ctx* ctx, const void* data, unsigned long size)
+{
+	const unsigned char* p = data;
+	unsigned int used = ctx->length % 64;
+
+	ctx->length += size;
+	if (used)
+	{
+		unsigned int n = 64 - used;
+		if (size < n)
+		{
+			memcpy(ctx->block + used, p, size);
+			return;
+		}
+		memcpy(ctx->block + used, p, n);
+		sha256_block(ctx->state, ctx->block);
+		p += n;
+		size -= n;
+	}
+	for (; size >= 64; p += 64, size -= 64)
+		sha256_block(ctx->state, p);
+	memcpy(ctx->block, p, size);
+}
+
+void sha256_final(sha256_ctx* ctx, unsigned char digest[SHA256_SIZE])
+{
+	unsigned long bits = ctx->length * 8;
+	unsigned int used = ctx->length % 64;
+
+	// a 1 bit, zeros up to the last 8 bytes of a block, and the length in bits (big-endian)
+	ctx->block[used++] = 0x80;
+	if (used > 56)
+	{
+		memset(ctx->block + used, 0, 64 - used);
+		sha256_block(ctx->state, ctx->block);
+		used = 0;
+	}
+	memset(ctx->block + used, 0, 56 - used);
+	for (int i=0; i < 8; i++)
+		ctx->block[56+i] = bits >> (56 - i*8);
+	sha256_block(ctx->state, ctx->block);
+
+	for (int i=0; i < 8; i++)
+	{
+		digest[i*4] = ctx->state[i] >> 24;
+		digest[i*4+1] = ctx->state[i] >> 16;
+		digest[i*4+2] = ctx->state[i] >> 8;
+		digest[i*4+3] = ctx->state[i];
+	}
+}
@@ -0,0 +1,24 @@
+#ifndef _HASH__H
+#define _HASH__H
+
+#define HASH_INIT 0xcbf29ce484222325UL
+
+/* 64-bit FNV-1a - pass HASH_INIT as the seed, or the result of a previous call to continue hashing */
+unsigned long hash_buffer(const void* data, unsigned long size, unsigned long seed);
+
+#define SHA256_SIZE 32
+
+/* SHA-256, for when a collision must not happen (i.e. to reuse the output of a whole run) - it is much
+slower than hash_buffer */
+typedef struct sha256_ctx
+{
+	unsigned int state[8];
+	unsigned long length;		// bytes hashed so far
+	unsigned char block[64];	// the part of a block that has been given so far
+} sha256_ctx;
+
+void sha256_init(sha256_ctx* ctx);
+void sha256_update(sha256_ctx* ctx, const void* data, unsigned long size);
+void sha256_final(sha256_ctx* ctx, unsigned char digest[SHA256_SIZE]);
+
+#endif // _HASH__H
@@ -0,0 +1,320 @@
+#include <stdlib.h>
+#include <string.h>
+#include <udis86.h>
+#include "insn.h"
+#include "alloc.h"
+
+// a block that was moved by a successful realloc must be kept even when a later one fails, so the
+// table is always left with valid arrays of at least the old size
+static int grow(insn_table* t, unsigned int max)
+{
+	void* p;
+	int err = 0;
+
+	if ((p = mem_realloc(MEM_INSNS, t->offset, max * sizeof(*t->offset))))
+		t->offset = p;
+	else
+		err = -1;
+	if ((p = mem_realloc(MEM_INSNS, t->length, max)))
+		t->length = p;
+	else
+		err = -1;
+	if ((p = mem_realloc(MEM_INSNS, t->cls, max)))
+		t->cls = p;
+	else
+		err = -1;
+	if ((p = mem_realloc(MEM_INSNS, t->op_offset, max)))
+		t->op_offset = p;
+	else
+		err = -1;
+	if ((p = mem_realloc(MEM_INSNS, t->op_kind, max)))
+		t->op_kind = p;
+	else
+		err = -1;
+	if ((p = mem_realloc(MEM_INSNS, t->operand, max * sizeof(*t->operand))))
+		t->operand = p;
+	else
+		err = -1;
+	if (err)
+		return err;
+
+	t->max = max;
+	return 0;
+}
+
+static insn_class classify(enum ud_mnemonic_code mnem)
+{
+	switch (mnem)
+	{
+	case UD_Inop:
+	case UD_Iint3:
+		return INSN_CLASS_PADDING;
+
+	case UD_Iret:
+	case UD_Iretf:
+	case UD_Ihlt:
+	case UD_Iud2:
+		return INSN_CLASS_RET;
+
+	case UD_Ijmp:
+		return INSN_CLASS_JMP;
+
+	case UD_Ijo: case UD_Ijno: case UD_Ijb: case UD_Ijae:
+	case UD_Ijz: case UD_Ijnz: case UD_Ijbe: case UD_Ija:
+	case UD_Ijs: case UD_Ijns: case UD_Ijp: case UD_Ijnp:
+	case UD_Ijl: case UD_Ijge: case UD_Ijle: case UD_Ijg:
+	case UD_Ijcxz: case UD_Ijecxz: case UD_Ijrcxz:
+	case UD_Iloop: case UD_Iloope: case UD_Iloopne:
+		return INSN_CLASS_JCC;
+
+	case UD_Icall:
+		return INSN_CLASS_CALL;
+
+	case UD_Imov:
+		return INSN_CLASS_MOV;
+
+	case UD_Iinvalid:
+		return INSN_CLASS_INVALID;
+	}
+
+	return INSN_CLASS_OTHER;
+}
+
+// find the operand that holds an address, if there is one
+static void decode_operand(insn_table* t, unsigned int i, ud_t* ud, const unsigned char* ins)
+{
+	const struct ud_operand* op;
+	unsigned int bytes = t->length[i];
+	int pos = 0;
+
+	t->op_kind[i] = INSN_OP_NONE;
+	t->op_offset[i] = 0;
+	t->operand[i] = 0;
+
+	switch (t->cls[i])
+	{
+	case INSN_CLASS_MOV:
+  		// 89 35 ac af 40 00    	mov    %esi,0x40afac
+  		// 8a 88 40 80 40 00    	mov    0x408040(%eax),%cl
+  		// 8b 15 34 80 40 00    	mov    0x408034,%edx
+  		// a1 dc ac 40 00       	mov    0x40acdc,%eax
+  		// a3 9c af 40 00       	mov    %eax,0x40af9c
+  		// b8 98 81 40 00       	mov    $0x408198,%eax
+  		// be 98 82 40 00       	mov    $0x408298,%esi
+  		// bf a0 af 40 00       	mov    $0x40afa0,%edi
+  		// c7 05 ac af 40 00 01 	movl   $0x1,0x40afac
+		if (bytes == 6 && (ins[0] == 0x89 || ins[0] == 0x8a || ins[0] == 0x8b))
+			pos = 2;
+		else if (bytes == 5 && (ins[0] == 0xa1 || ins[0] == 0xa3 || ins[0] == 0xb8 || ins[0] == 0xbe || ins[0] == 0xbf))
+			pos = 1;
+		else if (bytes == 7 && ins[0] == 0xc7)
+			pos = 2;
+		if (pos)
+			t->op_kind[i] = INSN_OP_ABS32;
+		break;
+
+	case INSN_CLASS_JMP:
+		// ff 25 98 62 45 00       jmp    *0x456298
+		if (bytes == 6 && ins[0] == 0xff)
+		{
+			pos = 2;
+			t->op_kind[i] = INSN_OP_MEM32;
+			break;
+		}
+		// fall through
+
+	case INSN_CLASS_CALL:
+	case INSN_CLASS_JCC:
+		// e8 00 00 00 00          call   33 <fn000020+0x13>
+		op = ud_insn_opr(ud, 0);
+		if (!op || op->type != UD_OP_JIMM)
+			break;
+
+		if (op->size == 8)
+		{
+			t->op_kind[i] = INSN_OP_REL8;
+			t->op_offset[i] = bytes - 1;
+			t->operand[i] = op->lval.sbyte;
+		}
+		else if (op->size == 32)
+		{
+			t->op_kind[i] = INSN_OP_REL32;
+			t->op_offset[i] = bytes - 4;
+			t->operand[i] = op->lval.sdword;
+		}
+		return;
+	}
+
+	if (pos)
+	{
+		t->op_offset[i] = pos;
+		t->operand[i] = *(int*)(ins + pos);
+	}
+}
+
+// append the instruction that was just decoded
+static int add_insn(insn_table* t, ud_t* ud, unsigned int length)
+{
+	if (t->count == t->max && grow(t, t->max ? t->max * 2 : 256))
+		return -1;
+
+	unsigned int i = t->count++;
+	t->offset[i] = ud_insn_off(ud);
+	t->length[i] = length;
+	t->cls[i] = classify(ud_insn_mnemonic(ud));
+	decode_operand(t, i, ud, ud_insn_ptr(ud));
+	return 0;
+}
+
+static void insn_free_arrays(insn_table* t)
+{
+	mem_free(MEM_INSNS, t->offset);
+	mem_free(MEM_INSNS, t->length);
+	mem_free(MEM_INSNS, t->cls);
+	mem_free(MEM_INSNS, t->op_offset);
+	mem_free(MEM_INSNS, t->op_kind);
+	mem_free(MEM_INSNS, t->operand);
+}
+
+insn_table* insn_decode(const char* data, unsigned long size, int mode)
+{
+	ud_t ud_obj;
+	unsigned int length;
+
+	insn_table* t = mem_calloc(MEM_INSNS, 1, sizeof(insn_table));
+	if (!t)
+		return NULL;
+	t->mode = mode;
+
+	ud_init(&ud_obj);
+	ud_set_mode(&ud_obj, mode);
+	ud_set_input_buffer(&ud_obj, (const unsigned char*)data, size);
+	//ud_set_syntax(&ud_obj, NULL); // #5 no disassemble!
+
+	while ((length = ud_disassemble(&ud_obj)))
+	{
+		if (add_insn(t, &ud_obj, length))
+		{
+			insn_free(t);
+			return NULL;
+		}
+	}
+
+	return t;
+}
+
+unsigned int insn_lower_bound(const insn_table* t, unsigned long offset)
+{
+	unsigned int lo = 0;
+	unsigned int hi = t->count;
+
+	while (lo < hi)
+	{
+		unsigned int mid = (lo + hi) / 2;
+		if (t->offset[mid] < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+int insn_decode_at(insn_table* t, const char* data, unsigned long size, unsigned long offset)
+{
+	ud_t ud_obj;
+	unsigned int length;
+	insn_table n = { .mode = t->mode };
+
+	if (offset >= size)
+		return -1;
+
+	ud_init(&ud_obj);
+	ud_set_mode(&ud_obj, t->mode);
+	ud_set_pc(&ud_obj, offset);
+	ud_set_input_buffer(&ud_obj, (const unsigned char*)data + offset, size - offset);
+
+	// decode until the instruction stream lines up with the table again, or the control flow ends
+	while ((length = ud_disassemble(&ud_obj)))
+	{
+		if (add_insn(&n, &ud_obj, length))
+		{
+			insn_free_arrays(&n);
+			return -1;
+		}
+		unsigned int last = n.count - 1;
+		unsigned long next = n.offset[last] + length;
+		if (n.cls[last] == INSN_CLASS_RET || n.cls[last] == INSN_CLASS_JMP || n.cls[last] == INSN_CLASS_INVALID ||
+			insn_find(t, next) >= 0)
+			break;
+	}
+	if (!n.count)
+		return -1;
+
+	// the new instructions replace the ones they overlap, including one that runs into 'offset'
+	unsigned long end = n.offset[n.count - 1] + n.length[n.count - 1];
+	unsigned int lo = insn_lower_bound(t, offset);
+	if (lo > 0 && t->offset[lo - 1] + t->length[lo - 1] > offset)
+		lo--;
+	unsigned int hi = insn_lower_bound(t, end);
+	unsigned int count = t->count - (hi - lo) + n.count;
+
+	if (count > t->max && grow(t, count))
+	{
+		insn_free_arrays(&n);
+		return -1;
+	}
+
+	unsigned int tail = t->count - hi;
+	memmove(t->offset + lo + n.count, t->offset + hi, tail * sizeof(*t->offset));
+	memmove(t->length + lo + n.count, t->length + hi, tail);
+	memmove(t->cls + lo + n.count, t->cls + hi, tail);
+	memmove(t->op_offset + lo + n.count, t->op_offset + hi, tail);
+	memmove(t->op_kind + lo + n.count, t->op_kind + hi, tail);
+	memmove(t->operand + lo + n.count, t->operand + hi, tail * sizeof(*t->operand));
+	memcpy(t->offset + lo, n.offset, n.count * sizeof(*t->offset));
+	memcpy(t->length + lo, n.length, n.count);
+	memcpy(t->cls + lo, n.cls, n.count);
+	memcpy(t->op_offset + lo, n.op_offset, n.count);
+	memcpy(t->op_kind + lo, n.op_kind, n.count);
+	memcpy(t->operand + lo, n.operand, n.count * sizeof(*t->operand));
+	t->count = count;
+
+	insn_free_arrays(&n);
+	return lo;
+}
+
+void insn_free(insn_table* t)
+{
+	if (!t)
+		return;
+
+	insn_free_arrays(t);
+	mem_free(MEM_INSNS, t);
+}
+
+int insn_find(const insn_table* t, unsigned long offset)
+{
+	int lo = 0;
+	int hi = (int)t->count - 1;
+
+	while (lo <= hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (t->offset[mid] == offset)
+			return mid;
+		if (t->offset[mid] < offset)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	return -1;
+}
+
+long insn_branch_target(const insn_table* t, unsigned int index)
+{
+	if (t->op_kind[index] != INSN_OP_REL8 && t->op_kind[index] != INSN_OP_REL32)
+		return -1;
+
+	return (long)t->offset[index] + t->length[index] + t->operand[index];
+}
@@ -0,0 +1,57 @@
+/* Decoded instruction table
+
+Disassembling the code is the most expensive part of the analysis, so each code section is decoded
+only once. The result is kept in a compact table (one array per field) that every analysis pass can
+iterate over, instead of calling the disassembler again. */
+
+#ifndef _INSN__H
+#define _INSN__H
+
+#include "backend.h"
+
+typedef enum insn_class
+{
+	INSN_CLASS_OTHER,
+	INSN_CLASS_PADDING,	// nop, int3
+	INSN_CLASS_RET,		// ret, hlt, ud2 - anything that ends the control flow
+	INSN_CLASS_JMP,		// unconditional jump
+	INSN_CLASS_JCC,		// conditional jump or loop
+	INSN_CLASS_CALL,
+	INSN_CLASS_MOV,
+	INSN_CLASS_INVALID,	// the bytes could not be decoded
+} insn_class;
+
+typedef enum insn_operand_kind
+{
+	INSN_OP_NONE,
+	INSN_OP_ABS32,			// 32-bit absolute address (immediate or displacement)
+	INSN_OP_MEM32,			// 32-bit absolute address of a pointer (i.e. jmp *0x456298)
+	INSN_OP_REL8,			// 8-bit branch offset, relative to the next instruction
+	INSN_OP_REL32,			// 32-bit branch offset, relative to the next instruction
+} insn_operand_kind;
+
+typedef struct insn_table
+{
+	unsigned int count;
+	unsigned int max;
+	int mode;						// decoder mode (16/32/64)
+	unsigned int* offset;		// offset of the instruction from the start of the section
+	unsigned char* length;
+	unsigned char* cls;			// see INSN_CLASS_
+	unsigned char* op_offset;	// offset of the address operand inside the instruction
+	unsigned char* op_kind;		// see INSN_OP_
+	int* operand;					// value of the address operand, as it was when decoded
+} insn_table;
+
+insn_table* insn_decode(const char* data, unsigned long size, int mode); /* decode a buffer of code */
+/* Decode the code at 'offset' that isn't in the table, because the linear decode went out of step with
+the real instructions (i.e. over data in the code). Decoding stops where the two line up again, or at
+the end of the control flow, and the new instructions replace the ones they overlap. Returns the index
+of the instruction at 'offset' (the other indexes may have moved), or -1. */
+int insn_decode_at(insn_table* t, const char* data, unsigned long size, unsigned long offset);
+void insn_free(insn_table* t);
+int insn_find(const insn_table* t, unsigned long offset); /* index of the instruction at 'offset', or -1 */
+unsigned int insn_lower_bound(const insn_table* t, unsigned long offset); /* index of the first instruction at or after 'offset' */
+long insn_branch_target(const insn_table* t, unsigned int index); /* offset of a relative branch target, or -1 */
+
+#endif // _INSN__H
@@ -0,0 +1,82 @@
+#ifdef INSTRUMENT
+#include <stdio.h>
+#include <stdlib.h>
+#include "instrument.h"
+#include "stats.h"
+
+// the last row collects what is counted outside of the timed phases
+#define UNTIMED STATS_PHASE_COUNT
+
+typedef struct lookup_count
+{
+	unsigned long calls;
+	unsigned long visited;	// list nodes looked at
+} lookup_count;
+
+static const char* func_names[LOOKUP_FUNC_COUNT] =
+{
+	"symbol_by_name",
+	"symbol_by_val",
+	"symbol_by_index",
+	"symbol_index",
+	"section_by_name",
+	"section_by_val",
+	"section_by_index",
+	"section_index_by_name",
+	"reloc_by_offset",
+	"import_module_by_name",
+	"import_by_address",
+};
+
+static lookup_count totals[UNTIMED + 1][LOOKUP_FUNC_COUNT];
+static __thread lookup_count pending[LOOKUP_FUNC_COUNT];
+
+void instrument_call(lookup_func f)
+{
+	pending[f].calls++;
+}
+
+void instrument_visit(lookup_func f)
+{
+	pending[f].visited++;
+}
+
+void instrument_phase_end(int phase)
+{
+	if (phase < 0 || phase >= UNTIMED)
+		phase = UNTIMED;
+
+	for (int i=0; i < LOOKUP_FUNC_COUNT; i++)
+	{
+		if (!pending[i].calls)
+			continue;
+		__atomic_add_fetch(&totals[phase][i].calls, pending[i].calls, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&totals[phase][i].visited, pending[i].visited, __ATOMIC_RELAXED);
+		pending[i].calls = 0;
+		pending[i].visited = 0;
+	}
+}
+
+static void instrument_report(void)
+{
+	instrument_phase_end(-1);
+
+	fprintf(stderr, "\n%-12s %-22s %12s %14s %10s\n", "phase", "lookup", "calls", "nodes visited", "per call");
+	for (int p=0; p <= UNTIMED; p++)
+	{
+		for (int i=0; i < LOOKUP_FUNC_COUNT; i++)
+		{
+			const lookup_count* c = &totals[p][i];
+			if (!c->calls)
+				continue;
+			fprintf(stderr, "%-12s %-22s %12lu %14lu %10.1f\n", p == UNTIMED ? "untimed" : stats_phase_name(p),
+				func_names[i], c->calls, c->visited, (double)c->visited / c->calls);
+		}
+	}
+}
+
+__attribute__((constructor)) static void instrument_init(void)
+{
+	atexit(instrument_report);
+}
+#endif // INSTRUMENT
@@ -0,0 +1,44 @@
+/* Lookup instrumentation
+
+Most of the backend lookups walk a linked list from the start, so their cost depends on where they
+are called from and how big the tables are. A build with 'make INSTRUMENT=1' counts the calls of
+each lookup function and the list nodes it visited, and prints the counts when the program exits,
+divided between the phases of stats.h. The counts are kept per thread, and are handed to the phase
+that is stopped next on that thread (anything counted outside of a timed phase is shown as
+'untimed'), so they are attributed correctly even when the objects are written by several threads.
+Without INSTRUMENT, the macros compile out to nothing. */
+
+#ifndef _INSTRUMENT__H
+#define _INSTRUMENT__H
+
+typedef enum lookup_func
+{
+	LOOKUP_SYMBOL_BY_NAME,
+	LOOKUP_SYMBOL_BY_VAL,
+	LOOKUP_SYMBOL_BY_INDEX,
+	LOOKUP_SYMBOL_INDEX,
+	LOOKUP_SECTION_BY_NAME,
+	LOOKUP_SECTION_BY_VAL,
+	LOOKUP_SECTION_BY_INDEX,
+	LOOKUP_SECTION_INDEX_BY_NAME,
+	LOOKUP_RELOC_BY_OFFSET,
+	LOOKUP_IMPORT_MODULE_BY_NAME,
+	LOOKUP_IMPORT_BY_ADDRESS,
+	LOOKUP_FUNC_COUNT
+} lookup_func;
+
+#ifdef INSTRUMENT
+void instrument_call(lookup_func f);
+void instrument_visit(lookup_func f);
+void instrument_phase_end(int phase); /* a stats_phase, or -1 for the time between phases */
+
+#define INSTRUMENT_CALL(_f) instrument_call(_f)
+#define INSTRUMENT_VISIT(_f) instrument_visit(_f)
+#define INSTRUMENT_PHASE_END(_p) instrument_phase_end(_p)
+#else
+#define INSTRUMENT_CALL(_f) do { } while (0)
+#define INSTRUMENT_VISIT(_f) do { } while (0)
+#define INSTRUMENT_PHASE_END(_p) do { } while (0)
+#endif // INSTRUMENT
+
+#endif // _INSTRUMENT__H
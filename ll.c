@@ -1,12 +1,14 @@
 #include "ll.h"
+#include "alloc.h"
 
 linked_list* ll_init(void)
 {
-   linked_list* ll = malloc(sizeof(struct linked_list));
+   linked_list* ll = mem_alloc(MEM_LISTS, sizeof(struct linked_list));
    if (ll)
    {
       ll->count = 0;
       ll->head = NULL;
+      ll->tail = NULL;
    }
    return ll;
 }
@@ -19,7 +21,7 @@ unsigned int ll_size(const linked_list* ll)
 void ll_add(linked_list* ll, void* val)
 {
    // create the new node
-   list_node* n = malloc(sizeof(list_node));
+   list_node* n = mem_alloc(MEM_LISTS, sizeof(list_node));
    n->val = val;
    n->next = NULL;
 
@@ -27,12 +29,8 @@ void ll_add(linked_list* ll, void* val)
    if (!(ll->head))
       ll->head = n;
    else
-   {
-      list_node* tmp = ll->head;
-      while (tmp->next)
-         tmp = tmp->next;
-      tmp->next = n;
-   }
+      ll->tail->next = n;
+   ll->tail = n;
    ll->count++;
 }
 
@@ -48,9 +46,11 @@ void* ll_remove(linked_list* ll, const void* data, ll_cmpfunc cmp)
 	if (cmp(tmp->val, data) == 0)
 	{
 		ll->head = ll->head->next;
+		if (!ll->head)
+			ll->tail = NULL;
 		ll->count--;
 		val = tmp->val;
-		free(tmp);
+		mem_free(MEM_LISTS, tmp);
 		return val;
 	}
 
@@ -61,9 +61,11 @@ void* ll_remove(linked_list* ll, const void* data, ll_cmpfunc cmp)
 		if (cmp(del->val, data) == 0)
 		{
 			tmp->next = del->next;
+			if (ll->tail == del)
+				ll->tail = tmp;
 			ll->count--;
 			val = del->val;
-			free(del);
+			mem_free(MEM_LISTS, del);
 			return val;
 		}
 		tmp = tmp->next;
@@ -78,10 +80,14 @@ void* ll_pop(linked_list* ll)
 		return NULL;
 
 	list_node* tmp = ll->head;
+	void* val = tmp->val;
 	ll->head = ll->head->next;
+	if (!ll->head)
+		ll->tail = NULL;
 	ll->count--;
+	mem_free(MEM_LISTS, tmp);
 
-	return tmp->val;
+	return val;
 }
 
 const list_node* ll_iter_start(const linked_list* ll)
@@ -89,16 +95,19 @@ const list_node* ll_iter_start(const linked_list* ll)
    return ll->head;
 }
 
-void ll_insert(list_node* here, void* val)
+void ll_insert(linked_list* ll, list_node* here, void* val)
 {
-	if (!here)
+	if (!ll || !here)
 		return;
 
    // create the new node
-   list_node* n = malloc(sizeof(list_node));
+   list_node* n = mem_alloc(MEM_LISTS, sizeof(list_node));
    n->val = val;
    n->next = here->next;
 	here->next = n;
+	if (ll->tail == here)
+		ll->tail = n;
+   ll->count++;
 }
 
 void ll_push(linked_list* ll, void* val)
@@ -107,12 +116,15 @@ void ll_push(linked_list* ll, void* val)
 		return;
 
    // create the new node
-   list_node* n = malloc(sizeof(list_node));
+   list_node* n = mem_alloc(MEM_LISTS, sizeof(list_node));
    n->val = val;
 	if (ll->head)
    	n->next = ll->head;
 	else
+	{
 		n->next = NULL;
+		ll->tail = n;
+	}
 	ll->head = n;
    ll->count++;
 }
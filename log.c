@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include "log.h"
+
+int log_verbosity = LOG_LEVEL_INFO;
+
+void log_set_verbosity(int level)
+{
+	if (level < LOG_LEVEL_ERROR)
+		level = LOG_LEVEL_ERROR;
+	if (level > LOG_LEVEL_DEBUG)
+		level = LOG_LEVEL_DEBUG;
+	log_verbosity = level;
+}
+
+void log_print(log_level level, const char* fmt, ...)
+{
+	va_list args;
+
+	if (!log_enabled(level))
+		return;
+
+	va_start(args, fmt);
+	vfprintf(level <= LOG_LEVEL_WARN ? stderr : stdout, fmt, args);
+	va_end(args);
+}
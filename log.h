@@ -0,0 +1,36 @@
+/* Logging
+
+Every message has a level, and is only printed if the level is enabled by the current verbosity
+(-v / -q on the command line). Errors and warnings go to stderr, everything else to stdout. Debug
+messages are compiled out completely in release builds (NDEBUG), so they cost nothing in the hot
+loops, but the arguments are still checked by the compiler. */
+
+#ifndef _LOG__H
+#define _LOG__H
+
+typedef enum log_level
+{
+	LOG_LEVEL_ERROR,
+	LOG_LEVEL_WARN,
+	LOG_LEVEL_INFO,		// default
+	LOG_LEVEL_DEBUG,
+} log_level;
+
+extern int log_verbosity;	// the highest level that is printed
+
+void log_set_verbosity(int level); /* clamps to the known levels */
+void log_print(log_level level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#define log_enabled(level) ((level) <= log_verbosity)
+
+#define log_error(...) log_print(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define log_warn(...) do { if (log_enabled(LOG_LEVEL_WARN)) log_print(LOG_LEVEL_WARN, __VA_ARGS__); } while (0)
+#define log_info(...) do { if (log_enabled(LOG_LEVEL_INFO)) log_print(LOG_LEVEL_INFO, __VA_ARGS__); } while (0)
+
+#ifdef NDEBUG
+#define log_debug(...) do { if (0) log_print(LOG_LEVEL_DEBUG, __VA_ARGS__); } while (0)
+#else
+#define log_debug(...) do { if (log_enabled(LOG_LEVEL_DEBUG)) log_print(LOG_LEVEL_DEBUG, __VA_ARGS__); } while (0)
+#endif
+
+#endif // _LOG__H
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "manifest.h"
+#include "alloc.h"
+#include "log.h"
+
+#define MANIFEST_HEADER "# delinker manifest 1\n"
+
+manifest* manifest_init(void)
+{
+	return mem_calloc(MEM_OTHER, 1, sizeof(manifest));
+}
+
+manifest* manifest_load(const char* filename)
+{
+	char line[1024];
+	char kind;
+	unsigned long hash;
+	int pos;
+
+	manifest* m = manifest_init();
+	FILE* f = fopen(filename, "r");
+	if (!f)
+		return m;
+
+	if (!fgets(line, sizeof(line), f) || strcmp(line, MANIFEST_HEADER) != 0)
+	{
+		log_warn("Ignoring manifest %s with an unknown format\n", filename);
+		fclose(f);
+		return m;
+	}
+
+	while (fgets(line, sizeof(line), f))
+	{
+		line[strcspn(line, "\n")] = 0;
+		if (sscanf(line, "%c %lx %n", &kind, &hash, &pos) != 2 || line[pos] == 0)
+			continue;
+		manifest_add(m, kind, line + pos, hash);
+	}
+
+	fclose(f);
+	return m;
+}
+
+int manifest_save(const manifest* m, const char* filename)
+{
+	char tmp[1024];
+
+	snprintf(tmp, sizeof(tmp), "%s.%u", filename, getpid());
+	FILE* f = fopen(tmp, "w");
+	if (!f)
+	{
+		log_warn("Can't create manifest %s\n", tmp);
+		return -1;
+	}
+
+	int err = (fputs(MANIFEST_HEADER, f) < 0);
+	for (unsigned int i=0; i < m->count; i++)
+		err |= (fprintf(f, "%c %016lx %s\n", m->entries[i].kind, m->entries[i].hash, m->entries[i].name) < 0);
+	err |= fclose(f);
+
+	if (err || rename(tmp, filename))
+	{
+		log_warn("Can't write manifest %s\n", filename);
+		unlink(tmp);
+		return -2;
+	}
+
+	return 0;
+}
+
+void manifest_add(manifest* m, char kind, const char* name, unsigned long hash)
+{
+	if (m->count == m->max)
+	{
+		m->max = m->max ? m->max * 2 : 256;
+		m->entries = mem_realloc(MEM_OTHER, m->entries, m->max * sizeof(manifest_entry));
+	}
+
+	m->entries[m->count].kind = kind;
+	m->entries[m->count].hash = hash;
+	m->entries[m->count].name = mem_strdup(MEM_STRINGS, name);
+	m->count++;
+	m->sorted = 0;
+}
+
+static int cmp_entry(const void* a, const void* b)
+{
+	const manifest_entry* ea = a;
+	const manifest_entry* eb = b;
+	if (ea->kind != eb->kind)
+		return ea->kind - eb->kind;
+	return strcmp(ea->name, eb->name);
+}
+
+const manifest_entry* manifest_find(manifest* m, char kind, const char* name)
+{
+	manifest_entry key;
+
+	// entries are saved in the order they were added - only sort when somebody needs to search
+	if (!m->sorted)
+	{
+		if (m->count)
+			qsort(m->entries, m->count, sizeof(manifest_entry), cmp_entry);
+		m->sorted = 1;
+	}
+
+	key.kind = kind;
+	key.name = (char*)name;
+	if (!m->count)
+		return NULL;
+	manifest_entry* e = bsearch(&key, m->entries, m->count, sizeof(manifest_entry), cmp_entry);
+	if (!e)
+		return NULL;
+
+	// an object that was written more than once was overwritten, so we can't trust any of its hashes
+	if ((e > m->entries && cmp_entry(e - 1, &key) == 0) || (e + 1 < m->entries + m->count && cmp_entry(e + 1, &key) == 0))
+		return NULL;
+
+	return e;
+}
+
+void manifest_free(manifest* m)
+{
+	if (!m)
+		return;
+
+	for (unsigned int i=0; i < m->count; i++)
+		mem_free(MEM_STRINGS, m->entries[i].name);
+	mem_free(MEM_OTHER, m->entries);
+	mem_free(MEM_OTHER, m);
+}
@@ -0,0 +1,35 @@
+/* Incremental manifest
+
+Records a content hash for every output object and every function written by a run of the delinker.
+On the next run, any object whose hash hasn't changed (and is still on disk) doesn't have to be
+generated or written again, so its timestamp is preserved and a relink has less work to do. */
+
+#ifndef _MANIFEST__H
+#define _MANIFEST__H
+
+#define MANIFEST_OBJECT		'o'
+#define MANIFEST_FUNCTION	'f'
+
+typedef struct manifest_entry
+{
+	char kind;	// see MANIFEST_
+	unsigned long hash;
+	char* name;
+} manifest_entry;
+
+typedef struct manifest
+{
+	manifest_entry* entries;
+	unsigned int count;
+	unsigned int max;
+	int sorted;
+} manifest;
+
+manifest* manifest_init(void);
+manifest* manifest_load(const char* filename); /* a missing file is the same as an empty manifest */
+int manifest_save(const manifest* m, const char* filename);
+void manifest_add(manifest* m, char kind, const char* name, unsigned long hash);
+const manifest_entry* manifest_find(manifest* m, char kind, const char* name); /* NULL if the name is missing or not unique */
+void manifest_free(manifest* m);
+
+#endif // _MANIFEST__H
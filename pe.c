@@ -10,6 +10,9 @@ optional header
 #include <stdlib.h>
 #include <time.h>
 #include "backend.h"
+#include "alloc.h"
+#include "trace.h"
+#include "log.h"
 
 #pragma pack(1)
 
@@ -70,6 +73,8 @@ optional header
 #define SYM_CLASS_FILE 103
 #define SYM_CLASS_SECTION 104
 
+#define IMAGE_COMDAT_SELECT_NODUPLICATES 1 // The linker reports an error if the COMDAT symbol is defined more than once
+
 // section flags
 #define SCN_CNT_CODE                      (1<<SCN_SHIFT_CNT_CODE) // The section contains executable code
 #define SCN_CNT_INIT_DATA                 (1<<SCN_SHIFT_CNT_INIT_DATA) // The section contains initialized data
@@ -248,6 +253,18 @@ typedef struct symbol
    unsigned char auxsymbols;
 } symbol;
 
+// the aux entry of a section symbol (section definition)
+typedef struct symbol_aux_sec
+{
+   unsigned int length;
+   unsigned short num_reloc;
+   unsigned short num_lines;
+   unsigned int checksum;
+   unsigned short number; // the associated section, for IMAGE_COMDAT_SELECT_ASSOCIATIVE
+   unsigned char selection; // see IMAGE_COMDAT_SELECT_
+   unsigned char unused[3];
+} symbol_aux_sec;
+
 typedef struct import_dir
 {
 	unsigned int lu_table;
@@ -373,60 +390,60 @@ const char* lookup_machine(unsigned short machine)
 
 void dump_coff(coff_header* h)
 {
-   printf("machine: %s\n", lookup_machine(h->machine));
-   printf("num sections: %u\n", h->num_sections);
+   log_debug("machine: %s\n", lookup_machine(h->machine));
+   log_debug("num sections: %u\n", h->num_sections);
    time_t creat = h->time_created;
-   printf("created: %s", ctime(&creat));
-   printf("symtab offset: %u\n", h->offset_symtab);
-   printf("num symbols: %u\n", h->num_symbols);
-   printf("exe header size: %u\n", h->size_optional_hdr);
-   printf("flags: 0x%X\n", h->flags);
+   log_debug("created: %s", ctime(&creat));
+   log_debug("symtab offset: %u\n", h->offset_symtab);
+   log_debug("num symbols: %u\n", h->num_symbols);
+   log_debug("exe header size: %u\n", h->size_optional_hdr);
+   log_debug("flags: 0x%X\n", h->flags);
    for (int i=0; i < sizeof(h->flags)*8; i++)
       if (h->flags & 1<<i)
-         printf("   - %s\n", flags_lookup[i]);
+         log_debug("   - %s\n", flags_lookup[i]);
 }
 
 void dump_optional(optional_header* h, unsigned short state)
 {
-   printf("state: ");
+   log_debug("state: ");
    switch(state)
    {
    case STATE_ID_NORMAL:
-      printf("PE32\n");
+      log_debug("PE32\n");
       break;
    case STATE_ID_ROM:
-      printf("PE ROM\n");
+      log_debug("PE ROM\n");
       break;
    case STATE_ID_PE32PLUS:
-      printf("PE32+\n");   
+      log_debug("PE32+\n");   
       break;
    default:
-      printf("Unknown\n");
+      log_debug("Unknown\n");
    }
-   printf("link ver: %i.%i\n", h->major_linker_ver, h->minor_linker_ver);
-   printf("code size: %i\n", h->code_size);
-   printf("data size: %i\n", h->data_size);
-   printf("uninit data size: %i\n", h->uninit_data_size);
-   printf("entry: 0x%x\n", h->entry);
-   printf("code base: 0x%x\n", h->code_base);
+   log_debug("link ver: %i.%i\n", h->major_linker_ver, h->minor_linker_ver);
+   log_debug("code size: %i\n", h->code_size);
+   log_debug("data size: %i\n", h->data_size);
+   log_debug("uninit data size: %i\n", h->uninit_data_size);
+   log_debug("entry: 0x%x\n", h->entry);
+   log_debug("code base: 0x%x\n", h->code_base);
    if (state == STATE_ID_NORMAL)
-      printf("date base: 0x%x\n", h->data_base);
+      log_debug("date base: 0x%x\n", h->data_base);
 }
 
 void dump_pe32_windows(pe32_windows_header* h)
 {
-   printf("Base: 0x%x\n", h->base);
-   printf("Section alignment: %u\n", h->section_alignment);
+   log_debug("Base: 0x%x\n", h->base);
+   log_debug("Section alignment: %u\n", h->section_alignment);
    unsigned int file_alignment;
-   printf("OS version: %u.%u\n", h->os_major, h->os_minor);
-   printf("Image version: %u.%u\n", h->image_major, h->image_minor);
-   printf("Subsystem version: %u.%u\n", h->subsys_major, h->subsys_minor);
+   log_debug("OS version: %u.%u\n", h->os_major, h->os_minor);
+   log_debug("Image version: %u.%u\n", h->image_major, h->image_minor);
+   log_debug("Subsystem version: %u.%u\n", h->subsys_major, h->subsys_minor);
    //unsigned int image_size;
    //unsigned int header_size;
    //unsigned int checksum;
    if (h->subsystem >= IMAGE_SUBSYSTEM_MAX)
       h->subsystem = 0;
-   printf("Subsystem: %s\n", subsystem_lookup[h->subsystem]); // see IMAGE_SUBSYSTEM_
+   log_debug("Subsystem: %s\n", subsystem_lookup[h->subsystem]); // see IMAGE_SUBSYSTEM_
    //unsigned short dll_chars;
    //unsigned int stack_size;
    //unsigned int stack_commit_size;
@@ -438,34 +455,34 @@ void dump_pe32_windows(pe32_windows_header* h)
 
 void dump_data_dirs(data_dirs* h)
 {
-   printf("Export: 0x%x (%u)\n", h->export.offset, h->export.size);
-   printf("Import: 0x%x (%u)\n", h->import.offset, h->import.size);
-   printf("Resource: 0x%x (%u)\n", h->resource.offset, h->resource.size);
-   printf("Exception: 0x%x (%u)\n", h->exception.offset, h->exception.size);
-   printf("Certificate: 0x%x (%u)\n", h->certificate.offset, h->certificate.size);
-   printf("Relocation: 0x%x (%u)\n", h->relocation.offset, h->relocation.size);
-   printf("Debug: 0x%x (%u)\n", h->debug.offset, h->debug.size);
-   printf("Arch: 0x%x (%u)\n", h->arch.offset, h->arch.size);
-   printf("Ptr: 0x%x (%u)\n", h->ptr.offset, h->ptr.size);
-   printf("TLS: 0x%x (%u)\n", h->tls.offset, h->tls.size);
-   printf("Load Config: 0x%x (%u)\n", h->load.offset, h->load.size);
-   printf("Bound Import: 0x%x (%u)\n", h->bound.offset, h->bound.size);
-   printf("Import Address: 0x%x (%u)\n", h->iat.offset, h->iat.size);
-   printf("Delay Import: 0x%x (%u)\n", h->delay.offset, h->delay.size);
-   printf("CLR Runtime: 0x%x (%u)\n", h->clr.offset, h->clr.size);
+   log_debug("Export: 0x%x (%u)\n", h->export.offset, h->export.size);
+   log_debug("Import: 0x%x (%u)\n", h->import.offset, h->import.size);
+   log_debug("Resource: 0x%x (%u)\n", h->resource.offset, h->resource.size);
+   log_debug("Exception: 0x%x (%u)\n", h->exception.offset, h->exception.size);
+   log_debug("Certificate: 0x%x (%u)\n", h->certificate.offset, h->certificate.size);
+   log_debug("Relocation: 0x%x (%u)\n", h->relocation.offset, h->relocation.size);
+   log_debug("Debug: 0x%x (%u)\n", h->debug.offset, h->debug.size);
+   log_debug("Arch: 0x%x (%u)\n", h->arch.offset, h->arch.size);
+   log_debug("Ptr: 0x%x (%u)\n", h->ptr.offset, h->ptr.size);
+   log_debug("TLS: 0x%x (%u)\n", h->tls.offset, h->tls.size);
+   log_debug("Load Config: 0x%x (%u)\n", h->load.offset, h->load.size);
+   log_debug("Bound Import: 0x%x (%u)\n", h->bound.offset, h->bound.size);
+   log_debug("Import Address: 0x%x (%u)\n", h->iat.offset, h->iat.size);
+   log_debug("Delay Import: 0x%x (%u)\n", h->delay.offset, h->delay.size);
+   log_debug("CLR Runtime: 0x%x (%u)\n", h->clr.offset, h->clr.size);
 }
 
-static char* coff_symbol_name(symbol* s, char* stringtab)
+// short names are copied to 'buf' (at least 9 bytes), so several files can be read at the same time
+static char* coff_symbol_name(symbol* s, char* stringtab, char* buf)
 {
-   static char nametmp[10];
    char* name;
    if (s->name.ptr.zeros == 0)
       name = stringtab + s->name.ptr.index;
    else
    {
-      memcpy(nametmp, s->name.str, 8);
-      nametmp[8] = 0;
-      name = nametmp;
+      memcpy(buf, s->name.str, 8);
+      buf[8] = 0;
+      name = buf;
    }
    return name;
 }
@@ -476,7 +493,8 @@ void dump_symtab(symbol* symtab, unsigned int count, char* stringtab)
    for (unsigned int i=0; i< count; i++)
    {
       symbol* s = &(symtab[i]);
-      char* name=coff_symbol_name(s, stringtab);
+      char shortname[9];
+      char* name=coff_symbol_name(s, stringtab, shortname);
       aux = s->auxsymbols;
       while (aux)
       {
@@ -487,7 +505,7 @@ void dump_symtab(symbol* symtab, unsigned int count, char* stringtab)
             char nametmp[19];
             // COFF symbols of type file should have the name ".file"
             if (strcmp(name, ".file"))
-               printf("Got a symbol of type file without name .file! (named %s)\n", name);
+               log_warn("Got a symbol of type file without name .file! (named %s)\n", name);
             // now get its real name
             memcpy(nametmp, (char*)(&symtab[i]), 18);
             nametmp[18] = 0;
@@ -497,7 +515,7 @@ void dump_symtab(symbol* symtab, unsigned int count, char* stringtab)
          //AUX tagndx 0 ttlsiz 0x0 lnnos 0 next 0
          aux--;
       }
-      printf("[%3u](sec %2i)(fl 0x00)(ty %3x)(scl %3i) (nx %i) 0x%08x %s\n", i, s->section, s->type, s->class, s->auxsymbols, s->val, name);
+      log_debug("[%3u](sec %2i)(fl 0x00)(ty %3x)(scl %3i) (nx %i) 0x%08x %s\n", i, s->section, s->type, s->class, s->auxsymbols, s->val, name);
    }
 }
 
@@ -505,19 +523,19 @@ static void dump_sections(section_header* secs, unsigned int nsec)
 {
    for (unsigned int i=0; i < nsec; i++)
    {
-      printf("Index: %i\n", i+1);
-      printf("Section Name: %s\n", secs[i].name);
-      printf("Size in mem: %u\n", secs[i].size_in_mem);
-      printf("Address: 0x%x\n", secs[i].address);
-      printf("Data ptr: %u\n", secs[i].data_offset); 
-      printf("Flags: 0x%x\n", secs[i].flags);
+      log_debug("Index: %i\n", i+1);
+      log_debug("Section Name: %s\n", secs[i].name);
+      log_debug("Size in mem: %u\n", secs[i].size_in_mem);
+      log_debug("Address: 0x%x\n", secs[i].address);
+      log_debug("Data ptr: %u\n", secs[i].data_offset); 
+      log_debug("Flags: 0x%x\n", secs[i].flags);
       for (int f=0; f < 19; f++)
          if (secs[i].flags & (1<<f))
-            printf("   - %s\n", section_flags_lookup[f]);
+            log_debug("   - %s\n", section_flags_lookup[f]);
       for (int f=24; f < 31; f++)
          if (secs[i].flags & (1<<f))
-            printf("   - %s\n", section_flags_lookup[f]);
-      printf("Alignment: %i\n", (secs[i].flags >> SCN_SHIFT_ALIGN) & SCN_ALIGN);
+            log_debug("   - %s\n", section_flags_lookup[f]);
+      log_debug("Alignment: %i\n", (secs[i].flags >> SCN_SHIFT_ALIGN) & SCN_ALIGN);
    }
 }
 
@@ -534,13 +552,13 @@ backend_type pe32plus_format(void)
 
 static backend_object* pe_read_file(const char* filename)
 {
-   char* buff = malloc(sizeof(coff_header));
+   char* buff = mem_alloc(MEM_OTHER, sizeof(coff_header));
 
    FILE* f = fopen(filename, "rb");
    if (!f)
    {
-      printf("can't open file\n");
-      free(buff);
+      log_error("can't open file\n");
+      mem_free(MEM_OTHER, buff);
       return 0;
    }
 
@@ -550,7 +568,7 @@ static backend_object* pe_read_file(const char* filename)
 
    if (MAGIC_LOCATOR >= fsize)
    {
-      free(buff);
+      mem_free(MEM_OTHER, buff);
       return 0;
    }
 
@@ -559,7 +577,7 @@ static backend_object* pe_read_file(const char* filename)
    fread(buff, MAGIC_SIZE, 1, f);
    if (*(unsigned int*)buff >= fsize)
    {
-      free(buff);
+      mem_free(MEM_OTHER, buff);
       return 0;
    }
 
@@ -567,16 +585,16 @@ static backend_object* pe_read_file(const char* filename)
    fread(buff, MAGIC_SIZE, 1, f);
    if (memcmp(buff, PE_MAGIC, 4) != 0)
    {
-      free(buff);
+      mem_free(MEM_OTHER, buff);
       return 0;
    }
    
-   printf("found PE magic number\n");
+   log_debug("found PE magic number\n");
    
    backend_object* obj = backend_create();
    if (!obj)
    {
-      free(buff);
+      mem_free(MEM_OTHER, buff);
       return 0;
    }
 
@@ -592,20 +610,20 @@ static backend_object* pe_read_file(const char* filename)
 	unsigned int base_address;
 
    // read the optional header
-   free(buff);
+   mem_free(MEM_OTHER, buff);
    switch(state)
    {
    case STATE_ID_NORMAL:
       backend_set_type(obj, OBJECT_TYPE_PE32);
       // read the optional header
-      buff = malloc(sizeof(optional_header));
+      buff = mem_alloc(MEM_OTHER, sizeof(optional_header));
       fread(buff, sizeof(optional_header), 1, f);
       //dump_optional((optional_header*)buff, state);
 		entry_offset = ((optional_header*)buff)->entry;
 
       // read the windows-specific header
-      free(buff);
-      buff = malloc(sizeof(pe32_windows_header));
+      mem_free(MEM_OTHER, buff);
+      buff = mem_alloc(MEM_OTHER, sizeof(pe32_windows_header));
       fread(buff, sizeof(pe32_windows_header), 1, f);
       //dump_pe32_windows((pe32_windows_header*)buff);
 
@@ -620,38 +638,36 @@ static backend_object* pe_read_file(const char* filename)
 
    case STATE_ID_PE32PLUS:
       backend_set_type(obj, OBJECT_TYPE_PE32PLUS);
-      free(buff);
+      mem_free(MEM_OTHER, buff);
       //buff = malloc(sizeof(pe32_windows_header));
       //fread(buff, sizeof(pe32_windows_header), 1, f);
       //dump_pe32plus_windows((pe32_windows_header*)buff);
       break;
 
    default:
-      printf("Unknown\n");
+      log_debug("Unknown\n");
    }
 
 
    // read the data directories
-   data_dirs* dd = malloc(sizeof(data_dirs));
+   data_dirs* dd = mem_alloc(MEM_OTHER, sizeof(data_dirs));
    fread(dd, sizeof(data_dirs), 1, f);
    dump_data_dirs(dd);
 
    // read the sections - they are immediately after the optional header
+	trace_span span;
+	unsigned long data_size = 0;
+	trace_begin(&span);
 	char tmp_name[32];
 	unsigned int import_file_base; // file offset of section containing the import info
 	backend_section* import_sec; // pointer to the section containing the import info
-   printf("There are %u sections\n", ch.num_sections);
+   log_debug("There are %u sections\n", ch.num_sections);
    int sectabsize = sizeof(section_header) * ch.num_sections;
-   section_header* secs = malloc(sectabsize);
+   section_header* secs = mem_alloc(MEM_OTHER, sectabsize);
    fread(secs, sectabsize, 1 ,f);
    //dump_sections(secs, ch.num_sections);
    for (unsigned int i=0; i < ch.num_sections; i++)
    {
-      // load the data
-      fseek(f, secs[i].data_offset, SEEK_SET);
-      char* data = malloc(secs[i].size_on_disk);
-      fread(data, secs[i].size_on_disk, 1, f);
-
       // convert the flags
       unsigned int flags=0;
       if (secs[i].flags & SCN_CNT_CODE)
@@ -671,13 +687,25 @@ static backend_object* pe_read_file(const char* filename)
       if (secs[i].flags & SCN_MEM_WRITE)
          flags |= SECTION_FLAG_WRITE;
 
+      // load the data - uninitialized data has nothing in the file, and anything in memory past the
+      // end of the data in the file is zero
+      char* data = NULL;
+      if ((flags & (SECTION_FLAG_UNINIT_DATA | SECTION_FLAG_INIT_DATA | SECTION_FLAG_CODE)) != SECTION_FLAG_UNINIT_DATA)
+      {
+         unsigned int size = secs[i].size_in_mem > secs[i].size_on_disk ? secs[i].size_in_mem : secs[i].size_on_disk;
+         data = mem_calloc(MEM_DATA, size, 1);
+         fseek(f, secs[i].data_offset, SEEK_SET);
+         fread(data, secs[i].size_on_disk, 1, f);
+         data_size += size;
+      }
+
 		strncpy(tmp_name, secs[i].name, 8);
-		printf("Section %s has flags: 0x%x\n", tmp_name, secs[i].flags);
+		log_debug("Section %s has flags: 0x%x\n", tmp_name, secs[i].flags);
 
 		// update the known names to have a consistent naming in the backend
 		if (strcmp(tmp_name, ".rdata") == 0)
 		{
-			printf("PE: replacing .rdata with .rodata\n");
+			log_debug("PE: replacing .rdata with .rodata\n");
 			strcpy(tmp_name, ".rodata");
 		}
 
@@ -688,15 +716,17 @@ static backend_object* pe_read_file(const char* filename)
 		if (dd->import.offset && secs[i].data_offset <= dd->import.offset && secs[i].data_offset +
 secs[i].size_in_mem > dd->import.offset)
 		{
-			printf("Section %s (base=0x%x) has imports\n", secs[i].name, secs[i].data_offset);
+			log_debug("Section %s (base=0x%x) has imports\n", secs[i].name, secs[i].data_offset);
 			import_file_base = secs[i].data_offset;
 			import_sec = sec;
 		}
    }
+	trace_end(&span, "read_sections", NULL, "sections", (unsigned long)ch.num_sections, "bytes", data_size, NULL);
 
    // read the symbol table
+	trace_begin(&span);
    int symtabsize = ch.num_symbols * sizeof(symbol);
-   symbol* symtab = (symbol*)malloc(symtabsize);
+   symbol* symtab = (symbol*)mem_alloc(MEM_OTHER, symtabsize);
    fseek(f, ch.offset_symtab, SEEK_SET);
    fread(symtab, symtabsize, 1, f);
    // can't dump the symbol table until the string table is read
@@ -705,7 +735,7 @@ secs[i].size_in_mem > dd->import.offset)
    int strtabsize=0;
    fread(&strtabsize, 4, 1, f);
    //printf("string table is %i bytes long\n", strtabsize);
-   char* strtab = malloc(strtabsize + sizeof(strtabsize));
+   char* strtab = mem_alloc(MEM_STRINGS, strtabsize + sizeof(strtabsize));
    fread(strtab+sizeof(strtabsize), strtabsize, 1, f);
    //dump_symtab(symtab, ch.num_symbols, strtab);
 
@@ -713,14 +743,15 @@ secs[i].size_in_mem > dd->import.offset)
    for (unsigned int i=0; i< ch.num_symbols; i++)
    {
       symbol* s = &(symtab[i]);
-      char* name = coff_symbol_name(s, strtab);
+      char shortname[9];
+      char* name = coff_symbol_name(s, strtab, shortname);
 
       // is this a function?
       if (s->type == 0x20)
       {
          if (s->class == SYM_CLASS_EXTERNAL && s->section <= 0)
          {
-            printf("Warning: external symbol %s does not have a valid section number\n", name);
+            log_warn("Warning: external symbol %s does not have a valid section number\n", name);
             break;
          }
          if (s->auxsymbols == 1)
@@ -734,7 +765,7 @@ secs[i].size_in_mem > dd->import.offset)
          {
          case SYM_CLASS_FILE:
             if (strcmp(name, ".file"))
-               printf("Warning: 'file' symbol is not named '.file'!\n");
+               log_warn("Warning: 'file' symbol is not named '.file'!\n");
             backend_add_symbol(obj, strndup((char*)&symtab[++i], 18), s->val, SYMBOL_TYPE_FILE, 0, 0, NULL);
             break;
 
@@ -762,14 +793,18 @@ secs[i].size_in_mem > dd->import.offset)
       }
    }
 
+	trace_end(&span, "read_symbols", NULL, "symbols", (unsigned long)backend_symbol_count(obj), NULL);
+
 	backend_section* sec_text = backend_get_section_by_name(obj, ".text");
 	if (!sec_text)
 	{
-		printf("Can't find code section!\n");
+		log_warn("Can't find code section!\n");
 		goto done;
 	}
 
 	// read the import directory table
+	trace_begin(&span);
+	unsigned long modules = 0;
    if (dd->import.size && dd->import.offset)
    {
 	   unsigned long next;
@@ -783,6 +818,7 @@ secs[i].size_in_mem > dd->import.offset)
 	   	char* name = import_sec->data + (dir.name - import_file_base);
    		//printf("Module: %s Table @ 0x%x\n", name, dir.addr_table);
 	   	mod = backend_add_import_module(obj, name);
+	   	modules++;
 		   next = ftell(f);
 
    		// read the import address table
@@ -815,22 +851,23 @@ secs[i].size_in_mem > dd->import.offset)
 		   fread(&dir, sizeof(import_dir), 1, f);
    	}
    }
+	trace_end(&span, "read_imports", NULL, "modules", modules, NULL);
 
 	// read the debug info
    if (dd->debug.size && dd->debug.offset)
    {
       debug_dir_header ddh;
-      printf("Has debug info\n");
+      log_debug("Has debug info\n");
       if (dd->debug.size != sizeof(debug_dir_header))
       {
-         printf("Unusual size %i (expected %lu)\n", dd->debug.size, sizeof(debug_dir_header));
+         log_warn("Unusual size %i (expected %lu)\n", dd->debug.size, sizeof(debug_dir_header));
       }
 
       fseek(f, dd->debug.offset, SEEK_SET);
       fread(&ddh, sizeof(ddh), 1, f);
-      printf("debug type: %i\n", ddh.type);
-      printf("debug size: %i\n", ddh.size);
-      printf("debug offset: 0x%x\n", ddh.offset);
+      log_debug("debug type: %i\n", ddh.type);
+      log_debug("debug size: %i\n", ddh.size);
+      log_debug("debug offset: 0x%x\n", ddh.offset);
 
       fseek(f, ddh.offset, SEEK_SET);
       
@@ -838,85 +875,178 @@ secs[i].size_in_mem > dd->import.offset)
 
 done:
    // clean up
-   free(strtab);
-   free(symtab);
-   free(buff);
+   mem_free(MEM_STRINGS, strtab);
+   mem_free(MEM_OTHER, symtab);
+   mem_free(MEM_OTHER, buff);
 
-	printf("PE32 loading done (%i symbols, %i relocs)\n", backend_symbol_count(obj), backend_relocation_count(obj));
-	printf("-----------------------------------------\n");
+	log_info("PE32 loading done (%i symbols, %i relocs)\n", backend_symbol_count(obj), backend_relocation_count(obj));
+	log_debug("-----------------------------------------\n");
    return obj;
 }
 
+// COFF relocation types for x86
+#define IMAGE_REL_I386_DIR32 0x0006
+#define IMAGE_REL_I386_REL32 0x0014
+
+typedef struct coff_reloc
+{
+   unsigned int address;   // offset of the relocated field from the start of the section
+   unsigned int symbol;    // index in the symbol table
+   unsigned short type;    // see IMAGE_REL_I386_
+} coff_reloc;
+
+/* Names that don't fit in 8 characters are kept in a string table, which immediately follows the
+symbol table. The table starts with its own size, so the first string is at offset 4. */
+typedef struct coff_strtab
+{
+   char* data;
+   unsigned int size;
+   unsigned int max;
+} coff_strtab;
+
+static unsigned int coff_add_string(coff_strtab* t, const char* str)
+{
+   unsigned int len = strlen(str) + 1;
+   unsigned int offset;
+
+   if (t->size == 0)
+      t->size = 4;
+   if (t->size + len > t->max)
+   {
+      t->max = (t->size + len) * 2;
+      t->data = mem_realloc(MEM_STRINGS, t->data, t->max);
+   }
+   offset = t->size;
+   memcpy(t->data + offset, str, len);
+   t->size += len;
+   return offset;
+}
+
+/* Some symbols are written using multiple entries, so there can be a primary entry and
+0 or more aux entries for each symbol */
+static unsigned int coff_aux_count(const backend_symbol* sym)
+{
+   switch (sym->type)
+   {
+   case SYMBOL_TYPE_FILE:     // aux type 4
+   case SYMBOL_TYPE_SECTION:  // aux type 5
+   case SYMBOL_TYPE_FUNCTION: // aux format 1
+      return 1;
+   }
+   return 0;
+}
+
+/* Function sections (.text$<function>) are written as COMDAT sections, which is what allows the
+linker to drop the ones nothing refers to (/OPT:REF). A COMDAT section must have a section symbol
+with a section definition aux entry, and the next symbol in that section (the function) is its
+COMDAT symbol. The section symbols are written at the start of the symbol table, before any
+symbol of the object. */
+static int coff_is_comdat(const backend_section* sec)
+{
+   return (sec->flags & SECTION_FLAG_CODE) && strchr(sec->name, '$');
+}
+
+// number of symbol table entries used by the section symbols of the COMDAT sections
+static unsigned int coff_comdat_entries(backend_object* obj)
+{
+   unsigned int count = 0;
+   if (!obj->section_table)
+      return 0;
+   for (const list_node* iter=ll_iter_start(obj->section_table); iter != NULL; iter=iter->next)
+      if (coff_is_comdat(iter->val))
+         count += 2;
+   return count;
+}
+
 /* We must calculate the symbol count differently in COFF in order to take AUX
-symbols into account. Some symbols are written using multiple entries, so there
-can be a primary entry and 0 or more aux entries for each symbol */
+symbols into account. The index of the primary entry of each symbol is kept as it is counted, so the
+relocations can refer to it. */
 static unsigned int coff_symbol_count(backend_object* obj)
 {
-   unsigned int count=0;
+   unsigned int count = coff_comdat_entries(obj);
    backend_symbol* sym = backend_get_first_symbol(obj);
    while (sym)
    {
-      count++; // for the primary symbol
-      switch (sym->type)
-      {
-      case SYMBOL_TYPE_FILE:
-         if (sym->section == 0)
-            count++; // aux type 4
-         break;
-      case SYMBOL_TYPE_SECTION:
-         count++; // aux type 5
-         break;
-      case SYMBOL_TYPE_FUNCTION:
-         count++; // aux format 1
-         break;
-      }
+      sym->_index = count;
+      count += 1 + coff_aux_count(sym); // for the primary symbol and its aux entries
       //printf("counting symbol %s (%u)\n", sym->name, count);
       sym = backend_get_next_symbol(obj);
    }
    return count;
 }
 
-static int coff_write_file(backend_object* obj, const char* filename)
+static unsigned short backend_to_coff_reloc_type(backend_reloc_type t)
 {
-   FILE* f = fopen(filename, "wb");
-   if (!f)
+   if (t == RELOC_TYPE_PC_RELATIVE)
+      return IMAGE_REL_I386_REL32;
+   return IMAGE_REL_I386_DIR32;
+}
+
+static int coff_has_raw_data(const backend_section* sec)
+{
+   return sec->size && sec->data && !(sec->flags & SECTION_FLAG_UNINIT_DATA);
+}
+
+/* The raw data of each section is followed by its relocations, starting at 'pos'. Returns the
+position after the last section, which is where the symbol table goes. */
+static unsigned int coff_layout_size(backend_object* obj, unsigned int pos)
+{
+   backend_section* sec = backend_get_first_section(obj);
+   while (sec)
    {
-      printf("can't open file\n");
-      return -1;
+      if (coff_has_raw_data(sec))
+         pos += sec->size;
+      pos += backend_section_relocation_count(obj, sec) * sizeof(coff_reloc);
+      sec = backend_get_next_section(obj);
    }
+   return pos;
+}
 
-   // fill and write the coff header
-   printf("writing COFF header\n");
-   coff_header ch;
-   ch.machine = IMAGE_FILE_MACHINE_I386;
-   ch.num_sections = backend_section_count(obj);
-   ch.time_created = time(NULL);
-   ch.offset_symtab = sizeof(coff_header) + sizeof(section_header)*backend_section_count(obj);
-   printf("counting symbols\n");
-   ch.num_symbols = coff_symbol_count(obj);
-	printf("setting count to %i symbols\n", ch.num_symbols);
-   ch.size_optional_hdr = 0;
-   ch.flags = (1<<COFF_FLAG_32BIT_MACHINE) | (1<<COFF_FLAG_DEBUG_STRIPPED);
-   fwrite(&ch, sizeof(coff_header), 1, f);
-
-   // section table immediately follows the COFF header
-   printf("writing %u sections\n", backend_section_count(obj));
+static void coff_write_section_headers(backend_object* obj, FILE* f, unsigned int pos, coff_strtab* strtab)
+{
+   log_debug("writing %u sections\n", backend_section_count(obj));
    backend_section* sec = backend_get_first_section(obj);
    while (sec)
    {
       section_header sh;
-      printf("Writing section %s\n", sec->name);
-      strncpy(sh.name, sec->name, 9); // yes, we want the null to go one past the end of buffer
+      char name[9];
+      log_debug("Writing section %s\n", sec->name);
+
+      // long names (i.e. .text$function) are written as "/<offset in the string table>"
+      memset(sh.name, 0, sizeof(sh.name));
+      if (strlen(sec->name) > sizeof(sh.name))
+      {
+         snprintf(name, sizeof(name), "/%u", coff_add_string(strtab, sec->name));
+         memcpy(sh.name, name, strlen(name));
+      }
+      else
+         memcpy(sh.name, sec->name, strlen(sec->name));
+
       sh.size_in_mem = sec->size;
       sh.address = sec->address;
-      sh.data_offset = ch.offset_symtab + ch.num_symbols*sizeof(symbol) + 0; // after the string table
-      sh.reloc = 0;
+      sh.size_on_disk = 0;
+      sh.data_offset = 0;
+      if (coff_has_raw_data(sec))
+      {
+         sh.size_on_disk = sec->size;
+         sh.data_offset = pos;
+         pos += sec->size;
+      }
+      sh.num_reloc = backend_section_relocation_count(obj, sec);
+      sh.reloc = sh.num_reloc ? pos : 0;
+      pos += sh.num_reloc * sizeof(coff_reloc);
       sh.linenums = 0;
-      sh.num_reloc = 0;
       sh.num_lines = 0;
       
-      // section alignment
-      sh.flags = (sec->alignment & SCN_ALIGN) << SCN_SHIFT_ALIGN;
+      // section alignment, stored as log2(alignment) + 1
+      sh.flags = 0;
+      if (sec->alignment)
+      {
+         unsigned int n = 1;
+         while ((1U << (n - 1)) < sec->alignment && n < 14)
+            n++;
+         sh.flags = n << SCN_SHIFT_ALIGN;
+      }
 
       // convert the flags
       if (sec->flags & SECTION_FLAG_CODE)
@@ -929,42 +1059,193 @@ static int coff_write_file(backend_object* obj, const char* filename)
          sh.flags |= SCN_LNK_INFO |SCN_LNK_REMOVE;
       if (sec->flags & SECTION_FLAG_DISCARDABLE)
          sh.flags |= SCN_LNK_REMOVE;
+      if (coff_is_comdat(sec))
+         sh.flags |= SCN_LNK_COMDAT;
 
-      printf("writing section header\n");
+      log_debug("writing section header\n");
       fwrite(&sh, sizeof(section_header), 1, f);
       sec = backend_get_next_section(obj);
    }
+}
+
+/* Write the contents of each section, followed by its relocations. COFF relocations don't have an
+addend, so it is stored in the relocated field instead. The symbols must already have been counted
+by coff_symbol_count(), which gives them their indexes. */
+static void coff_write_section_data(backend_object* obj, FILE* f)
+{
+   backend_section* sec = backend_get_first_section(obj);
+   while (sec)
+   {
+      char* data = NULL;
+      if (coff_has_raw_data(sec))
+      {
+         data = mem_alloc(MEM_DATA, sec->size);
+         memcpy(data, sec->data, sec->size);
+      }
+
+      for (backend_reloc* r=backend_get_first_section_reloc(obj, sec); data && r; r=backend_get_next_section_reloc(obj))
+      {
+         if (r->offset + 4 > sec->size)
+            continue;
+
+         // the field is relative to the end of the relocated field, which is what the addend took care of
+         int addend = r->addend;
+         if (r->type == RELOC_TYPE_PC_RELATIVE)
+            addend += 4;
+         memcpy(data + r->offset, &addend, sizeof(addend));
+      }
+      if (data)
+         fwrite(data, sec->size, 1, f);
+      mem_free(MEM_DATA, data);
+
+      for (backend_reloc* r=backend_get_first_section_reloc(obj, sec); r; r=backend_get_next_section_reloc(obj))
+      {
+         coff_reloc cr;
+         cr.address = r->offset;
+         cr.symbol = r->symbol->_index;
+         cr.type = backend_to_coff_reloc_type(r->type);
+         fwrite(&cr, sizeof(coff_reloc), 1, f);
+      }
+      sec = backend_get_next_section(obj);
+   }
+}
+
+// the section symbol of a COMDAT section, and its section definition
+static void coff_write_comdat_symbol(backend_object* obj, backend_section* sec, short index, FILE* f, coff_strtab* strtab)
+{
+   symbol s;
+   symbol_aux_sec aux;
+
+   memset(&s, 0, sizeof(symbol));
+   if (strlen(sec->name) > sizeof(s.name.str))
+      s.name.ptr.index = coff_add_string(strtab, sec->name);
+   else
+      memcpy(s.name.str, sec->name, strlen(sec->name));
+   s.section = index;
+   s.class = SYM_CLASS_STATIC;
+   s.auxsymbols = 1;
+
+   memset(&aux, 0, sizeof(aux));
+   aux.length = sec->size;
+   aux.num_reloc = backend_section_relocation_count(obj, sec);
+   aux.selection = IMAGE_COMDAT_SELECT_NODUPLICATES;
+
+   fwrite(&s, sizeof(symbol), 1, f);
+   fwrite(&aux, sizeof(aux), 1, f);
+}
+
+static void coff_write_symbols(backend_object* obj, FILE* f, coff_strtab* strtab)
+{
+   char aux[sizeof(symbol)];
+   short index = 0;
+
+	log_debug("writing symbol table\n");
+   for (const list_node* iter=obj->section_table ? ll_iter_start(obj->section_table) : NULL; iter != NULL; iter=iter->next)
+   {
+      // sections are numbered from 1
+      index++;
+      if (coff_is_comdat(iter->val))
+         coff_write_comdat_symbol(obj, iter->val, index, f, strtab);
+   }
 
-   // symbol table
    backend_symbol* sym = backend_get_first_symbol(obj);
    while (sym)
    {
       symbol s;
-      memcpy(s.name.str, sym->name, 8);
+      memset(&s, 0, sizeof(symbol));
+      memset(aux, 0, sizeof(aux));
       s.val = sym->val;
-      //JKN - fix this. it should call backend_get_section_index() s.section = sym->section->index;
-      s.auxsymbols = 0;
+      s.auxsymbols = coff_aux_count(sym);
+      if (strlen(sym->name) > sizeof(s.name.str))
+         s.name.ptr.index = coff_add_string(strtab, sym->name);
+      else
+         memcpy(s.name.str, sym->name, strlen(sym->name));
+
+      // symbols are numbered from 1, and 0 means the symbol is defined somewhere else
+      if (sym->section && !(sym->flags & SYMBOL_FLAG_EXTERNAL))
+         s.section = sym->section->_index;
+
       switch (sym->type)
       {
       case SYMBOL_TYPE_FILE:
+			log_debug("writing file symbol %s\n", sym->name);
+         // the name of the file goes in the aux entry
+         memset(&s.name, 0, sizeof(s.name));
+			memcpy(s.name.str, ".file", 5);
+         memcpy(aux, sym->name, strnlen(sym->name, sizeof(aux)));
          s.type = 0x20;
          s.class = SYM_CLASS_FILE;
          s.section = -2;
          break;
+
       case SYMBOL_TYPE_SECTION:
+         s.section = backend_get_section_index_by_name(obj, sym->name);
          s.type = 0;
          s.class = SYM_CLASS_STATIC;
          break;
+
       case SYMBOL_TYPE_FUNCTION:
-         s.type = 0;
+         s.type = 0x20;
          s.class = SYM_CLASS_EXTERNAL;
          break;
+
+      default:
+         s.type = 0;
+         s.class = (sym->flags & SYMBOL_FLAG_GLOBAL) ? SYM_CLASS_EXTERNAL : SYM_CLASS_STATIC;
+         break;
       }
+      if (s.section < 0 && sym->type != SYMBOL_TYPE_FILE)
+         s.section = 0;
+
       fwrite(&s, sizeof(symbol), 1, f);
+      if (s.auxsymbols)
+         fwrite(aux, sizeof(aux), 1, f);
       sym = backend_get_next_symbol(obj);
    }
+}
 
-   // string table immediately follows the symbol table
+// the string table immediately follows the symbol table
+static void coff_write_strtab(coff_strtab* strtab, FILE* f)
+{
+   if (strtab->size == 0)
+      strtab->size = 4;
+   fwrite(&strtab->size, sizeof(strtab->size), 1, f);
+   if (strtab->size > 4)
+      fwrite(strtab->data + 4, strtab->size - 4, 1, f);
+   mem_free(MEM_STRINGS, strtab->data);
+}
+
+static int coff_write_file(backend_object* obj, const char* filename)
+{
+   coff_strtab strtab = {0};
+   FILE* f = fopen(filename, "wb");
+   if (!f)
+   {
+      log_error("can't open file\n");
+      return -1;
+   }
+
+   // fill and write the coff header - the section contents come after the section table
+   log_debug("writing COFF header\n");
+   unsigned int data_offset = sizeof(coff_header) + sizeof(section_header)*backend_section_count(obj);
+   coff_header ch;
+   ch.machine = IMAGE_FILE_MACHINE_I386;
+   ch.num_sections = backend_section_count(obj);
+   ch.time_created = time(NULL);
+   ch.offset_symtab = coff_layout_size(obj, data_offset);
+   backend_index_sections(obj);
+   log_debug("counting symbols\n");
+   ch.num_symbols = coff_symbol_count(obj);
+	log_debug("setting count to %i symbols\n", ch.num_symbols);
+   ch.size_optional_hdr = 0;
+   ch.flags = (1<<COFF_FLAG_32BIT_MACHINE) | (1<<COFF_FLAG_DEBUG_STRIPPED);
+   fwrite(&ch, sizeof(coff_header), 1, f);
+
+   // section table immediately follows the COFF header
+   coff_write_section_headers(obj, f, data_offset, &strtab);
+   coff_write_section_data(obj, f);
+   coff_write_symbols(obj, f, &strtab);
+   coff_write_strtab(&strtab, f);
 
    fclose(f);
    return 0;
@@ -984,10 +1265,15 @@ static const char pe_header[] =
 
 static int pe32_write_file(backend_object* obj, const char* filename)
 {
+   coff_strtab strtab = {0};
+   unsigned short state = STATE_ID_NORMAL; // STATE_ID_
+   unsigned int data_offset = sizeof(pe_header) + MAGIC_SIZE + sizeof(coff_header) + sizeof(state) +
+      sizeof(optional_header) + sizeof(pe32_windows_header) + sizeof(data_dirs) +
+      sizeof(section_header)*backend_section_count(obj);
    FILE* f = fopen(filename, "wb");
    if (!f)
    {
-      printf("can't open file\n");
+      log_error("can't open file\n");
       return -1;
    }
 
@@ -998,20 +1284,20 @@ static int pe32_write_file(backend_object* obj, const char* filename)
    fwrite(buff, MAGIC_SIZE, 1, f);
 
    // fill and write the coff header
-   printf("writing PE file\n");
+   log_debug("writing PE file\n");
    coff_header ch;
    ch.machine = IMAGE_FILE_MACHINE_I386;
    ch.num_sections = backend_section_count(obj);
    ch.time_created = time(NULL);
-   ch.offset_symtab = sizeof(coff_header) + sizeof(optional_header) + +sizeof(pe32_windows_header) + sizeof(data_dirs) + sizeof(section_header)*backend_section_count(obj);
-   printf("counting symbols\n");
+   ch.offset_symtab = coff_layout_size(obj, data_offset);
+   backend_index_sections(obj);
+   log_debug("counting symbols\n");
    ch.num_symbols = coff_symbol_count(obj);
-	printf("setting count to %i symbols\n", ch.num_symbols);
+	log_debug("setting count to %i symbols\n", ch.num_symbols);
    ch.size_optional_hdr = sizeof(optional_header);
    ch.flags = (1<<COFF_FLAG_32BIT_MACHINE) | (1<<COFF_FLAG_DEBUG_STRIPPED) | (1<<COFF_FLAG_EXECUTABLE_IMAGE);
    fwrite(&ch, sizeof(coff_header), 1, f);
 
-   unsigned short state = STATE_ID_NORMAL; // STATE_ID_
    fwrite(&state, sizeof(state), 1, f);
 
    // standard optional header
@@ -1040,84 +1326,11 @@ static int pe32_write_file(backend_object* obj, const char* filename)
    data_dirs dd;
    fwrite(&dd, sizeof(data_dirs), 1, f);
 
-   // section table immediately follows the COFF header
-   printf("writing %u sections\n", backend_section_count(obj));
-   backend_section* sec = backend_get_first_section(obj);
-   while (sec)
-   {
-      section_header sh;
-      printf("Writing section %s\n", sec->name);
-      strncpy(sh.name, sec->name, 9); // yes, we want the null to go one past the end of buffer
-      sh.size_in_mem = sec->size;
-      sh.address = sec->address;
-      sh.data_offset = ch.offset_symtab + ch.num_symbols*sizeof(symbol) + 0; // after the string table
-      sh.reloc = 0;
-      sh.linenums = 0;
-      sh.num_reloc = 0;
-      sh.num_lines = 0;
-      
-      // section alignment
-      sh.flags = (sec->alignment & SCN_ALIGN) << SCN_SHIFT_ALIGN;
-
-      // convert the flags
-      if (sec->flags & SECTION_FLAG_CODE)
-         sh.flags |= SCN_CNT_CODE | SCN_MEM_EXECUTE | SCN_MEM_READ;
-      if (sec->flags & SECTION_FLAG_INIT_DATA)
-         sh.flags |= SCN_CNT_INIT_DATA |SCN_MEM_READ | SCN_MEM_WRITE;
-      if (sec->flags & SECTION_FLAG_UNINIT_DATA)
-         sh.flags |= SCN_CNT_UNINIT_DATA |SCN_MEM_READ | SCN_MEM_WRITE;
-      if (sec->flags & SECTION_FLAG_COMMENTS)
-         sh.flags |= SCN_LNK_INFO |SCN_LNK_REMOVE;
-      if (sec->flags & SECTION_FLAG_DISCARDABLE)
-         sh.flags |= SCN_LNK_REMOVE;
-
-      printf("writing section header\n");
-      fwrite(&sh, sizeof(section_header), 1, f);
-      sec = backend_get_next_section(obj);
-   }
-
-   // symbol table
-	printf("writing symbol table\n");
-   backend_symbol* sym = backend_get_first_symbol(obj);
-   while (sym)
-   {
-		char tmp[19];
-      symbol s;
-      s.val = sym->val;
-      //JKN - fix this. it should call backend_get_section_index() s.section = sym->section->index;
-      s.auxsymbols = 0;
-      switch (sym->type)
-      {
-      case SYMBOL_TYPE_FILE:
-			printf("writing file symbol %s\n", sym->name);
-         s.type = 0x20;
-         s.class = SYM_CLASS_FILE;
-         s.section = -2;
-			s.auxsymbols = 1;
-			memcpy(s.name.str, ".file", 6);
-			fwrite(&s, sizeof(symbol), 1, f);
-			memcpy(tmp, sym->name, 19);
-			fwrite(tmp, 18, 1, f);
-         break;
-
-      case SYMBOL_TYPE_SECTION:
-			memcpy(s.name.str, sym->name, 8);
-         s.type = 0;
-         s.class = SYM_CLASS_STATIC;
-			s.auxsymbols = 1;
-         break;
-
-      case SYMBOL_TYPE_FUNCTION:
-      	memcpy(s.name.str, sym->name, 8);
-         s.type = 0;
-         s.class = SYM_CLASS_EXTERNAL;
-			s.auxsymbols = 1;
-         break;
-      }
-      sym = backend_get_next_symbol(obj);
-   }
-
-   // string table immediately follows the symbol table
+   // section table immediately follows the optional headers, and the section contents follow it
+   coff_write_section_headers(obj, f, data_offset, &strtab);
+   coff_write_section_data(obj, f);
+   coff_write_symbols(obj, f, &strtab);
+   coff_write_strtab(&strtab, f);
 
    fclose(f);
    return 0;
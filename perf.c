@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perf.h"
+#include "alloc.h"
+#include "log.h"
+
+typedef struct thread_counters
+{
+	int fds[PERF_EVENT_COUNT];
+} thread_counters;
+
+static const char* event_names[PERF_EVENT_COUNT] =
+{
+	"cycles",
+	"instructions",
+	"cache_misses",
+	"branch_misses",
+};
+
+static const unsigned long event_configs[PERF_EVENT_COUNT] =
+{
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+int perf_enabled;
+
+static int available[PERF_EVENT_COUNT];
+static pthread_key_t counters_key;
+static __thread thread_counters* counters;
+
+static int open_counter(perf_event e)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = event_configs[e];
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	// this thread only, on any CPU
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// the emitting threads come and go, so their counters are closed when they exit
+static void close_counters(void* p)
+{
+	thread_counters* c = p;
+	for (int i=0; i < PERF_EVENT_COUNT; i++)
+		if (c->fds[i] >= 0)
+			close(c->fds[i]);
+	mem_free(MEM_OTHER, c);
+}
+
+static thread_counters* open_counters(void)
+{
+	thread_counters* c = mem_alloc(MEM_OTHER, sizeof(thread_counters));
+	if (!c)
+		return NULL;
+	for (int i=0; i < PERF_EVENT_COUNT; i++)
+		c->fds[i] = available[i] ? open_counter(i) : -1;
+	pthread_setspecific(counters_key, c);
+	return c;
+}
+
+int perf_init(void)
+{
+	int count = 0;
+
+	if (perf_enabled)
+		return 0;
+
+	for (int i=0; i < PERF_EVENT_COUNT; i++)
+	{
+		int fd = open_counter(i);
+		if (fd < 0)
+		{
+			log_info("Performance counter %s is not available\n", event_names[i]);
+			continue;
+		}
+		close(fd);
+		available[i] = 1;
+		count++;
+	}
+
+	if (!count)
+	{
+		log_warn("Performance counters are not available - check /proc/sys/kernel/perf_event_paranoid\n");
+		return -1;
+	}
+
+	pthread_key_create(&counters_key, close_counters);
+	perf_enabled = 1;
+	return 0;
+}
+
+void perf_read(perf_sample* s)
+{
+	// value, time enabled, time running
+	unsigned long buf[3];
+
+	memset(s, 0, sizeof(perf_sample));
+	if (!perf_enabled)
+		return;
+	if (!counters && !(counters = open_counters()))
+		return;
+
+	for (int i=0; i < PERF_EVENT_COUNT; i++)
+	{
+		if (counters->fds[i] < 0 || read(counters->fds[i], buf, sizeof(buf)) != sizeof(buf) || !buf[2])
+			continue;
+
+		// the counter was multiplexed with others - scale it up to the whole time
+		if (buf[2] < buf[1])
+			s->val[i] = (unsigned long)((double)buf[0] * buf[1] / buf[2]);
+		else
+			s->val[i] = buf[0];
+		s->valid |= 1U << i;
+	}
+}
+
+int perf_available(perf_event e)
+{
+	return perf_enabled && available[e];
+}
+
+const char* perf_event_name(perf_event e)
+{
+	return event_names[e];
+}
@@ -0,0 +1,35 @@
+/* Hardware performance counters
+
+With --perf, the CPU's performance counters (cycles, instructions, cache misses and branch misses)
+are read around each phase that is timed by stats.h, through the Linux perf_event_open() interface.
+The counters are opened for each thread the first time it reads them, and only count that thread,
+in user mode. When the counters can't be opened (an old kernel, a virtual machine without a PMU,
+or perf_event_paranoid set too high) the option is turned off with a warning, and a counter that
+the CPU doesn't have on its own is reported as missing, so the rest of the run is not affected. */
+
+#ifndef _PERF__H
+#define _PERF__H
+
+typedef enum perf_event
+{
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_EVENT_COUNT
+} perf_event;
+
+typedef struct perf_sample
+{
+	unsigned long val[PERF_EVENT_COUNT];
+	unsigned int valid;		// bit (1 << event) is set when val[event] was read
+} perf_sample;
+
+extern int perf_enabled;
+
+int perf_init(void); /* returns 0 if at least one counter is available */
+void perf_read(perf_sample* s); /* the counters of the calling thread - check 'valid' before using a value */
+int perf_available(perf_event e);
+const char* perf_event_name(perf_event e);
+
+#endif // _PERF__H
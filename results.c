@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include "results.h"
+#include "delinker.h"
+#include "hash.h"
+#include "alloc.h"
+#include "log.h"
+
+// change this whenever a change to the delinker changes its output, so the old entries are not used
+#define RESULTS_VERSION 3
+
+// how a file was copied out of the cache
+enum
+{
+	COPY_REFLINK,
+	COPY_LINK,
+	COPY_PLAIN,
+	COPY_COUNT
+};
+
+// all of the paths are built with this - returns -1 if the path doesn't fit in PATH_MAX
+static int make_path(char* path, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+static int make_path(char* path, const char* fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	int n = vsnprintf(path, PATH_MAX, fmt, args);
+	va_end(args);
+	return (n < 0 || n >= PATH_MAX) ? -1 : 0;
+}
+
+static int entry_path(char* path, const char* dir, const result_key* key)
+{
+	return make_path(path, "%s/%016lx", dir, key->name);
+}
+
+// the first line of the index, which tells the inputs with the same entry name apart
+#define KEY_LINE_SIZE (8 + SHA256_SIZE * 2 + 24)
+static void key_line(char* line, const result_key* key)
+{
+	char* p = line + sprintf(line, "sha256 ");
+	for (unsigned int i=0; i < SHA256_SIZE; i++)
+		p += sprintf(p, "%02x", key->digest[i]);
+	sprintf(p, " %lu\n", key->size);
+}
+
+// the same rule as the output objects: relative names are in the output directory
+static int join_path(char* path, const char* dir, const char* name)
+{
+	if (!dir || name[0] == '/')
+		return make_path(path, "%s", name);
+	return make_path(path, "%s/%s", dir, name);
+}
+
+int results_key(const char* input_filename, backend_type output_target, result_key* key)
+{
+	struct stat st;
+	sha256_ctx ctx;
+
+	int fd = open(input_filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode))
+	{
+		close(fd);
+		return -1;
+	}
+	sha256_init(&ctx);
+	if (st.st_size)
+	{
+		void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED)
+		{
+			close(fd);
+			return -1;
+		}
+		sha256_update(&ctx, map, st.st_size);
+		munmap(map, st.st_size);
+	}
+	close(fd);
+
+	// the options that change what is written
+	long params[] = { RESULTS_VERSION, output_target, config.reconstruct_symbols, config.fill_gaps, config.shared_data,
+		config.slice_data, config.function_sections };
+	sha256_update(&ctx, params, sizeof(params));
+	if (config.manifest)
+		sha256_update(&ctx, config.manifest, strlen(config.manifest) + 1);
+	sha256_final(&ctx, key->digest);
+
+	key->size = st.st_size;
+	key->name = 0;
+	for (unsigned int i=0; i < sizeof(key->name); i++)
+		key->name = key->name << 8 | key->digest[i];
+	return 0;
+}
+
+// copy src to dst in the cheapest way that works - returns COPY_ or -1
+static int copy_file(const char* src, const char* dst, int allow_link)
+{
+	char buf[65536];
+	long n;
+
+	int in = open(src, O_RDONLY);
+	if (in < 0)
+		return -1;
+
+	// never write through an existing file, which may be a link to something else
+	unlink(dst);
+	int out = open(dst, O_WRONLY | O_CREAT | O_EXCL, 0666);
+	if (out < 0)
+	{
+		close(in);
+		return -1;
+	}
+
+#ifdef FICLONE
+	if (ioctl(out, FICLONE, in) == 0)
+	{
+		close(out);
+		close(in);
+		return COPY_REFLINK;
+	}
+#endif
+
+	if (allow_link)
+	{
+		close(out);
+		unlink(dst);
+		if (link(src, dst) == 0)
+		{
+			close(in);
+			return COPY_LINK;
+		}
+		out = open(dst, O_WRONLY | O_CREAT | O_EXCL, 0666);
+		if (out < 0)
+		{
+			close(in);
+			return -1;
+		}
+	}
+
+	int err = 0;
+	while (!err && (n = read(in, buf, sizeof(buf))) > 0)
+	{
+		for (long done = 0; done < n; )
+		{
+			long w = write(out, buf + done, n - done);
+			if (w <= 0)
+			{
+				err = 1;
+				break;
+			}
+			done += w;
+		}
+	}
+	err |= (n < 0);
+	err |= close(out);
+	close(in);
+	if (err)
+	{
+		unlink(dst);
+		return -1;
+	}
+	return COPY_PLAIN;
+}
+
+int results_lookup(const char* dir, const result_key* key, const char* output_dir, manifest* outputs)
+{
+	char line[KEY_LINE_SIZE];
+	char entry[PATH_MAX];
+	char src[PATH_MAX];
+	char dst[PATH_MAX];
+	char name[PATH_MAX];
+	unsigned int counts[COPY_COUNT] = { 0 };
+	unsigned int n = 0;
+	int ret = 0;
+
+	if (entry_path(entry, dir, key) || make_path(src, "%s/index", entry))
+		return -1;
+	FILE* index = fopen(src, "r");
+	if (!index)
+		return -1;
+
+	// another input (or options) with the same entry name
+	key_line(line, key);
+	if (!fgets(name, sizeof(name), index) || strcmp(name, line))
+	{
+		log_warn("The result cache entry %s is for another input\n", entry);
+		fclose(index);
+		return -1;
+	}
+
+	while (fgets(name, sizeof(name), index))
+	{
+		name[strcspn(name, "\n")] = 0;
+		int how = -1;
+		if (make_path(src, "%s/%u", entry, n++) == 0 && join_path(dst, output_dir, name) == 0)
+			how = copy_file(src, dst, 1);
+		if (how < 0)
+		{
+			log_warn("Can't copy %s from the result cache %s\n", name, entry);
+			ret = -1;
+			break;
+		}
+		counts[how]++;
+		if (outputs)
+			manifest_add(outputs, MANIFEST_OBJECT, name, 0);
+	}
+	fclose(index);
+
+	if (ret == 0)
+		log_info("Using cached result %016lx: %u files (%u reflinked, %u linked, %u copied)\n", key->name, n,
+			counts[COPY_REFLINK], counts[COPY_LINK], counts[COPY_PLAIN]);
+	return ret;
+}
+
+static int cmp_name(const void* a, const void* b)
+{
+	return strcmp(*(const char**)a, *(const char**)b);
+}
+
+static void remove_entry(const char* entry, unsigned int files)
+{
+	char path[PATH_MAX];
+
+	for (unsigned int i=0; i < files; i++)
+		if (make_path(path, "%s/%u", entry, i) == 0)
+			unlink(path);
+	if (make_path(path, "%s/index", entry) == 0)
+		unlink(path);
+	rmdir(entry);
+}
+
+int results_store(const char* dir, const result_key* key, const char* output_dir, const manifest* outputs)
+{
+	char line[KEY_LINE_SIZE];
+	char entry[PATH_MAX];
+	char tmp[PATH_MAX];
+	char path[PATH_MAX];
+	char src[PATH_MAX];
+	unsigned int count = 0;
+	unsigned int files = 0;
+
+	mkdir(dir, 0777);
+	// in batch mode, two threads of the same process may store the same key
+	if (entry_path(entry, dir, key) || make_path(tmp, "%s.%u.%lx", entry, getpid(), (unsigned long)pthread_self()))
+	{
+		log_warn("The result cache path %s is too long\n", dir);
+		return -1;
+	}
+	if (mkdir(tmp, 0777))
+	{
+		log_warn("Can't create result cache entry %s\n", tmp);
+		return -1;
+	}
+
+	// an object that was written twice is stored once
+	const char** names = mem_alloc(MEM_WORK, sizeof(char*) * (outputs->count + 1));
+	for (unsigned int i=0; i < outputs->count; i++)
+		if (outputs->entries[i].kind == MANIFEST_OBJECT)
+			names[count++] = outputs->entries[i].name;
+	qsort(names, count, sizeof(char*), cmp_name);
+
+	FILE* index = NULL;
+	if (make_path(path, "%s/index", tmp) == 0)
+		index = fopen(path, "w");
+	int err = !index;
+	if (index)
+	{
+		key_line(line, key);
+		err = (fputs(line, index) < 0);
+	}
+	for (unsigned int i=0; i < count && !err; i++)
+	{
+		if (i && strcmp(names[i], names[i-1]) == 0)
+			continue;
+		// the outputs stay independent of the cache, so they can't be linked here
+		err = (join_path(src, output_dir, names[i]) || make_path(path, "%s/%u", tmp, files++) ||
+			copy_file(src, path, 0) < 0 || chmod(path, 0444) || fprintf(index, "%s\n", names[i]) < 0);
+	}
+	if (index)
+		err |= fclose(index);
+	mem_free(MEM_WORK, names);
+
+	// the entry is complete when it has its final name - another process may have stored it first
+	if (err || rename(tmp, entry))
+	{
+		if (err)
+			log_warn("Can't write result cache entry %s\n", entry);
+		remove_entry(tmp, files);
+		return err ? -2 : 0;
+	}
+
+	return 0;
+}
@@ -0,0 +1,35 @@
+/* Result cache
+
+Keeps the complete output of delinking a file (every object that was written, and the manifest in
+incremental mode), named by a hash of the input file and of the options that change the output. When
+the same file is delinked again with the same options, the objects are taken from the cache and the
+input isn't even read. The outputs are made as cheaply as the file system allows: a reflink (a
+copy-on-write clone) where it is supported, otherwise a hard link to the file in the cache, or a plain
+copy when the cache is on another file system. The files in the cache are read-only, because a hard
+link shares them with the output directory. Each entry is a directory with the files and an index of
+their names, which is built under a temporary name and then renamed, so that other processes never
+see a partial entry. An entry is named by the first 64 bits of the SHA-256 digest of the input and the
+options, and its index starts with the whole digest and the size of the input, which must match before
+the entry is used. */
+
+#ifndef _RESULTS__H
+#define _RESULTS__H
+
+#include "backend.h"
+#include "manifest.h"
+#include "hash.h"
+
+typedef struct result_key
+{
+	unsigned long name;		// the name of the entry
+	unsigned long size;		// size of the input file
+	unsigned char digest[SHA256_SIZE];	// of the input file and the options
+} result_key;
+
+int results_key(const char* input_filename, backend_type output_target, result_key* key); /* -1 if the input can't be read */
+/* copies the outputs, and adds their names to outputs (unless it is NULL) - returns 0 on a hit */
+int results_lookup(const char* dir, const result_key* key, const char* output_dir, manifest* outputs);
+/* outputs has the names of the files in output_dir (MANIFEST_OBJECT entries) - duplicates are allowed */
+int results_store(const char* dir, const result_key* key, const char* output_dir, const manifest* outputs);
+
+#endif // _RESULTS__H
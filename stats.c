@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "stats.h"
+#include "alloc.h"
+#include "instrument.h"
+
+typedef struct phase_stats
+{
+	unsigned long wall_ns;
+	unsigned long cpu_ns;
+	unsigned long peak_rss;		// in KB, as reported by getrusage()
+	unsigned long perf[PERF_EVENT_COUNT];
+	int used;					// the phase ran at least once
+} phase_stats;
+
+static const char* phase_names[STATS_PHASE_COUNT] =
+{
+	"read",
+	"analyze",
+	"reconstruct",
+	"relocations",
+	"sort",
+	"partition",
+	"copy",
+	"fixup",
+	"write",
+};
+
+static const char* counter_names[STATS_COUNTER_COUNT] =
+{
+	"text_bytes",
+	"symbols",
+	"relocations",
+	"objects",
+	"bytes_written",
+};
+
+stats_format stats_enabled;
+
+static phase_stats phases[STATS_PHASE_COUNT];
+static unsigned long counters[STATS_COUNTER_COUNT];
+static stats_timer run;
+
+static unsigned long elapsed_ns(const struct timespec* from, const struct timespec* to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000000000UL + to->tv_nsec - from->tv_nsec;
+}
+
+static unsigned long peak_rss(void)
+{
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru))
+		return 0;
+	return ru.ru_maxrss;
+}
+
+void stats_init(stats_format format)
+{
+	stats_enabled = format;
+	if (!stats_enabled)
+		return;
+	mem_enable_accounting();
+	clock_gettime(CLOCK_MONOTONIC, &run.wall);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &run.cpu);
+}
+
+void stats_start(stats_timer* t)
+{
+	INSTRUMENT_PHASE_END(-1);
+	if (!stats_enabled)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &t->wall);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t->cpu);
+	if (perf_enabled)
+		perf_read(&t->perf);
+}
+
+void stats_stop(stats_timer* t, stats_phase phase)
+{
+	struct timespec wall, cpu;
+	phase_stats* p = &phases[phase];
+
+	INSTRUMENT_PHASE_END(phase);
+	if (!stats_enabled)
+		return;
+	// the counters are read first, so they don't count the rest of this function
+	if (perf_enabled)
+	{
+		perf_sample end;
+		perf_read(&end);
+
+		// a counter that couldn't be read at either end, or that went backwards because its scaling
+		// changed (it was multiplexed), adds nothing to the phase
+		unsigned int valid = t->perf.valid & end.valid;
+		for (int i=0; i < PERF_EVENT_COUNT; i++)
+			if (valid & (1U << i) && end.val[i] >= t->perf.val[i])
+				__atomic_add_fetch(&p->perf[i], end.val[i] - t->perf.val[i], __ATOMIC_RELAXED);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+
+	// the per-object phases are timed by all of the emitting threads at once
+	__atomic_add_fetch(&p->wall_ns, elapsed_ns(&t->wall, &wall), __ATOMIC_RELAXED);
+	__atomic_add_fetch(&p->cpu_ns, elapsed_ns(&t->cpu, &cpu), __ATOMIC_RELAXED);
+	__atomic_store_n(&p->used, 1, __ATOMIC_RELAXED);
+
+	// the RSS only ever grows, so it is enough to keep the highest value seen
+	unsigned long rss = peak_rss();
+	unsigned long prev = __atomic_load_n(&p->peak_rss, __ATOMIC_RELAXED);
+	while (rss > prev && !__atomic_compare_exchange_n(&p->peak_rss, &prev, rss, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void stats_add(stats_counter c, unsigned long val)
+{
+	if (stats_enabled)
+		__atomic_add_fetch(&counters[c], val, __ATOMIC_RELAXED);
+}
+
+void stats_add_file(const char* filename)
+{
+	struct stat st;
+
+	if (!stats_enabled)
+		return;
+	stats_add(STATS_OBJECTS, 1);
+	if (stat(filename, &st) == 0)
+		stats_add(STATS_BYTES_WRITTEN, st.st_size);
+}
+
+const char* stats_phase_name(stats_phase phase)
+{
+	return phase_names[phase];
+}
+
+unsigned long stats_get(stats_counter c)
+{
+	return __atomic_load_n(&counters[c], __ATOMIC_RELAXED);
+}
+
+void stats_reset(void)
+{
+	memset(phases, 0, sizeof(phases));
+	memset(counters, 0, sizeof(counters));
+	stats_init(stats_enabled);
+}
+
+// per thousand instructions
+static double per_kinstr(const phase_stats* p, perf_event e)
+{
+	if (!p->perf[PERF_INSTRUCTIONS])
+		return 0;
+	return p->perf[e] * 1000.0 / p->perf[PERF_INSTRUCTIONS];
+}
+
+static void report_perf_text(FILE* f)
+{
+	fprintf(f, "\n%-12s %14s %14s %6s %14s %14s\n", "counters", "cycles", "instructions", "IPC",
+		"cache miss/ki", "branch miss/ki");
+	for (int i=0; i < STATS_PHASE_COUNT; i++)
+	{
+		const phase_stats* p = &phases[i];
+		char vals[PERF_EVENT_COUNT][24];
+
+		if (!p->used)
+			continue;
+		snprintf(vals[PERF_CYCLES], 24, "%lu", p->perf[PERF_CYCLES]);
+		snprintf(vals[PERF_INSTRUCTIONS], 24, "%lu", p->perf[PERF_INSTRUCTIONS]);
+		snprintf(vals[PERF_CACHE_MISSES], 24, "%.2f", per_kinstr(p, PERF_CACHE_MISSES));
+		snprintf(vals[PERF_BRANCH_MISSES], 24, "%.2f", per_kinstr(p, PERF_BRANCH_MISSES));
+		for (int e=0; e < PERF_EVENT_COUNT; e++)
+			if (!perf_available(e))
+				strcpy(vals[e], "-");
+
+		char ipc[24] = "-";
+		if (perf_available(PERF_CYCLES) && perf_available(PERF_INSTRUCTIONS) && p->perf[PERF_CYCLES])
+			snprintf(ipc, sizeof(ipc), "%.2f", (double)p->perf[PERF_INSTRUCTIONS] / p->perf[PERF_CYCLES]);
+
+		fprintf(f, "%-12s %14s %14s %6s %14s %14s\n", phase_names[i], vals[PERF_CYCLES], vals[PERF_INSTRUCTIONS],
+			ipc, vals[PERF_CACHE_MISSES], vals[PERF_BRANCH_MISSES]);
+	}
+}
+
+static void report_text(FILE* f, unsigned long wall, unsigned long cpu)
+{
+	fprintf(f, "%-12s %12s %12s %14s\n", "phase", "wall (ms)", "cpu (ms)", "peak rss (KB)");
+	for (int i=0; i < STATS_PHASE_COUNT; i++)
+	{
+		const phase_stats* p = &phases[i];
+		if (!p->used)
+			continue;
+		fprintf(f, "%-12s %12.3f %12.3f %14lu\n", phase_names[i], p->wall_ns / 1e6, p->cpu_ns / 1e6, p->peak_rss);
+	}
+	fprintf(f, "%-12s %12.3f %12.3f %14lu\n", "total", wall / 1e6, cpu / 1e6, peak_rss());
+
+	for (int i=0; i < STATS_COUNTER_COUNT; i++)
+		fprintf(f, "%-14s %lu\n", counter_names[i], counters[i]);
+	if (wall)
+	{
+		fprintf(f, "%-14s %.1f\n", "objects/s", counters[STATS_OBJECTS] * 1e9 / wall);
+		fprintf(f, "%-14s %.2f\n", "text MB/s", counters[STATS_TEXT_BYTES] * 1e3 / wall);
+	}
+
+	if (perf_enabled)
+		report_perf_text(f);
+
+	fprintf(f, "\n%-12s %12s %12s %10s %10s\n", "memory", "live (KB)", "peak (KB)", "allocs", "frees");
+	for (int i=0; i <= MEM_SUBSYS_COUNT; i++)
+	{
+		mem_usage u;
+		mem_get_usage(i, &u);
+		if (!u.allocs && i != MEM_SUBSYS_COUNT)
+			continue;
+		fprintf(f, "%-12s %12.1f %12.1f %10lu %10lu\n", mem_subsys_name(i), u.live / 1024.0, u.peak / 1024.0,
+			u.allocs, u.frees);
+	}
+}
+
+static void report_json(FILE* f, unsigned long wall, unsigned long cpu)
+{
+	fprintf(f, "{\"phases\":{");
+	for (int i=0, first=1; i < STATS_PHASE_COUNT; i++)
+	{
+		const phase_stats* p = &phases[i];
+		if (!p->used)
+			continue;
+		fprintf(f, "%s\"%s\":{\"wall_ns\":%lu,\"cpu_ns\":%lu,\"peak_rss_kb\":%lu",
+			first ? "" : ",", phase_names[i], p->wall_ns, p->cpu_ns, p->peak_rss);
+		for (int e=0; e < PERF_EVENT_COUNT; e++)
+			if (perf_available(e))
+				fprintf(f, ",\"%s\":%lu", perf_event_name(e), p->perf[e]);
+		fprintf(f, "}");
+		first = 0;
+	}
+	fprintf(f, "},\"total\":{\"wall_ns\":%lu,\"cpu_ns\":%lu,\"peak_rss_kb\":%lu}", wall, cpu, peak_rss());
+	for (int i=0; i < STATS_COUNTER_COUNT; i++)
+		fprintf(f, ",\"%s\":%lu", counter_names[i], counters[i]);
+	fprintf(f, ",\"memory\":{");
+	for (int i=0; i <= MEM_SUBSYS_COUNT; i++)
+	{
+		mem_usage u;
+		mem_get_usage(i, &u);
+		fprintf(f, "%s\"%s\":{\"live\":%li,\"peak\":%li,\"allocs\":%lu,\"frees\":%lu}",
+			i ? "," : "", mem_subsys_name(i), u.live, u.peak, u.allocs, u.frees);
+	}
+	fprintf(f, "}}\n");
+}
+
+void stats_report(FILE* f)
+{
+	struct timespec wall, cpu;
+
+	if (!stats_enabled)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+
+	if (stats_enabled == STATS_FORMAT_JSON)
+		report_json(f, elapsed_ns(&run.wall, &wall), elapsed_ns(&run.cpu, &cpu));
+	else
+		report_text(f, elapsed_ns(&run.wall, &wall), elapsed_ns(&run.cpu, &cpu));
+}
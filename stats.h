@@ -0,0 +1,68 @@
+/* Run statistics
+
+With --stats, the time spent in each phase of a run is measured and printed at the end, along with
+the peak memory use and the amount of work that was done. Each phase accumulates its wall time, the
+CPU time of the thread that ran it, and the peak RSS of the process when it ended. The per-object
+phases run once for every output object, possibly on several threads at the same time, so their
+times are the sum over all of the objects. The heap use of each subsystem (see alloc.h) is printed
+after the phases, and with --perf, the hardware counters of each phase (see perf.h). When the
+statistics are disabled, the timers don't read the clocks at all. */
+
+#ifndef _STATS__H
+#define _STATS__H
+
+#include <stdio.h>
+#include <time.h>
+#include "perf.h"
+
+typedef enum stats_phase
+{
+	STATS_PHASE_READ,				// reading the input file
+	STATS_PHASE_ANALYZE,			// decoding the code (or loading it from the cache)
+	STATS_PHASE_RECONSTRUCT,	// rebuilding the function symbols
+	STATS_PHASE_RELOCATIONS,	// build_relocations
+	STATS_PHASE_SORT,				// sorting the symbol table
+	STATS_PHASE_PARTITION,		// dividing the functions and relocations between the output objects
+	STATS_PHASE_COPY,				// per object: copying the code, symbols and data
+	STATS_PHASE_FIXUP,			// per object: copying and adjusting the relocations
+	STATS_PHASE_WRITE,			// per object: serializing to disk
+	STATS_PHASE_COUNT
+} stats_phase;
+
+typedef enum stats_counter
+{
+	STATS_TEXT_BYTES,				// size of the input code section
+	STATS_SYMBOLS,					// symbols in the input, after reconstruction
+	STATS_RELOCATIONS,			// relocations built for the input
+	STATS_OBJECTS,					// output objects written
+	STATS_BYTES_WRITTEN,			// total size of the output objects
+	STATS_COUNTER_COUNT
+} stats_counter;
+
+typedef enum stats_format
+{
+	STATS_FORMAT_NONE,			// statistics are disabled
+	STATS_FORMAT_TEXT,
+	STATS_FORMAT_JSON,
+} stats_format;
+
+typedef struct stats_timer
+{
+	struct timespec wall;
+	struct timespec cpu;
+	perf_sample perf;				// only read with --perf
+} stats_timer;
+
+extern stats_format stats_enabled;
+
+void stats_init(stats_format format); /* start measuring the whole run */
+void stats_start(stats_timer* t);
+void stats_stop(stats_timer* t, stats_phase phase); /* add the time since stats_start() to the phase */
+void stats_add(stats_counter c, unsigned long val); /* thread safe */
+void stats_add_file(const char* filename); /* count a written object and its size */
+unsigned long stats_get(stats_counter c);
+const char* stats_phase_name(stats_phase phase);
+void stats_reset(void); /* forget everything measured so far, and start measuring a new run */
+void stats_report(FILE* f);
+
+#endif // _STATS__H
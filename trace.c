@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "trace.h"
+#include "log.h"
+
+int trace_enabled;
+
+static FILE* trace_file;
+static struct timespec trace_start;
+static int event_count;
+// the output objects are written from several threads at once
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long now_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (t.tv_sec - trace_start.tv_sec) * 1000000000UL + t.tv_nsec - trace_start.tv_nsec;
+}
+
+// object names come from the input file, so they may need escaping
+static void write_string(FILE* f, const char* s)
+{
+	fputc('"', f);
+	for (; *s; s++)
+	{
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(f, "\\u%04x", *s);
+		else
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+int trace_open(const char* filename)
+{
+	trace_file = fopen(filename, "w");
+	if (!trace_file)
+	{
+		log_error("Can't open trace file %s\n", filename);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &trace_start);
+	fprintf(trace_file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	trace_enabled = 1;
+	return 0;
+}
+
+void trace_close(void)
+{
+	if (!trace_enabled)
+		return;
+	trace_enabled = 0;
+	fprintf(trace_file, "\n]}\n");
+	fclose(trace_file);
+	trace_file = NULL;
+	event_count = 0;
+}
+
+void trace_begin(trace_span* s)
+{
+	if (trace_enabled)
+		s->start = now_ns();
+}
+
+void trace_end(trace_span* s, const char* name, const char* object, ...)
+{
+	va_list args;
+
+	if (!trace_enabled)
+		return;
+	unsigned long end = now_ns();
+
+	pthread_mutex_lock(&trace_lock);
+	fprintf(trace_file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%i,\"tid\":%li,\"args\":{",
+		event_count++ ? ",\n" : "", name, s->start / 1e3, (end - s->start) / 1e3, getpid(), syscall(SYS_gettid));
+
+	int first = 1;
+	if (object)
+	{
+		fprintf(trace_file, "\"object\":");
+		write_string(trace_file, object);
+		first = 0;
+	}
+
+	va_start(args, object);
+	const char* key;
+	while ((key = va_arg(args, const char*)))
+	{
+		fprintf(trace_file, "%s\"%s\":%lu", first ? "" : ",", key, va_arg(args, unsigned long));
+		first = 0;
+	}
+	va_end(args);
+
+	fprintf(trace_file, "}}");
+	pthread_mutex_unlock(&trace_lock);
+}
@@ -0,0 +1,28 @@
+/* Trace output
+
+With --trace=<file>, the stages of the reader, the analysis passes, and the steps of writing each
+output object are recorded as spans in the Chrome trace-event format, which can be loaded in
+Perfetto (ui.perfetto.dev) or chrome://tracing. Each span is a "complete" event with the thread
+that ran it, the name of the object it worked on (if any), and a few sizes, so the objects that take
+the most time stand out. When tracing is disabled, the spans don't read the clock at all. */
+
+#ifndef _TRACE__H
+#define _TRACE__H
+
+typedef struct trace_span
+{
+	unsigned long start;		// ns since the trace was opened
+} trace_span;
+
+extern int trace_enabled;
+
+int trace_open(const char* filename);
+void trace_close(void);
+void trace_begin(trace_span* s);
+
+/* Record the span from trace_begin() until now. 'object' may be NULL. It is followed by pairs of a
+name and an unsigned long size, ending with NULL, i.e.
+trace_end(&s, "copy_data", u->filename, "sections", (unsigned long)count, NULL); */
+void trace_end(trace_span* s, const char* name, const char* object, ...);
+
+#endif // _TRACE__H
@@ -0,0 +1,2534 @@
+/* J.Nider 27/07/2017
+I tried for so long to get BFD to work, but it is just not built well enough
+to be used for other tasks. There are too many format-specific flags and
+behaviours that just make life difficult, which is why I am writing my own
+backend from scratch. */
+
+/* The idea of the program is simple - read in a fully linked executable,
+and write out a set of unlinked .o files that can be relinked later.*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "backend.h"
+#include "insn.h"
+#include "cache.h"
+#include "hash.h"
+#include "manifest.h"
+#include "results.h"
+#include "log.h"
+#include "stats.h"
+#include "alloc.h"
+#include "perf.h"
+#include "trace.h"
+#include "delinker.h"
+
+// the object that holds the data sections when they are shared by all of the other objects
+#define SHARED_DATA_FILENAME "shared_data.o"
+
+// data slices keep at least this alignment
+#define DATA_SLICE_ALIGN 16
+
+// estimated memory for each relocation of an output object (the relocation, its symbol and list nodes)
+#define UNIT_RELOC_COST 128
+
+struct config config = { .jobs = 1 };
+
+// make sure all function symbols are in increasing order, without any overlaps
+static int check_function_sequence(backend_object* obj)
+{
+	unsigned long curr = 0;
+	const backend_section* sec = NULL;
+   backend_symbol* sym = backend_get_first_symbol(obj);
+	while (sym)
+	{
+		if (sym->type == SYMBOL_TYPE_FUNCTION)
+		{
+			// each code section has its own sequence
+			if (sym->section != sec)
+			{
+				sec = sym->section;
+				curr = 0;
+			}
+
+			//printf("sym: %s\t\t0x%lx -> 0x%lx\n", sym->name, sym->val, sym->val+sym->size);
+			if (sym->val < curr)
+			{
+				log_warn("Overlap detected @ 0x%lx!\n", sym->val);
+				return -1;
+			}
+			curr = sym->val + sym->size;
+		}
+      sym = backend_get_next_symbol(obj);
+	}
+
+	return 0;
+}
+
+// choose the decoder mode that matches the machine code of the object
+static int decoder_mode(backend_object* obj)
+{
+	backend_type t = backend_get_type(obj);
+	if (t == OBJECT_TYPE_ELF32 || t == OBJECT_TYPE_PE32)
+		return 32;
+	else if (t == OBJECT_TYPE_ELF64)
+		return 64;
+	return 0;
+}
+
+// per-byte state of the code section during function discovery
+#define CODE_COVERED		(1<<0)	// byte belongs to a decoded instruction of some function
+#define CODE_FUNC_START	(1<<1)	// a function starts here
+#define CODE_QUEUED		(1<<2)	// this address is already waiting in the work queue
+#define CODE_KNOWN		(1<<3)	// byte belongs to a function symbol of the input file (gap filling only)
+
+typedef struct discovery
+{
+	backend_section* sec;
+	insn_table* insns;	// grows when a function starts where the linear decode was out of step
+	unsigned char* state;
+	linked_list* queue;	// offsets of function starts that have not been decoded yet
+	code_func* funcs;
+	unsigned int func_count;
+	unsigned int func_max;
+	unsigned int known;	// number of functions taken from the symbol table
+} discovery;
+
+static void queue_function(discovery* d, unsigned long off)
+{
+	if (off >= d->sec->size || d->state[off] & (CODE_FUNC_START | CODE_QUEUED | CODE_KNOWN))
+		return;
+
+	// store off+1 so that offset 0 can't be mistaken for the end of the queue
+	d->state[off] |= CODE_QUEUED;
+	ll_push(d->queue, (void*)(off + 1));
+}
+
+static void add_function(discovery* d, unsigned long start, unsigned long end)
+{
+	if (d->func_count == d->func_max)
+	{
+		d->func_max = d->func_max ? d->func_max * 2 : 64;
+		d->funcs = mem_realloc(MEM_WORK, d->funcs, d->func_max * sizeof(code_func));
+	}
+	d->funcs[d->func_count].start = start;
+	d->funcs[d->func_count].end = end;
+	d->func_count++;
+}
+
+// When filling gaps, a function symbol that has a size is taken as it is. Its code is never walked,
+// and no other function can start inside of it.
+static void add_known_function(discovery* d, unsigned long off, unsigned long size)
+{
+	unsigned long end = off + size;
+	if (end > d->sec->size)
+		end = d->sec->size;
+	if (d->state[off] & CODE_KNOWN)
+		return;
+
+	for (unsigned long b=off; b < end; b++)
+		d->state[b] |= CODE_COVERED | CODE_KNOWN;
+	d->state[off] |= CODE_FUNC_START;
+	add_function(d, off, end);
+	d->known++;
+}
+
+// Walk a single function, starting at 'start' and following the control flow until we reach a
+// terminating instruction (ret, unconditional jmp, etc.) that is not skipped over by any branch
+// inside the function. The target of every 'call' is queued as the start of another function.
+static void decode_function(discovery* d, unsigned long start)
+{
+	insn_table* t = d->insns;
+	backend_section* sec = d->sec;
+	unsigned long limit = start;	// the furthest known branch target inside this function
+	unsigned long end = start;
+
+	// the linear decode may have gone out of sync with the real instruction stream (i.e. data
+	// embedded in the code), in which case the code is decoded again from this address
+	int i = insn_find(t, start);
+	if (i < 0)
+		i = insn_decode_at(t, sec->data, sec->size, start);
+	if (i < 0)
+	{
+		log_warn("Can't decode the function at 0x%lx\n", sec->address + start);
+		return;
+	}
+
+	d->state[start] |= CODE_FUNC_START;
+	while (i >= 0)
+	{
+		unsigned long addr = t->offset[i];
+		long target;
+		int stop = 0;
+
+		// we ran into a function that was already discovered (or is about to be)
+		if (addr != start && d->state[addr] & (CODE_FUNC_START | CODE_QUEUED | CODE_KNOWN))
+			break;
+
+		for (unsigned int b=0; b < t->length[i] && addr + b < sec->size; b++)
+			d->state[addr + b] |= CODE_COVERED;
+		end = addr + t->length[i];
+
+		switch (t->cls[i])
+		{
+		case INSN_CLASS_CALL:
+			target = insn_branch_target(t, i);
+			if (target >= 0)
+				queue_function(d, target);
+			break;
+
+		case INSN_CLASS_JMP:
+			target = insn_branch_target(t, i);
+			if (target >= 0 && (target < start || target >= sec->size || d->state[target] & (CODE_FUNC_START | CODE_QUEUED | CODE_KNOWN)))
+				queue_function(d, target); // tail call
+			else if (target > 0 && target > limit)
+				limit = target;
+			stop = 1;
+			break;
+
+		case INSN_CLASS_JCC:
+			target = insn_branch_target(t, i);
+			if (target > 0 && target > limit)
+				limit = target;
+			break;
+
+		case INSN_CLASS_RET:
+		case INSN_CLASS_INVALID:
+			stop = 1;
+			break;
+		}
+
+		// only stop if nothing inside the function jumps past this point
+		if (stop && end >= limit)
+			break;
+
+		// follow the instructions by address, since the table may have a different idea of where the next one starts
+		if (i + 1 < t->count && t->offset[i + 1] == end)
+			i++;
+		else if ((i = insn_find(t, end)) < 0)
+			i = insn_decode_at(t, sec->data, sec->size, end);
+	}
+
+	add_function(d, start, end);
+}
+
+static void drain_queue(discovery* d)
+{
+	void* val;
+	while ((val = ll_pop(d->queue)))
+	{
+		unsigned long off = (unsigned long)val - 1;
+		d->state[off] &= ~CODE_QUEUED;
+		if (!(d->state[off] & (CODE_FUNC_START | CODE_KNOWN)))
+			decode_function(d, off);
+	}
+}
+
+// Any code that is not reachable from the known entry points (i.e. only called indirectly) is
+// found with a linear sweep of the gaps between discovered functions. Padding is skipped, and the
+// first real instruction is treated as the start of a new function.
+static int sweep_gaps(discovery* d)
+{
+	const insn_table* t = d->insns;
+	unsigned int found = 0;
+
+	for (int i=0; i < (int)t->count; i++)
+	{
+		unsigned long off = t->offset[i];
+		if (d->state[off] & CODE_COVERED)
+			continue;
+
+		if (t->cls[i] == INSN_CLASS_PADDING || t->cls[i] == INSN_CLASS_INVALID || (d->sec->data[off] == 0 && t->length[i] == 1))
+			continue;
+
+		decode_function(d, off);
+		drain_queue(d);
+		found++;
+
+		// decoding may have changed the table, so carry on from the first instruction after this one
+		i = (int)insn_lower_bound(t, off + 1) - 1;
+	}
+
+	return found;
+}
+
+static int cmp_code_func(const void* a, const void* b)
+{
+	const code_func* fa = a;
+	const code_func* fb = b;
+	if (fa->start < fb->start)
+		return -1;
+	return (fa->start > fb->start);
+}
+
+// Discover the functions in the code section by recursive descent. We start from the program entry
+// point, any function symbols we already have, and imports that live in the code section, and follow
+// 'call' targets to find the rest. Only reachable code is walked - any gaps that are left over are
+// covered with a linear sweep. The functions are returned sorted by start address.
+// When filling gaps, only the code that isn't covered by an existing function symbol is walked.
+static int discover_functions(backend_object* obj, insn_table* insns, int fill_gaps, code_func** funcs, unsigned int* count)
+{
+	discovery d = {0};
+
+   /* find the text section */
+   backend_section* sec_text = backend_get_section_by_name(obj, ".text");
+   if (!sec_text)
+      return -ERR_NO_TEXT_SECTION;
+	if (!insns)
+		return -ERR_BAD_FORMAT;
+
+	d.sec = sec_text;
+	d.insns = insns;
+	d.state = mem_calloc(MEM_WORK, sec_text->size + 1, 1);
+	d.queue = ll_init();
+
+	// seed the queue with everything we know to be the start of a function
+	unsigned long entry = backend_get_entry_point(obj);
+	if (entry >= sec_text->address && entry < sec_text->address + sec_text->size)
+		queue_function(&d, entry - sec_text->address);
+
+	backend_symbol* bs = backend_get_first_symbol(obj);
+	while (bs)
+	{
+		if (bs->type == SYMBOL_TYPE_FUNCTION && bs->val >= sec_text->address && bs->val < sec_text->address + sec_text->size)
+		{
+			if (fill_gaps && bs->size)
+				add_known_function(&d, bs->val - sec_text->address, bs->size);
+			else
+				queue_function(&d, bs->val - sec_text->address);
+		}
+		bs = backend_get_next_symbol(obj);
+	}
+
+	for (const list_node* iter=obj->import_table?ll_iter_start(obj->import_table):NULL; iter != NULL; iter=iter->next)
+	{
+		backend_import* mod = iter->val;
+   	for (const list_node* s_iter=ll_iter_start(mod->symbols); s_iter != NULL; s_iter=s_iter->next)
+		{
+			backend_symbol* bs = s_iter->val;
+			if (bs->val >= sec_text->address && bs->val < sec_text->address + sec_text->size)
+				queue_function(&d, bs->val - sec_text->address);
+		}
+	}
+
+	drain_queue(&d);
+	unsigned int swept = sweep_gaps(&d);
+	if (fill_gaps)
+		log_info("%u functions known from symbols, ", d.known);
+	log_info("%u functions found by descent, %u more by sweeping gaps\n", d.func_count - d.known - swept, swept);
+
+	qsort(d.funcs, d.func_count, sizeof(code_func), cmp_code_func);
+	mem_free(MEM_LISTS, d.queue);
+	mem_free(MEM_WORK, d.state);
+
+	*funcs = d.funcs;
+	*count = d.func_count;
+	return 0;
+}
+
+// Create a symbol for each discovered function that doesn't have one yet
+static int reconstruct_symbols(backend_object* obj, const code_func* funcs, unsigned int count, int padding)
+{
+	char name[16];
+
+	log_debug("reconstructing symbols from text section\n");
+   backend_section* sec_text = backend_get_section_by_name(obj, ".text");
+   if (!sec_text)
+      return -ERR_NO_TEXT_SECTION;
+
+	// add a fake symbol for the filename
+	backend_add_symbol(obj, "source.c", 0, SYMBOL_TYPE_FILE, 0, 0, sec_text);
+
+	unsigned int start_count = backend_symbol_count(obj);
+
+	// a function can't extend into the next one (i.e. a call to a function that doesn't return)
+	for (unsigned int i=0; i < count; i++)
+	{
+		unsigned long start = funcs[i].start;
+		unsigned long end = funcs[i].end;
+		unsigned long next = (i+1 < count) ? funcs[i+1].start : sec_text->size;
+		if (end > next || padding)
+			end = next;
+
+		// don't duplicate functions that already have a symbol
+		if (backend_find_symbol_by_val(obj, sec_text->address + start))
+			continue;
+
+		sprintf(name, "fn%06lX", start);
+		backend_add_symbol(obj, name, sec_text->address + start, SYMBOL_TYPE_FUNCTION, end - start, SYMBOL_FLAG_GLOBAL, sec_text);
+	}
+
+	// If we have reconstructed symbols and we want to be able to link again later, the linker is going to
+	// look for a symbol called 'main'. We must rename the symbol at the original entry point to be called main.
+	// This is practically the only symbol that we can recover the name for without major decompiling efforts.
+	backend_symbol* bs = backend_find_symbol_by_val(obj, backend_get_entry_point(obj));
+	if (bs)
+	{
+		log_info("found entry point %s @ 0x%lx - renaming to 'main'\n", bs->name, bs->val);
+		mem_free(MEM_STRINGS, bs->name);
+		bs->name = mem_strdup(MEM_STRINGS, "main");
+	}
+
+	log_info("%u symbols recovered\n", backend_symbol_count(obj) - start_count);
+
+   return 0;
+}
+
+// Decode the code section. Returns NULL if there is no code, or we don't know how to decode it.
+static insn_table* decode_text(backend_object* obj)
+{
+   backend_section* sec_text = backend_get_section_by_name(obj, ".text");
+	int mode = decoder_mode(obj);
+
+	if (!sec_text || !mode)
+		return NULL;
+
+	return insn_decode(sec_text->data, sec_text->size, mode);
+}
+
+static backend_symbol* get_data_section_symbol(backend_object* obj, unsigned long val)
+{
+	char name[14];
+
+	// which data segment does this address belong to?
+	backend_section* sec = backend_get_first_section(obj);
+	while (sec)
+	{
+		if (val >= sec->address && val < sec->address + sec->size)
+		{
+			log_debug("Address 0x%lx is in section %s\n", val, sec->name);
+
+			// should rely on flags, not section name
+			if (sec->flags & SECTION_FLAG_INIT_DATA)
+				log_debug("Section %s has init data\n", sec->name);
+			else if (sec->flags & SECTION_FLAG_UNINIT_DATA)
+				log_debug("Section %s has uninit data\n", sec->name);
+			else
+			{
+				log_debug("Section %s is not a data section\n", sec->name);
+				break;
+			}
+			
+			// now find the symbol that points to this section
+			//printf("Belongs to section %s\n", sec->name);
+			backend_symbol *sym = backend_find_symbol_by_name(obj, sec->name);
+			if (!sym)
+			{
+				log_debug("Creating section symbol %s\n", sec->name);
+				sym = backend_add_symbol(obj, sec->name, 0, SYMBOL_TYPE_SECTION, 0, 0, NULL);
+			}
+			if (!sym)
+				return NULL;
+
+			return sym;
+		}
+		sec = backend_get_next_section(obj);
+	}
+
+	return NULL;
+}
+
+static int cmp_ulong(const void* a, const void* b)
+{
+	unsigned long va = *(const unsigned long*)a;
+	unsigned long vb = *(const unsigned long*)b;
+	if (va < vb)
+		return -1;
+	return (va > vb);
+}
+
+// The start offsets of the functions in the code section, sorted. They come from the discovery pass
+// when it ran, or from the function symbols of the input file.
+static unsigned long* function_starts(backend_object* obj, const backend_section* sec_text, const code_func* funcs, unsigned int func_count, unsigned int* count)
+{
+	unsigned int n = 0;
+	unsigned long* starts;
+
+	if (funcs)
+	{
+		starts = mem_alloc(MEM_WORK, (func_count + 1) * sizeof(unsigned long));
+		if (!starts)
+			return NULL;
+		for (unsigned int i=0; i < func_count; i++)
+			starts[n++] = funcs[i].start;
+		*count = n;
+		return starts;
+	}
+
+	starts = mem_alloc(MEM_WORK, (backend_symbol_count(obj) + 1) * sizeof(unsigned long));
+	if (!starts)
+		return NULL;
+	backend_symbol* bs = backend_get_first_symbol(obj);
+	while (bs)
+	{
+		if (bs->type == SYMBOL_TYPE_FUNCTION && bs->val >= sec_text->address && bs->val < sec_text->address + sec_text->size)
+			starts[n++] = bs->val - sec_text->address;
+		bs = backend_get_next_symbol(obj);
+	}
+	qsort(starts, n, sizeof(unsigned long), cmp_ulong);
+	*count = n;
+	return starts;
+}
+
+// Iterate through all the code to find instructions that reference absolute memory. These addresses
+// are likely to be variables in the data segment or addresses of called functions. Branches inside
+// of a function use relative offsets that stay valid, so they are not included: conditional jumps
+// never leave their function, and an unconditional jump is only a tail call when its target is
+// outside of the function it is in (the function starts are given in 'starts').
+static reloc_site* find_reloc_sites(const backend_section* sec_text, const insn_table* insns, const unsigned long* starts, unsigned int start_count, unsigned int* count)
+{
+	// one more than needed, so an empty table isn't a zero size allocation
+	reloc_site* sites = mem_alloc(MEM_WORK, (insns->count + 1) * sizeof(reloc_site));
+	unsigned int n = 0;
+	unsigned int f = 0;	// index of the first function that starts after the current instruction
+
+	*count = 0;
+	if (!sites)
+		return NULL;
+
+	for (unsigned int i=0; i < insns->count; i++)
+	{
+		reloc_site* site = &sites[n];
+		long target;
+
+		while (f < start_count && starts[f] <= insns->offset[i])
+			f++;
+
+		switch (insns->op_kind[i])
+		{
+		// loading a data address:  mov instruction with a 32-bit immediate
+		case INSN_OP_ABS32:
+			if (insns->cls[i] != INSN_CLASS_MOV)
+				continue;
+			site->target = (unsigned int)insns->operand[i];
+			break;
+
+		// jump through a pointer (i.e. import address table)
+		case INSN_OP_MEM32:
+			site->target = (unsigned int)insns->operand[i];
+			break;
+
+		// callq calls a function with 1 byte opcode and signed 32-bit relative offset
+		case INSN_OP_REL32:
+			// jumps inside of a function stay as they are - only tail calls need a relocation
+			if (insns->cls[i] == INSN_CLASS_JCC)
+				continue;
+
+			// this instruction uses a relative offset, so to get the absolute address, add the:
+			// section base address + current instruction offset + length of current instruction + call offset
+			target = insn_branch_target(insns, i);
+			if (insns->cls[i] == INSN_CLASS_JMP && f > 0 && target > (long)starts[f - 1] &&
+				(f == start_count || target < (long)starts[f]))
+				continue;
+			site->target = sec_text->address + target;
+			break;
+
+		default:
+			continue;
+		}
+
+		site->offset = insns->offset[i] + insns->op_offset[i]; // offset of the operand
+		site->kind = insns->op_kind[i];
+		site->cls = insns->cls[i];
+		site->reserved = 0;
+		n++;
+	}
+
+	*count = n;
+	return sites;
+}
+
+// For each reference to an absolute address, we want to replace the absolute value with 0, and create
+// a relocation in its place which points to a symbol. Some relocations may already exist if the symbol
+// was dynamically linked (.so, .dll, etc.). In that case, the relocation should have already been
+// updated to point to the correct symbol, and we may use it as is. For statically linked functions,
+// we must create a new relocation and point it to the correct symbol.
+static int build_relocations(backend_object* obj, const reloc_site* sites, unsigned int count)
+{
+	backend_section* sec_text;
+	backend_section* sec;
+
+	log_debug("Building relocations\n");
+
+   /* find the text section */
+   sec_text = backend_get_section_by_name(obj, ".text");
+   if (!sec_text)
+      return -ERR_NO_TEXT_SECTION;
+	if (!sites)
+		return -ERR_BAD_FORMAT;
+
+	for (unsigned int i=0; i < count; i++)
+	{
+		unsigned int offset = sites[i].offset;
+		unsigned int* val_ptr = (unsigned int*)(sec_text->data + offset);
+		unsigned long val = sites[i].target;
+		backend_symbol *bs=NULL;
+
+		if (offset + sizeof(unsigned int) > sec_text->size)
+			continue;
+
+		if (sites[i].kind == INSN_OP_ABS32)
+		{
+			sec = backend_find_section_by_val(obj, val);
+			if (!sec)
+				continue;
+
+			//printf("Found mov @ 0x%x addr:0x%lx\n", offset, val);
+			if (strcmp(sec->name, ".text") == 0)
+			{
+				bs = backend_find_symbol_by_val(obj, val);
+				if (!bs)
+					log_warn("Can't find function 0x%lx\n", val);
+				else
+					backend_add_relocation(obj, offset, RELOC_TYPE_OFFSET, val - bs->val, bs);
+			}
+			else if ((sec->flags & SECTION_FLAG_INIT_DATA) || (sec->flags & SECTION_FLAG_UNINIT_DATA))
+			{
+				// make sure this is a data section
+				bs = backend_find_symbol_by_name(obj, sec->name);
+				if (!bs)
+				{
+					//printf("Creating section symbol %s\n", sec->name);
+					bs = backend_add_symbol(obj, sec->name, 0, SYMBOL_TYPE_SECTION, 0, 0, NULL);
+				}
+				if (bs)
+					backend_add_relocation(obj, offset, RELOC_TYPE_OFFSET, val - sec->address, bs);
+				else
+					log_warn("can't find section symbol for %s\n", sec->name);
+			}
+			if (bs)
+				*val_ptr = 0;
+			continue;
+		}
+
+		//printf("Found call @ 0x%x to 0x%lx\n", offset, val);
+
+		// now we can look up this absolute address in the symbol table to see which static function is called
+		bs = backend_find_symbol_by_val(obj, val);
+		if (bs && bs->type != SYMBOL_TYPE_FUNCTION)
+			bs = NULL;
+		if (!bs && backend_find_section_by_val(obj, val))
+		{
+			//printf("Address 0x%lx is in section %s\n", val, sec->name);
+			bs = backend_find_import_by_address(obj, val);
+			if (bs)
+			{
+				log_debug("Found import symbol %s\n", bs->name);
+				bs = backend_find_symbol_by_name(obj, bs->name);
+			}
+		}
+		if (bs)
+		{
+			//printf("Adding reloc offset=%x sym=%s\n", offset, bs->name);
+			backend_add_relocation(obj, offset, RELOC_TYPE_PC_RELATIVE, -4, bs);
+			*val_ptr = 0;
+		}
+	}
+
+	log_debug("Done building relocations\n");
+	return 0;
+}
+
+// Everything the analysis passes learn about the code section. It either comes from decoding
+// the instructions, or from a previous run through the decode cache.
+typedef struct code_analysis
+{
+	const code_func* funcs;
+	unsigned int func_count;
+	const reloc_site* sites;
+	unsigned int site_count;
+	code_func* own_funcs;	// buffers that must be freed (when not mapped from the cache)
+	reloc_site* own_sites;
+	decode_cache cache;
+} code_analysis;
+
+// The cache key covers everything the analysis depends on: the code bytes (before any relocations
+// are applied), where the code is loaded, the decoder mode, and the addresses that seed the function
+// discovery (the entry point and existing function symbols, with their sizes when filling gaps).
+static unsigned long cache_key(backend_object* obj, const backend_section* sec_text)
+{
+	unsigned long params[4] = { sec_text->address, backend_get_entry_point(obj), decoder_mode(obj), config.fill_gaps };
+	unsigned long h = hash_buffer(sec_text->data, sec_text->size, HASH_INIT);
+	h = hash_buffer(params, sizeof(params), h);
+
+	backend_symbol* bs = backend_get_first_symbol(obj);
+	while (bs)
+	{
+		if (bs->type == SYMBOL_TYPE_FUNCTION)
+		{
+			h = hash_buffer(&bs->val, sizeof(bs->val), h);
+			if (config.fill_gaps)
+				h = hash_buffer(&bs->size, sizeof(bs->size), h);
+		}
+		bs = backend_get_next_symbol(obj);
+	}
+
+	return h;
+}
+
+static int analyze_code(backend_object* obj, int want_funcs, code_analysis* a)
+{
+	unsigned long key = 0;
+	trace_span span;
+
+	memset(a, 0, sizeof(code_analysis));
+   backend_section* sec_text = backend_get_section_by_name(obj, ".text");
+   if (!sec_text)
+      return -ERR_NO_TEXT_SECTION;
+	if (!decoder_mode(obj))
+		return -ERR_BAD_FORMAT;
+
+	if (cache_enabled(config.cache_dir))
+	{
+		trace_begin(&span);
+		key = cache_key(obj, sec_text);
+		int found = (cache_lookup(config.cache_dir, key, &a->cache) == 0);
+		trace_end(&span, "cache_lookup", NULL, "bytes", sec_text->size, "hit", (unsigned long)found, NULL);
+		if (found)
+		{
+			if (!want_funcs || a->cache.funcs)
+			{
+				log_info("Using cached analysis %016lx\n", key);
+				a->funcs = a->cache.funcs;
+				a->func_count = a->cache.func_count;
+				a->sites = a->cache.sites;
+				a->site_count = a->cache.site_count;
+				return 0;
+			}
+			cache_release(&a->cache);
+		}
+	}
+
+	// the code is decoded only once, and the instructions are shared by all of the analysis passes
+	trace_begin(&span);
+	insn_table* insns = decode_text(obj);
+	if (!insns)
+		return -ERR_BAD_FORMAT;
+	trace_end(&span, "decode", NULL, "bytes", sec_text->size, "instructions", (unsigned long)insns->count, NULL);
+
+	if (want_funcs)
+	{
+		trace_begin(&span);
+		discover_functions(obj, insns, config.fill_gaps, &a->own_funcs, &a->func_count);
+		trace_end(&span, "discover_functions", NULL, "functions", (unsigned long)a->func_count, NULL);
+	}
+	trace_begin(&span);
+	unsigned int start_count = 0;
+	unsigned long* starts = function_starts(obj, sec_text, a->own_funcs, a->func_count, &start_count);
+	if (starts)
+		a->own_sites = find_reloc_sites(sec_text, insns, starts, start_count, &a->site_count);
+	mem_free(MEM_WORK, starts);
+	trace_end(&span, "find_reloc_sites", NULL, "sites", (unsigned long)a->site_count, NULL);
+	insn_free(insns);
+	if (!a->own_sites)
+		return -ERR_BAD_FORMAT;
+
+	a->funcs = a->own_funcs;
+	a->sites = a->own_sites;
+
+	if (cache_enabled(config.cache_dir))
+	{
+		trace_begin(&span);
+		cache_store(config.cache_dir, key, a->funcs, a->func_count, a->sites, a->site_count);
+		trace_end(&span, "cache_store", NULL, "functions", (unsigned long)a->func_count, "sites", (unsigned long)a->site_count, NULL);
+	}
+
+	return 0;
+}
+
+static void release_analysis(code_analysis* a)
+{
+	cache_release(&a->cache);
+	mem_free(MEM_WORK, a->own_funcs);
+	mem_free(MEM_WORK, a->own_sites);
+	memset(a, 0, sizeof(code_analysis));
+}
+
+// State for incremental mode. Every function is hashed after its relocation operands have been
+// zeroed, so only real changes to the code (or to the data it refers to) change the hash.
+typedef struct incremental
+{
+	manifest* prev;	// manifest from the previous run
+	manifest* next;	// manifest being built by this run
+	backend_reloc** relocs;	// relocations of the input file, sorted by offset
+	unsigned int reloc_count;
+	backend_section* data_sec[16];	// content hashes of the data sections that were seen so far
+	unsigned long data_hash[16];
+	unsigned int data_count;
+	unsigned long unit_hash;	// hash of the output object that is being built
+	unsigned int objects;
+	unsigned int unchanged;
+	unsigned int changed_funcs;
+} incremental;
+
+static int cmp_reloc_offset(const void* a, const void* b)
+{
+	const backend_reloc* ra = *(const backend_reloc**)a;
+	const backend_reloc* rb = *(const backend_reloc**)b;
+	if (ra->offset < rb->offset)
+		return -1;
+	return (ra->offset > rb->offset);
+}
+
+static incremental* incremental_init(backend_object* obj, const char* filename)
+{
+	incremental* inc = mem_calloc(MEM_WORK, 1, sizeof(incremental));
+	inc->prev = manifest_load(filename);
+	inc->next = manifest_init();
+
+	inc->relocs = mem_alloc(MEM_WORK, backend_relocation_count(obj) * sizeof(backend_reloc*) + 1);
+	backend_reloc* r = backend_get_first_reloc(obj);
+	while (r)
+	{
+		inc->relocs[inc->reloc_count++] = r;
+		r = backend_get_next_reloc(obj);
+	}
+	qsort(inc->relocs, inc->reloc_count, sizeof(backend_reloc*), cmp_reloc_offset);
+
+	return inc;
+}
+
+static unsigned long hash_data_section(incremental* inc, backend_section* sec)
+{
+	for (unsigned int i=0; i < inc->data_count; i++)
+		if (inc->data_sec[i] == sec)
+			return inc->data_hash[i];
+
+	unsigned long h = hash_buffer(&sec->size, sizeof(sec->size), HASH_INIT);
+	if (sec->data)
+		h = hash_buffer(sec->data, sec->size, h);
+
+	if (inc->data_count < sizeof(inc->data_sec)/sizeof(inc->data_sec[0]))
+	{
+		inc->data_sec[inc->data_count] = sec;
+		inc->data_hash[inc->data_count++] = h;
+	}
+	return h;
+}
+
+// the alignment that a function had in the input file, up to the alignment of its section
+static unsigned int function_alignment(const backend_section* in, unsigned long addr)
+{
+	unsigned int align = in->alignment ? in->alignment : 1;
+	while (align > 1 && addr % align)
+		align >>= 1;
+	return align;
+}
+
+// hash everything that ends up in the output object for this function: its name, code and relocations,
+// and the alignment it keeps in the output, since that decides the padding in front of it
+static unsigned long hash_function(incremental* inc, backend_object* obj, backend_symbol* sym)
+{
+	unsigned long h = hash_buffer(sym->name, strlen(sym->name) + 1, HASH_INIT);
+	h = hash_buffer(&sym->size, sizeof(sym->size), h);
+
+	backend_section* sec = sym->section;
+	if (!sec || !sym->size || sym->val < sec->address || sym->val + sym->size > sec->address + sec->size)
+		return h;
+
+	unsigned int align = function_alignment(sec, sym->val);
+	h = hash_buffer(&align, sizeof(align), h);
+
+	unsigned long start = sym->val - sec->address;
+	unsigned long end = start + sym->size;
+	if (sec->data)
+		h = hash_buffer(sec->data + start, sym->size, h);
+
+	// find the first relocation inside of the function
+	unsigned int lo = 0, hi = inc->reloc_count;
+	while (lo < hi)
+	{
+		unsigned int mid = (lo + hi) / 2;
+		if (inc->relocs[mid]->offset < start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (unsigned int i=lo; i < inc->reloc_count && inc->relocs[i]->offset < end; i++)
+	{
+		backend_reloc* r = inc->relocs[i];
+		long fields[5] = { r->offset - start, r->addend, r->type, 0, 0 };
+		backend_section* target = NULL;
+
+		if (r->symbol)
+		{
+			fields[3] = r->symbol->type;
+			h = hash_buffer(r->symbol->name, strlen(r->symbol->name) + 1, h);
+			if (r->symbol->type == SYMBOL_TYPE_OBJECT)
+			{
+				target = r->symbol->section;
+				if (target)
+					fields[4] = r->symbol->val - target->address;
+			}
+			else if (r->symbol->type == SYMBOL_TYPE_SECTION)
+				target = backend_get_section_by_name(obj, r->symbol->name);
+		}
+		h = hash_buffer(fields, sizeof(fields), h);
+
+		// the data sections referenced by the function are copied into the output object as well
+		// (unless they are shared, in which case they are checked separately)
+		if (target && !config.shared_data)
+		{
+			unsigned long dh = hash_data_section(inc, target);
+			h = hash_buffer(&dh, sizeof(dh), h);
+		}
+	}
+
+	return h;
+}
+
+static void incremental_finish(incremental* inc, const char* filename)
+{
+	log_info("%u of %u objects unchanged, %u functions changed\n", inc->unchanged, inc->objects, inc->changed_funcs);
+	manifest_save(inc->next, filename);
+	manifest_free(inc->prev);
+	manifest_free(inc->next);
+	mem_free(MEM_WORK, inc->relocs);
+	mem_free(MEM_WORK, inc);
+}
+
+backend_object* set_up_output_file(backend_object* src, const char* filename, backend_type t)
+{
+	backend_object* oo = backend_create();
+	if (!oo)
+		return NULL;
+
+	log_info("=== Opening file %s\n", filename);
+	backend_set_type(oo, t);
+
+	// add a symbol representing the file
+	backend_add_symbol(oo, filename, 0, SYMBOL_TYPE_FILE, 0, 0, NULL);
+
+	return oo;
+}
+
+// A compilation unit is the group of functions that are written to a single output object
+typedef struct comp_unit
+{
+	char* filename;				// name of the output object
+	char* path;						// where it is written (in the output directory)
+	backend_symbol** funcs;		// function symbols of the input file that belong to this unit
+	unsigned int func_count;
+	unsigned int func_max;
+	backend_reloc** relocs;		// relocations of the input file inside of these functions, sorted by offset
+	unsigned int reloc_count;
+	unsigned int reloc_max;
+	unsigned long code_start;	// range of the code section (offsets) covered by these functions
+	unsigned long code_end;
+	unsigned long code_size;	// total size of the functions, which is what the output object holds
+} comp_unit;
+
+// the code range of a single function, and the unit that owns it
+typedef struct func_range
+{
+	unsigned long start;
+	unsigned long end;
+	comp_unit* unit;
+} func_range;
+
+// Maps the symbols of the input file to the matching symbols of an output file. It is a small open
+// addressing hash table keyed by the address of the input symbol.
+typedef struct symbol_map
+{
+	const backend_symbol** src;
+	backend_symbol** dest;
+	unsigned int mask;
+} symbol_map;
+
+static void symbol_map_init(symbol_map* m, unsigned int count)
+{
+	unsigned int size = 16;
+	while (size < count * 2)
+		size *= 2;
+
+	m->src = mem_calloc(MEM_WORK, size, sizeof(backend_symbol*));
+	m->dest = mem_calloc(MEM_WORK, size, sizeof(backend_symbol*));
+	m->mask = size - 1;
+}
+
+static unsigned int symbol_map_slot(const symbol_map* m, const backend_symbol* src)
+{
+	unsigned int i = (((unsigned long)src >> 4) * 2654435761u) & m->mask;
+	while (m->src[i] && m->src[i] != src)
+		i = (i + 1) & m->mask;
+	return i;
+}
+
+static void symbol_map_set(symbol_map* m, const backend_symbol* src, backend_symbol* dest)
+{
+	unsigned int i = symbol_map_slot(m, src);
+	m->src[i] = src;
+	m->dest[i] = dest;
+}
+
+static backend_symbol* symbol_map_get(const symbol_map* m, const backend_symbol* src)
+{
+	unsigned int i = symbol_map_slot(m, src);
+	return m->src[i] ? m->dest[i] : NULL;
+}
+
+static void symbol_map_free(symbol_map* m)
+{
+	mem_free(MEM_WORK, m->src);
+	mem_free(MEM_WORK, m->dest);
+}
+
+static void unit_add_function(comp_unit* u, backend_symbol* sym, const backend_section* sec_text)
+{
+	if (u->func_count == u->func_max)
+	{
+		u->func_max = u->func_max ? u->func_max * 2 : 16;
+		u->funcs = mem_realloc(MEM_WORK, u->funcs, u->func_max * sizeof(backend_symbol*));
+	}
+	u->funcs[u->func_count++] = sym;
+
+	if (!sec_text || sym->section != sec_text || !sym->size)
+		return;
+
+	unsigned long start = sym->val - sec_text->address;
+	u->code_size += sym->size;
+	if (u->code_end == 0 || start < u->code_start)
+		u->code_start = start;
+	if (start + sym->size > u->code_end)
+		u->code_end = start + sym->size;
+}
+
+static void unit_add_reloc(comp_unit* u, backend_reloc* r)
+{
+	if (u->reloc_count == u->reloc_max)
+	{
+		u->reloc_max = u->reloc_max ? u->reloc_max * 2 : 16;
+		u->relocs = mem_realloc(MEM_WORK, u->relocs, u->reloc_max * sizeof(backend_reloc*));
+	}
+	u->relocs[u->reloc_count++] = r;
+}
+
+// Divide the functions of the input file into compilation units. Each file symbol (i.e. foo.c) starts
+// a new unit, which owns all of the function symbols that follow it.
+static int cmp_unit_name(const void* a, const void* b)
+{
+	const comp_unit* ua = *(const comp_unit**)a;
+	const comp_unit* ub = *(const comp_unit**)b;
+	int ret = strcmp(ua->filename, ub->filename);
+	if (ret)
+		return ret;
+	return (ua > ub) - (ua < ub);
+}
+
+// Units with the same file name (that are not next to each other in the symbol table) would write
+// to the same output file, so the second and later ones get the number of their place in the list
+// added to the name (i.e. util.o and util.12.o).
+static void name_duplicate_units(comp_unit* units, unsigned int count)
+{
+	if (count < 2)
+		return;
+
+	comp_unit** sorted = mem_alloc(MEM_WORK, sizeof(comp_unit*) * count);
+	for (unsigned int i=0; i < count; i++)
+		sorted[i] = &units[i];
+	qsort(sorted, count, sizeof(comp_unit*), cmp_unit_name);
+
+	// rename from the end, so each unit is still compared with the original name of the one before it
+	for (unsigned int i=count-1; i > 0; i--)
+	{
+		comp_unit* u = sorted[i];
+		if (strcmp(u->filename, sorted[i-1]->filename))
+			continue;
+
+		unsigned long len = strlen(u->filename) + 16;
+		char* name = mem_alloc(MEM_STRINGS, len);
+		snprintf(name, len, "%.*s.%u.o", (int)strlen(u->filename) - 2, u->filename, (unsigned int)(u - units));
+		log_info("Found another file named %s - writing it as %s\n", u->filename, name);
+		mem_free(MEM_STRINGS, u->filename);
+		u->filename = name;
+	}
+	mem_free(MEM_WORK, sorted);
+}
+
+static comp_unit* build_units(backend_object* obj, unsigned int* count)
+{
+	comp_unit* units = NULL;
+	comp_unit* u = NULL;
+	unsigned int max = 0;
+	int len;
+
+	*count = 0;
+	backend_section* sec_text = backend_get_section_by_name(obj, ".text");
+	backend_symbol* sym = backend_get_first_symbol(obj);
+	while (sym)
+	{
+		switch (sym->type)
+		{
+		case SYMBOL_TYPE_FILE:
+			// if the symbol name ends in .c open a corresponding .o for it
+			// I have also seen "ghost" files with no name, for no apparent reason
+			len = strlen(sym->name);
+			if (len < 2 || sym->name[len-2] != '.' || sym->name[len-1] != 'c')
+				break;
+
+			// I have seen the case where the same filename was present more than once (consecutively)
+			if (u && strncmp(sym->name, u->filename, len-1) == 0)
+				break;
+
+			if (*count == max)
+			{
+				max = max ? max * 2 : 16;
+				units = mem_realloc(MEM_WORK, units, max * sizeof(comp_unit));
+			}
+			u = &units[(*count)++];
+			memset(u, 0, sizeof(comp_unit));
+			u->filename = mem_strdup(MEM_STRINGS, sym->name);
+			u->filename[len-1] = 'o';
+			break;
+
+		case SYMBOL_TYPE_FUNCTION:
+			// skip any symbol that starts with an underscore
+			if (sym->name[0] == '_')
+				break;
+
+			// functions that come before the first file symbol don't belong to any output file
+			if (!u)
+				break;
+
+			unit_add_function(u, sym, sec_text);
+			break;
+		}
+
+		sym = backend_get_next_symbol(obj);
+	}
+
+	name_duplicate_units(units, *count);
+	return units;
+}
+
+// the path of an output file - in the output directory, if there is one
+static char* output_path(const char* output_dir, const char* name)
+{
+	if (!output_dir || name[0] == '/')
+		return mem_strdup(MEM_STRINGS, name);
+
+	char* path = mem_alloc(MEM_STRINGS, strlen(output_dir) + strlen(name) + 2);
+	sprintf(path, "%s/%s", output_dir, name);
+	return path;
+}
+
+static void free_units(comp_unit* units, unsigned int count)
+{
+	for (unsigned int i=0; i < count; i++)
+	{
+		mem_free(MEM_STRINGS, units[i].filename);
+		mem_free(MEM_STRINGS, units[i].path);
+		mem_free(MEM_WORK, units[i].funcs);
+		mem_free(MEM_WORK, units[i].relocs);
+	}
+	mem_free(MEM_WORK, units);
+}
+
+static int cmp_func_range(const void* a, const void* b)
+{
+	const func_range* ra = a;
+	const func_range* rb = b;
+	if (ra->start < rb->start)
+		return -1;
+	return (ra->start > rb->start);
+}
+
+// Give every relocation of the input file to the unit that owns the function it is in. The function
+// ranges and the relocations are both sorted by address, so they can be matched in a single pass.
+static void partition_relocations(backend_object* obj, comp_unit* units, unsigned int count)
+{
+	backend_section* sec_text = backend_get_section_by_name(obj, ".text");
+	if (!sec_text)
+		return;
+
+	unsigned int range_count = 0;
+	for (unsigned int i=0; i < count; i++)
+		range_count += units[i].func_count;
+
+	func_range* ranges = mem_alloc(MEM_WORK, range_count * sizeof(func_range) + 1);
+	range_count = 0;
+	for (unsigned int i=0; i < count; i++)
+	{
+		for (unsigned int f=0; f < units[i].func_count; f++)
+		{
+			backend_symbol* sym = units[i].funcs[f];
+			if (sym->section != sec_text || !sym->size)
+				continue;
+			ranges[range_count].start = sym->val - sec_text->address;
+			ranges[range_count].end = ranges[range_count].start + sym->size;
+			ranges[range_count].unit = &units[i];
+			range_count++;
+		}
+	}
+	qsort(ranges, range_count, sizeof(func_range), cmp_func_range);
+
+	unsigned int reloc_count = 0;
+	backend_reloc** relocs = mem_alloc(MEM_WORK, backend_relocation_count(obj) * sizeof(backend_reloc*) + 1);
+	backend_reloc* r = backend_get_first_reloc(obj);
+	while (r)
+	{
+		relocs[reloc_count++] = r;
+		r = backend_get_next_reloc(obj);
+	}
+	qsort(relocs, reloc_count, sizeof(backend_reloc*), cmp_reloc_offset);
+
+	unsigned int f = 0;
+	for (unsigned int i=0; i < reloc_count && f < range_count; i++)
+	{
+		r = relocs[i];
+		while (f < range_count && ranges[f].end <= r->offset)
+			f++;
+		if (f == range_count)
+			break;
+
+		// relocations that are not inside of any function (or have no symbol) are dropped
+		if (r->offset < ranges[f].start || !r->symbol)
+			continue;
+
+		unit_add_reloc(ranges[f].unit, r);
+	}
+
+	mem_free(MEM_WORK, relocs);
+	mem_free(MEM_WORK, ranges);
+}
+
+// The data object exports a global symbol at the start of each data section (i.e. __anchor_data for
+// .data), which the other objects refer to instead of having their own copy of the section.
+static void anchor_name(char* name, unsigned int len, const char* section)
+{
+	snprintf(name, len, "__anchor_%s", section[0] == '.' ? section + 1 : section);
+	for (char* c=name; *c; c++)
+		if (*c == '.')
+			*c = '_';
+}
+
+// returns the external anchor symbol in an output object, for a data section of the input file
+static backend_symbol* add_anchor_reference(backend_object* dest, const backend_section* target)
+{
+	char name[256];
+
+	anchor_name(name, sizeof(name), target->name);
+	backend_symbol* sym = backend_find_symbol_by_name(dest, name);
+	if (!sym)
+		sym = backend_add_symbol(dest, name, 0, SYMBOL_TYPE_NONE, 0, SYMBOL_FLAG_GLOBAL | SYMBOL_FLAG_EXTERNAL, NULL);
+	return sym;
+}
+
+// Which data section (and offset in it) a relocation refers to. Returns NULL if it isn't a data reference.
+static backend_section* reloc_data_target(backend_object* obj, const backend_reloc* r, unsigned long* off)
+{
+	backend_section* sec = NULL;
+
+	if (r->symbol->type == SYMBOL_TYPE_SECTION)
+	{
+		sec = backend_get_section_by_name(obj, r->symbol->name);
+		*off = r->addend;
+	}
+	else if (r->symbol->type == SYMBOL_TYPE_OBJECT && r->symbol->section)
+	{
+		sec = r->symbol->section;
+		*off = r->symbol->val - sec->address + r->addend;
+	}
+
+	if (sec && !(sec->flags & (SECTION_FLAG_INIT_DATA | SECTION_FLAG_UNINIT_DATA)))
+		return NULL;
+	return sec;
+}
+
+// Data symbols don't have a size, so the only thing we know about the size of a referenced object is
+// that it ends where the next data symbol starts. These are the offsets of all data symbols in one
+// data section, sorted.
+typedef struct data_bounds
+{
+	backend_section* sec;
+	unsigned long* offset;
+	unsigned int count;
+} data_bounds;
+
+typedef struct data_layout
+{
+	data_bounds* secs;
+	unsigned int count;
+} data_layout;
+
+// a part of an input data section that is copied into an output object
+typedef struct data_slice
+{
+	backend_section* sec;
+	unsigned long start;	// offsets in the input section
+	unsigned long end;
+	unsigned long out;	// offset in the output section
+} data_slice;
+
+typedef struct unit_slices
+{
+	data_slice* slice;
+	unsigned int count;
+	unsigned int max;
+} unit_slices;
+
+static int cmp_offset(const void* a, const void* b)
+{
+	unsigned long oa = *(const unsigned long*)a;
+	unsigned long ob = *(const unsigned long*)b;
+	if (oa < ob)
+		return -1;
+	return (oa > ob);
+}
+
+static data_bounds* find_bounds(const data_layout* layout, const backend_section* sec)
+{
+	for (unsigned int i=0; i < layout->count; i++)
+		if (layout->secs[i].sec == sec)
+			return &layout->secs[i];
+	return NULL;
+}
+
+static data_layout* build_data_layout(backend_object* obj)
+{
+	data_layout* layout = mem_calloc(MEM_WORK, 1, sizeof(data_layout));
+	layout->secs = mem_calloc(MEM_WORK, backend_section_count(obj) + 1, sizeof(data_bounds));
+
+	backend_section* sec = backend_get_first_section(obj);
+	while (sec)
+	{
+		if (sec->flags & (SECTION_FLAG_INIT_DATA | SECTION_FLAG_UNINIT_DATA))
+			layout->secs[layout->count++].sec = sec;
+		sec = backend_get_next_section(obj);
+	}
+
+	// count the data symbols in each section, and then fill in their offsets
+	for (int pass=0; pass < 2; pass++)
+	{
+		backend_symbol* sym = backend_get_first_symbol(obj);
+		while (sym)
+		{
+			data_bounds* b = (sym->type == SYMBOL_TYPE_OBJECT && sym->section) ? find_bounds(layout, sym->section) : NULL;
+			if (b && sym->val >= b->sec->address && sym->val < b->sec->address + b->sec->size)
+			{
+				if (pass)
+					b->offset[b->count] = sym->val - b->sec->address;
+				b->count++;
+			}
+			sym = backend_get_next_symbol(obj);
+		}
+
+		for (unsigned int i=0; i < layout->count; i++)
+		{
+			data_bounds* b = &layout->secs[i];
+			if (pass)
+			{
+				qsort(b->offset, b->count, sizeof(unsigned long), cmp_offset);
+				continue;
+			}
+			b->offset = mem_alloc(MEM_WORK, (b->count + 1) * sizeof(unsigned long));
+			b->count = 0;
+		}
+	}
+
+	return layout;
+}
+
+static void free_data_layout(data_layout* layout)
+{
+	if (!layout)
+		return;
+	for (unsigned int i=0; i < layout->count; i++)
+		mem_free(MEM_WORK, layout->secs[i].offset);
+	mem_free(MEM_WORK, layout->secs);
+	mem_free(MEM_WORK, layout);
+}
+
+static int cmp_slice(const void* a, const void* b)
+{
+	const data_slice* sa = a;
+	const data_slice* sb = b;
+	if (sa->sec != sb->sec)
+		return (sa->sec < sb->sec) ? -1 : 1;
+	if (sa->start < sb->start)
+		return -1;
+	return (sa->start > sb->start);
+}
+
+// Find the parts of the data sections that a unit refers to. Each referenced address is extended to
+// the data symbols around it (or the whole section, if it has no data symbols). The slices are packed
+// together in the output section, but keep their alignment.
+static void slice_data(const data_layout* layout, backend_object* obj, const comp_unit* u, unit_slices* s)
+{
+	s->count = 0;
+	for (unsigned int i=0; i < u->reloc_count; i++)
+	{
+		unsigned long off;
+		backend_section* sec = reloc_data_target(obj, u->relocs[i], &off);
+		data_bounds* b = sec ? find_bounds(layout, sec) : NULL;
+		if (!b || !sec->size)
+			continue;
+
+		// a pointer to the end of an object belongs to that object
+		if (off >= sec->size)
+			off = sec->size - 1;
+
+		if (s->count == s->max)
+		{
+			s->max = s->max ? s->max * 2 : 16;
+			s->slice = mem_realloc(MEM_WORK, s->slice, s->max * sizeof(data_slice));
+		}
+		data_slice* d = &s->slice[s->count++];
+		d->sec = sec;
+		d->start = 0;
+		d->end = sec->size;
+
+		// find the first symbol after the referenced offset
+		unsigned int lo = 0, hi = b->count;
+		while (lo < hi)
+		{
+			unsigned int mid = (lo + hi) / 2;
+			if (b->offset[mid] <= off)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo > 0)
+			d->start = b->offset[lo - 1];
+		if (lo < b->count)
+			d->end = b->offset[lo];
+	}
+
+	if (!s->count)
+		return;
+
+	// merge the slices that overlap, and lay them out in the output sections
+	qsort(s->slice, s->count, sizeof(data_slice), cmp_slice);
+	unsigned int n = 0;
+	unsigned long out = 0;
+	for (unsigned int i=0; i < s->count; i++)
+	{
+		data_slice* d = &s->slice[i];
+		if (n && s->slice[n-1].sec == d->sec && d->start <= s->slice[n-1].end)
+		{
+			if (d->end > s->slice[n-1].end)
+				s->slice[n-1].end = d->end;
+			continue;
+		}
+
+		if (!n || s->slice[n-1].sec != d->sec)
+			out = 0;
+		else
+			out = s->slice[n-1].out + s->slice[n-1].end - s->slice[n-1].start;
+
+		// keep the same alignment as the original data
+		unsigned long align = d->sec->alignment > DATA_SLICE_ALIGN ? d->sec->alignment : DATA_SLICE_ALIGN;
+		out += (d->start - out) & (align - 1);
+
+		s->slice[n] = *d;
+		s->slice[n].out = out;
+		n++;
+	}
+	s->count = n;
+}
+
+// where a data offset of the input section ends up in the output section, or -1 if it wasn't copied
+static long slice_map_offset(const unit_slices* s, const backend_section* sec, unsigned long off)
+{
+	for (unsigned int i=0; i < s->count; i++)
+	{
+		const data_slice* d = &s->slice[i];
+		if (d->sec == sec && off >= d->start && off <= d->end)
+			return d->out + off - d->start;
+	}
+	return -1;
+}
+
+// copy the slices into the output sections (which were created by copy_relocations)
+static void copy_data_slices(const unit_slices* s, backend_object* dest)
+{
+	unsigned int i = 0;
+	while (i < s->count)
+	{
+		backend_section* insec = s->slice[i].sec;
+		unsigned int first = i;
+		while (i < s->count && s->slice[i].sec == insec)
+			i++;
+		const data_slice* last = &s->slice[i-1];
+
+		backend_section* outsec = backend_get_section_by_name(dest, insec->name);
+		if (!outsec)
+			continue;
+
+		outsec->size = last->out + last->end - last->start;
+		outsec->flags = insec->flags;
+		outsec->alignment = insec->alignment > DATA_SLICE_ALIGN ? insec->alignment : DATA_SLICE_ALIGN;
+		log_debug("Copying %u slices of %s (%u of %u bytes)\n", i - first, insec->name, outsec->size, insec->size);
+
+		// uninitialized data has no contents
+		if (!insec->data || insec->flags & SECTION_FLAG_UNINIT_DATA)
+			continue;
+
+		outsec->data = mem_calloc(MEM_DATA, outsec->size, 1);
+		for (unsigned int j=first; j < i; j++)
+			memcpy(outsec->data + s->slice[j].out, insec->data + s->slice[j].start, s->slice[j].end - s->slice[j].start);
+	}
+}
+
+// Where a range of the input code ends up in the output object. Normally the functions of a unit are
+// packed into a single .text section, but with function sections each function has its own.
+typedef struct code_placement
+{
+	unsigned long start;		// range of the input code section (offsets)
+	unsigned long end;
+	backend_section* sec;	// the output section that holds this range
+	unsigned long out;		// offset of the range in the output section
+} code_placement;
+
+typedef struct unit_code
+{
+	code_placement* place;	// sorted by start
+	unsigned int count;
+} unit_code;
+
+static int cmp_placement(const void* a, const void* b)
+{
+	const code_placement* pa = a;
+	const code_placement* pb = b;
+	if (pa->start < pb->start)
+		return -1;
+	return (pa->start > pb->start);
+}
+
+// the placement that holds an offset of the input code section, or NULL
+static const code_placement* find_placement(const unit_code* code, unsigned long offset)
+{
+	unsigned int lo = 0, hi = code->count;
+	while (lo < hi)
+	{
+		unsigned int mid = (lo + hi) / 2;
+		if (code->place[mid].start <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == 0 || offset >= code->place[lo-1].end)
+		return NULL;
+	return &code->place[lo-1];
+}
+
+// The section that holds a single function. COFF groups sections by the part of the name before a '$'
+// (like .text$foo) while ELF linkers use the part before the second '.' (like .text.foo).
+static void function_section_name(char* name, unsigned int len, const char* func, backend_type target)
+{
+	int coff = (target == OBJECT_TYPE_PE32 || target == OBJECT_TYPE_PE_ROM || target == OBJECT_TYPE_PE32PLUS);
+	snprintf(name, len, ".text%c%s", coff ? '$' : '.', func);
+}
+
+// We set up relocations in the source file when it is read in, since that is when we have all of the
+// relevant information available. Once the symbols & code are divided into separate object files, it
+// is much harder to reconcile jumps between various files since the base addresses are all reset to
+// 0. That means when we write out the individual object files, we must copy any relevant relocation
+// information that was set up in the input file. The relocations were already divided up between the
+// units, and the symbol map tells us which output symbol each input symbol has become.
+static int copy_relocations(backend_object* src, backend_object* dest, const comp_unit* u, const unit_code* code, symbol_map* map, const unit_slices* slices)
+{
+	backend_symbol *sym;
+	backend_section* sec;
+
+	log_debug("Copy relocations - unit has %u\n", u->reloc_count);
+
+	if (check_function_sequence(dest) != 0)
+	{
+		log_warn("Non-linearity detected in function sequence\n");
+		return -1;
+	}
+
+	if (u->code_end == 0)
+	{
+		log_debug("No functions found in this output file - no need to copy relocations\n");
+		return 0;
+	}
+
+	// copy the relocations to the output object, and match the symbols to the output symbol table
+	for (unsigned int i=0; i < u->reloc_count; i++)
+	{
+		backend_reloc* r = u->relocs[i];
+		long addend = r->addend;
+		unsigned long off;
+		//printf("Checking reloc offset=%lx sym=%s\n", r->offset, r->symbol->name);
+
+		// only references to data sections go to the shared data object
+		backend_section* anchor = config.shared_data ? reloc_data_target(src, r, &off) : NULL;
+
+		// a data symbol is reached through the anchor of its section, so the addend must include its offset
+		if (anchor && r->symbol->type == SYMBOL_TYPE_OBJECT)
+			addend += r->symbol->val - anchor->address;
+
+		// when the data is sliced, an offset from the start of a section has moved
+		if (slices && r->symbol->type == SYMBOL_TYPE_SECTION)
+		{
+			long mapped = slice_map_offset(slices, backend_get_section_by_name(src, r->symbol->name), addend);
+			if (mapped >= 0)
+				addend = mapped;
+		}
+
+		sym = symbol_map_get(map, r->symbol);
+		if (!sym && anchor)
+		{
+			sym = add_anchor_reference(dest, anchor);
+			if (sym)
+				symbol_map_set(map, r->symbol, sym);
+		}
+		if (!sym)
+		{
+			switch (r->symbol->type)
+			{
+			case SYMBOL_TYPE_FUNCTION:
+				// the function is in another output file, so the linker will have to find it
+				//printf("Adding external symbol %s\n", r->symbol->name);
+				sym = backend_add_symbol(dest, r->symbol->name, 0, SYMBOL_TYPE_NONE, 0, SYMBOL_FLAG_GLOBAL | SYMBOL_FLAG_EXTERNAL, NULL);
+				break;
+
+			case SYMBOL_TYPE_OBJECT:
+				//printf("Input file has a data relocation to %s\n", r->symbol->name);
+				// if we have a data relocation, we must copy the associated symbol as well
+				sec = backend_get_section_by_name(dest, r->symbol->section->name);
+				if (!sec)
+				{
+					//printf("Can't get output section %s\n", r->symbol->section->name);
+         		sec = backend_add_section(dest, r->symbol->section->name, 0, r->symbol->section->address, NULL, 0, r->symbol->section->alignment, r->symbol->section->flags);
+				}
+				if (sec)
+				{
+					long val = r->symbol->val - r->symbol->section->address;
+					if (slices && slice_map_offset(slices, r->symbol->section, val) >= 0)
+						val = slice_map_offset(slices, r->symbol->section, val);
+					//printf("Adding symbol %s\n", r->symbol->name);
+					sym = backend_add_symbol(dest, r->symbol->name, val, r->symbol->type, r->symbol->size, r->symbol->flags, sec);
+				}
+				break;
+
+			case SYMBOL_TYPE_SECTION:
+				//printf("Relocation with a section symbol %s found\n", r->symbol->name);
+
+				// make sure the output file has the section associated with the symbol as well. Its enough
+				// to make sure it exists - the contents will be copied later (in copy_data)
+				sec = backend_get_section_by_name(dest, r->symbol->name);
+				if (!sec)
+				{
+				//	printf("Can't find output section %s - adding\n", r->symbol->name);
+         		sec = backend_add_section(dest, r->symbol->name, 0, 0, NULL, 0, 1, 0);
+				}
+				sym = backend_add_symbol(dest, r->symbol->name, r->symbol->val, r->symbol->type, r->symbol->size, r->symbol->flags, sec);
+				break;
+			}
+
+			if (!sym)
+			{
+				log_warn("Can't create output symbol for %s\n", r->symbol->name);
+				continue;
+			}
+			symbol_map_set(map, r->symbol, sym);
+		}
+
+		const code_placement* p = find_placement(code, r->offset);
+		if (!p)
+		{
+			log_warn("Relocation at 0x%lx is not in any function of %s\n", r->offset, u->filename);
+			continue;
+		}
+		backend_add_section_relocation(dest, p->sec, r->offset - p->start + p->out, r->type, addend, sym);
+	}
+
+	log_debug("Output file has %u relocations\n", backend_relocation_count(dest));
+	return 0;
+}
+
+static int copy_data(backend_object* src, backend_object* dest)
+{
+	// without serious code analysis I can't know how much data to copy. It's because data symbols
+	// don't have a size. So for now, I will just copy everything we have to every output object. This
+	// will include extraneous information, but it will work.
+
+	// several output objects may be written at the same time, so don't use the iterator of the source
+	backend_section* outsec;
+	for (const list_node* iter=ll_iter_start(src->section_table); iter != NULL; iter=iter->next)
+	{
+		backend_section* insec = iter->val;
+
+		// if this is a data section, copy the contents to the output section of the same name
+		if (insec->flags & SECTION_FLAG_INIT_DATA || insec->flags & SECTION_FLAG_UNINIT_DATA)
+		{
+			// if we can't find a matching output section, skip the data
+			outsec = backend_get_section_by_name(dest, insec->name);
+			if (!outsec)
+			{
+				//printf("Can't find output section named %s\n", insec->name);
+				continue;
+			}
+
+			outsec->size = insec->size;
+			outsec->flags = insec->flags;
+			if (insec->data && !(insec->flags & SECTION_FLAG_UNINIT_DATA))
+			{
+				outsec->data = mem_alloc(MEM_DATA, insec->size);
+				memcpy(outsec->data, insec->data, insec->size);
+			}
+		}
+	}
+
+	return 0;
+}
+
+static void incremental_add_function(incremental* inc, backend_object* obj, backend_symbol* sym, const char* output_filename)
+{
+	char name[1024];
+
+	unsigned long h = hash_function(inc, obj, sym);
+	inc->unit_hash = hash_buffer(&h, sizeof(h), inc->unit_hash);
+
+	snprintf(name, sizeof(name), "%s:%s", output_filename, sym->name);
+	const manifest_entry* e = manifest_find(inc->prev, MANIFEST_FUNCTION, name);
+	if (!e || e->hash != h)
+		inc->changed_funcs++;
+	manifest_add(inc->next, MANIFEST_FUNCTION, name, h);
+}
+
+// check whether the output object for this unit would be exactly the same as the one written by the previous run
+static int incremental_object_unchanged(incremental* inc, const char* filename, const char* path, unsigned long hash)
+{
+	const manifest_entry* e = manifest_find(inc->prev, MANIFEST_OBJECT, filename);
+	manifest_add(inc->next, MANIFEST_OBJECT, filename, hash);
+	inc->objects++;
+	if (e && e->hash == hash && access(path, F_OK) == 0)
+	{
+		log_info("%s is unchanged\n", filename);
+		inc->unchanged++;
+		return 1;
+	}
+
+	return 0;
+}
+
+static int incremental_unit_unchanged(incremental* inc, backend_object* obj, const comp_unit* u, backend_type output_target)
+{
+	int params[4] = { output_target, config.shared_data, config.slice_data, config.function_sections };
+	inc->unit_hash = hash_buffer(params, sizeof(params), HASH_INIT);
+	for (unsigned int i=0; i < u->func_count; i++)
+		incremental_add_function(inc, obj, u->funcs[i], u->filename);
+
+	return incremental_object_unchanged(inc, u->filename, u->path, inc->unit_hash);
+}
+
+// Build the code section of an output object from the code of its own functions. The functions are
+// packed one after another (each one keeps the alignment it had in the input file), so the section
+// only holds the code of this unit, even when other code lies between its functions in the input.
+static void copy_code(const backend_section* in, const comp_unit* u, backend_section* out, unit_code* code)
+{
+	unsigned long size = 0;
+	unsigned int align_max = out->alignment;
+	unsigned int n = 0;
+
+	if (!in || !in->data)
+		return;
+
+	for (unsigned int i=0; i < u->func_count; i++)
+	{
+		backend_symbol* sym = u->funcs[i];
+		if (sym->section != in || !sym->size)
+			continue;
+
+		code_placement* p = &code->place[code->count++];
+		p->start = sym->val - in->address;
+		p->end = p->start + sym->size;
+		p->sec = out;
+	}
+	qsort(code->place, code->count, sizeof(code_placement), cmp_placement);
+
+	// functions that overlap (i.e. aliases) share their code
+	for (unsigned int i=0; i < code->count; i++)
+	{
+		code_placement* p = &code->place[i];
+		code_placement* prev = n ? &code->place[n-1] : NULL;
+		if (prev && p->start < prev->end)
+		{
+			if (p->end > prev->end)
+			{
+				size += p->end - prev->end;
+				prev->end = p->end;
+			}
+			continue;
+		}
+
+		unsigned int align = function_alignment(in, in->address + p->start);
+		if (align > align_max)
+			align_max = align;
+		size = (size + align - 1) & ~(unsigned long)(align - 1);
+		p->out = size;
+		size += p->end - p->start;
+		code->place[n++] = *p;
+	}
+	code->count = n;
+	if (!size)
+		return;
+
+	out->data = mem_calloc(MEM_DATA, size, 1);
+	if (!out->data)
+	{
+		code->count = 0;
+		return;
+	}
+	out->size = size;
+	out->alignment = align_max;
+	for (unsigned int i=0; i < code->count; i++)
+		memcpy(out->data + code->place[i].out, in->data + code->place[i].start, code->place[i].end - code->place[i].start);
+	log_debug("Setting code size to %u\n", out->size);
+}
+
+// Create the code sections of the output object, and copy the code of the functions into them
+static void place_code(backend_object* obj, const comp_unit* u, backend_object* oo, backend_type output_target, unit_code* code)
+{
+	backend_section* in = backend_get_section_by_name(obj, ".text");
+	char name[256];
+
+	code->count = 0;
+	code->place = mem_alloc(MEM_WORK, (u->func_count + 1) * sizeof(code_placement));
+
+	if (!config.function_sections)
+	{
+		for (unsigned int i=0; i < u->func_count; i++)
+		{
+			if (!u->funcs[i]->section)
+				continue;
+
+			//printf("no text section found - creating\n");
+			backend_section* sec_text = backend_add_section(oo, ".text", 0, 0, NULL, 0, 2, SECTION_FLAG_CODE);
+			copy_code(in, u, sec_text, code);
+			break;
+		}
+		return;
+	}
+
+	for (unsigned int i=0; in && in->data && i < u->func_count; i++)
+	{
+		backend_symbol* sym = u->funcs[i];
+		if (sym->section != in || !sym->size)
+			continue;
+
+		// keep the alignment that the function had in the input file
+		unsigned long start = sym->val - in->address;
+		unsigned int align = function_alignment(in, sym->val);
+
+		char* data = mem_alloc(MEM_DATA, sym->size);
+		memcpy(data, in->data + start, sym->size);
+		function_section_name(name, sizeof(name), sym->name, output_target);
+		code_placement* p = &code->place[code->count++];
+		p->start = start;
+		p->end = start + sym->size;
+		p->sec = backend_add_section(oo, name, sym->size, 0, data, 0, align, SECTION_FLAG_CODE);
+		p->out = 0;
+	}
+	qsort(code->place, code->count, sizeof(code_placement), cmp_placement);
+	log_debug("%u function sections\n", code->count);
+}
+
+// Build and write the output object of one unit. The input object is only read from here, so
+// several units can be emitted at the same time.
+static int emit_unit(backend_object* obj, const comp_unit* u, backend_type output_target, const data_layout* layout)
+{
+	symbol_map map;
+	unit_slices slices = {0};
+	unit_code code;
+	stats_timer t;
+	trace_span unit_span, span;
+
+	trace_begin(&unit_span);
+	trace_begin(&span);
+	stats_start(&t);
+	backend_object* oo = set_up_output_file(obj, u->filename, output_target);
+	if (!oo)
+		return -10;
+
+	place_code(obj, u, oo, output_target, &code);
+	backend_section* sec_text = config.function_sections ? NULL : backend_get_section_by_name(oo, ".text");
+
+	symbol_map_init(&map, u->func_count + u->reloc_count);
+	for (unsigned int i=0; i < u->func_count; i++)
+	{
+		backend_symbol* sym = u->funcs[i];
+		unsigned int flags=SYMBOL_FLAG_GLOBAL; // mark all functions as global
+		unsigned int type=SYMBOL_TYPE_FUNCTION;
+		unsigned long base=0;	// base address to remove from symbol values
+		backend_section* sec = sec_text;
+
+		// set the base address of functions to where their code was placed in the output section
+		if (sym->section)
+		{
+			//printf("Symbol %s is in section %s\n", sym->name, sym->section->name);
+			const code_placement* p = find_placement(&code, sym->val - sym->section->address);
+			base = sym->section->address + (p ? p->start - p->out : u->code_start);
+			if (p)
+				sec = p->sec;
+		}
+
+      //printf("Found function %s @ 0x%lx + 0x%lx\n", sym->name, base, sym->val-base);
+
+		// any function with a 0 size is probably an external function (from a library)
+		// even though it is a function, it should be marked as "No type"
+		if (sym->size == 0)
+		{
+			flags |= SYMBOL_FLAG_GLOBAL | SYMBOL_FLAG_EXTERNAL;
+			type = SYMBOL_TYPE_NONE;
+		}
+
+      // add function symbols to the output symbol table
+		symbol_map_set(&map, sym, backend_add_symbol(oo, sym->name, sym->val-base, type, sym->size, flags, sec));
+	}
+
+	if (layout)
+		slice_data(layout, obj, u, &slices);
+	stats_stop(&t, STATS_PHASE_COPY);
+	trace_end(&span, "copy_functions", u->path, "functions", (unsigned long)u->func_count,
+		"code_bytes", u->code_size, NULL);
+
+	trace_begin(&span);
+	stats_start(&t);
+	copy_relocations(obj, oo, u, &code, &map, layout ? &slices : NULL);
+	stats_stop(&t, STATS_PHASE_FIXUP);
+	trace_end(&span, "copy_relocations", u->path, "relocations", (unsigned long)u->reloc_count, NULL);
+
+	trace_begin(&span);
+	stats_start(&t);
+	if (layout)
+		copy_data_slices(&slices, oo);
+	else if (!config.shared_data)
+		copy_data(obj, oo);
+	mem_free(MEM_WORK, slices.slice);
+	stats_stop(&t, STATS_PHASE_COPY);
+	trace_end(&span, "copy_data", u->path, "sections", (unsigned long)backend_section_count(oo), NULL);
+
+	//backend_sort_symbols(oo);
+	trace_begin(&span);
+	stats_start(&t);
+	unsigned long symbols = backend_symbol_count(oo);
+	unsigned long relocs = backend_relocation_count(oo);
+	if (backend_write(oo, u->path))
+		log_error("error writing file\n");
+	else
+		stats_add_file(u->path);
+	backend_destructor(oo);
+	stats_stop(&t, STATS_PHASE_WRITE);
+	trace_end(&span, "backend_write", u->path, "symbols", symbols, "relocations", relocs, NULL);
+	symbol_map_free(&map);
+	mem_free(MEM_WORK, code.place);
+	trace_end(&unit_span, "emit_object", u->path, "functions", (unsigned long)u->func_count,
+		"relocations", (unsigned long)u->reloc_count, NULL);
+
+	return 0;
+}
+
+// Streaming mode: the units are emitted in address order, and the data of each input section is
+// released as soon as the last unit that needs it has been written. With a memory limit, a unit is
+// only started when the input data that is still held plus the units being built fit under it. The
+// memory of a unit is an estimate from its code size and relocation count, so the limit bounds the
+// estimates rather than the memory that is actually in use.
+typedef struct stream
+{
+	backend_section** secs;		// input sections that still hold data
+	unsigned int* users;			// number of units that still need each section
+	unsigned int sec_count;
+	unsigned int* use;			// the sections needed by unit i are use[use_start[i]] .. use[use_start[i+1]-1]
+	unsigned int* use_start;
+	unsigned long* cost;			// estimated memory needed to build each unit
+	backend_section* text;
+	unsigned long resident;		// input data that is still held
+	unsigned long peak;			// highest resident + in_flight
+	unsigned long in_flight;	// estimated memory of the units being built
+	unsigned long limit;
+	pthread_cond_t room;			// signalled when memory is released
+} stream;
+
+static int cmp_unit_address(const void* a, const void* b)
+{
+	const comp_unit* ua = a;
+	const comp_unit* ub = b;
+	if (ua->code_start < ub->code_start)
+		return -1;
+	return (ua->code_start > ub->code_start);
+}
+
+static int stream_section_index(stream* st, const backend_section* sec)
+{
+	for (unsigned int i=0; i < st->sec_count; i++)
+		if (st->secs[i] == sec)
+			return i;
+	return -1;
+}
+
+static void stream_free_section(stream* st, unsigned int index)
+{
+	backend_section* sec = st->secs[index];
+	if (!sec->data)
+		return;
+
+	log_debug("Releasing section %s (%u bytes)\n", sec->name, sec->size);
+	st->resident -= sec->size;
+	mem_free(MEM_DATA, sec->data);
+	sec->data = NULL;
+}
+
+// record that unit i needs the data of a section - returns 1 the first time
+static int stream_add_use(stream* st, unsigned int i, backend_section* sec, unsigned int* max)
+{
+	int index = sec ? stream_section_index(st, sec) : -1;
+	if (index < 0)
+		return 0;
+
+	for (unsigned int j=st->use_start[i]; j < st->use_start[i+1]; j++)
+		if (st->use[j] == index)
+			return 0;
+
+	if (st->use_start[i+1] == *max)
+	{
+		*max = *max ? *max * 2 : 64;
+		st->use = mem_realloc(MEM_WORK, st->use, *max * sizeof(unsigned int));
+	}
+	st->use[st->use_start[i+1]++] = index;
+	st->users[index]++;
+	return 1;
+}
+
+// The units must already be sorted by address. Any input data that none of the units need is released
+// right away.
+static stream* stream_init(backend_object* obj, const comp_unit* units, unsigned int count, unsigned long limit)
+{
+	stream* st = mem_calloc(MEM_WORK, 1, sizeof(stream));
+	st->secs = mem_calloc(MEM_WORK, backend_section_count(obj) + 1, sizeof(backend_section*));
+	st->users = mem_calloc(MEM_WORK, backend_section_count(obj) + 1, sizeof(unsigned int));
+	st->use_start = mem_calloc(MEM_WORK, count + 1, sizeof(unsigned int));
+	st->cost = mem_calloc(MEM_WORK, count + 1, sizeof(unsigned long));
+	st->text = backend_get_section_by_name(obj, ".text");
+	st->limit = limit;
+	pthread_cond_init(&st->room, NULL);
+
+	for (const list_node* iter=ll_iter_start(obj->section_table); iter != NULL; iter=iter->next)
+	{
+		backend_section* sec = iter->val;
+		if (!sec->data)
+			continue;
+		st->secs[st->sec_count++] = sec;
+		st->resident += sec->size;
+	}
+
+	// find the sections that each unit needs, and how much memory it will take to build it
+	unsigned int use_max = 0;
+	for (unsigned int i=0; i < count; i++)
+	{
+		const comp_unit* u = &units[i];
+		st->use_start[i+1] = st->use_start[i];
+		st->cost[i] = u->code_size + u->reloc_count * UNIT_RELOC_COST;
+
+		if (u->code_end)
+			stream_add_use(st, i, st->text, &use_max);
+
+		// the data is copied into the unit, unless it is in the shared data object
+		for (unsigned int r=0; r < u->reloc_count && !config.shared_data; r++)
+		{
+			unsigned long off;
+			backend_section* sec = reloc_data_target(obj, u->relocs[r], &off);
+			if (stream_add_use(st, i, sec, &use_max))
+				st->cost[i] += sec->size;
+		}
+	}
+
+	for (unsigned int i=0; i < st->sec_count; i++)
+		if (!st->users[i])
+			stream_free_section(st, i);
+	st->peak = st->resident;
+	log_info("Streaming: holding %lu bytes of input data\n", st->resident);
+
+	return st;
+}
+
+// wait until there is room for unit i under the memory limit (called with the queue locked)
+static void stream_reserve(stream* st, unsigned int i, pthread_mutex_t* lock)
+{
+	// a unit that doesn't fit even on its own is built by itself
+	while (st->limit && st->in_flight && st->resident + st->in_flight + st->cost[i] > st->limit)
+		pthread_cond_wait(&st->room, lock);
+
+	st->in_flight += st->cost[i];
+	if (st->resident + st->in_flight > st->peak)
+		st->peak = st->resident + st->in_flight;
+}
+
+// unit i has been written (called with the queue locked)
+static void stream_unit_done(stream* st, unsigned int i)
+{
+	st->in_flight -= st->cost[i];
+
+	for (unsigned int j=st->use_start[i]; j < st->use_start[i+1]; j++)
+		if (--st->users[st->use[j]] == 0)
+			stream_free_section(st, st->use[j]);
+
+	pthread_cond_broadcast(&st->room);
+}
+
+static void stream_finish(stream* st)
+{
+	if (!st)
+		return;
+
+	log_info("Streaming: peak estimate %lu bytes", st->peak);
+	if (st->limit)
+		log_info(" (limit %lu)", st->limit);
+	log_info("\n");
+	if (st->limit && st->peak > st->limit)
+		log_warn("The memory limit is too low - the units were written one at a time, but still went over it\n");
+
+	pthread_cond_destroy(&st->room);
+	mem_free(MEM_WORK, st->secs);
+	mem_free(MEM_WORK, st->users);
+	mem_free(MEM_WORK, st->use);
+	mem_free(MEM_WORK, st->use_start);
+	mem_free(MEM_WORK, st->cost);
+	mem_free(MEM_WORK, st);
+}
+
+// the units that are waiting to be emitted, shared by all of the worker threads
+typedef struct emit_queue
+{
+	backend_object* obj;
+	const comp_unit* units;
+	const unsigned char* skip;	// units that don't have to be written again (incremental mode)
+	unsigned int count;
+	unsigned int next;			// index of the next unit to emit
+	backend_type target;
+	const data_layout* layout;
+	stream* st;						// NULL when not streaming
+	int ret;							// the first error, if any
+	pthread_mutex_t lock;
+} emit_queue;
+
+static void* emit_worker(void* arg)
+{
+	emit_queue* q = arg;
+
+	while (1)
+	{
+		pthread_mutex_lock(&q->lock);
+		unsigned int i = q->next++;
+		int failed = (q->ret < 0);
+		if (q->st && i < q->count && !failed && !q->skip[i])
+			stream_reserve(q->st, i, &q->lock);
+		pthread_mutex_unlock(&q->lock);
+
+		// stop taking new units after the first error, like the sequential loop does
+		if (i >= q->count || failed)
+			break;
+
+		int ret = 0;
+		if (!q->skip[i])
+			ret = emit_unit(q->obj, &q->units[i], q->target, q->layout);
+
+		pthread_mutex_lock(&q->lock);
+		if (ret < 0 && q->ret >= 0)
+			q->ret = ret;
+		if (q->st)
+		{
+			if (q->skip[i])
+				q->st->in_flight += q->st->cost[i];
+			stream_unit_done(q->st, i);
+		}
+		pthread_mutex_unlock(&q->lock);
+	}
+
+	return NULL;
+}
+
+// Emit all of the units, using up to 'jobs' threads. The incremental checks update the manifest, so
+// they are done here before any of the threads start.
+static int emit_units(backend_object* obj, const comp_unit* units, unsigned int count, backend_type output_target, incremental* inc, const data_layout* layout, stream* st, int jobs)
+{
+	emit_queue q = { obj, units, NULL, count, 0, output_target, layout, st, 0 };
+	pthread_t* threads;
+	unsigned int started = 0;
+
+	unsigned char* skip = mem_calloc(MEM_WORK, count + 1, 1);
+	for (unsigned int i=0; inc && i < count; i++)
+		skip[i] = incremental_unit_unchanged(inc, obj, &units[i], output_target);
+	q.skip = skip;
+
+	if (jobs <= 0)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs > (int)count)
+		jobs = count;
+
+	pthread_mutex_init(&q.lock, NULL);
+	threads = mem_alloc(MEM_WORK, sizeof(pthread_t) * (jobs + 1));
+	for (int i=1; i < jobs; i++)
+	{
+		if (pthread_create(&threads[started], NULL, emit_worker, &q))
+		{
+			log_warn("Can't start thread %i - continuing with %u\n", i, started + 1);
+			break;
+		}
+		started++;
+	}
+
+	// the main thread does its share of the work too
+	emit_worker(&q);
+
+	for (unsigned int i=0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&q.lock);
+	mem_free(MEM_WORK, threads);
+	mem_free(MEM_WORK, skip);
+
+	return q.ret;
+}
+
+// Write all of the data sections that are referenced by any unit to a single object, with an anchor
+// symbol at the start of each one.
+static int emit_shared_data(backend_object* obj, const comp_unit* units, unsigned int count, backend_type output_target, incremental* inc, const char* output_dir)
+{
+	backend_section** used = NULL;
+	unsigned int used_count = 0;
+	unsigned int used_max = 0;
+	char name[256];
+
+	// find the data sections that are referenced
+	for (unsigned int i=0; i < count; i++)
+	{
+		for (unsigned int r=0; r < units[i].reloc_count; r++)
+		{
+			unsigned long off;
+			backend_section* sec = reloc_data_target(obj, units[i].relocs[r], &off);
+			if (!sec)
+				continue;
+
+			unsigned int s;
+			for (s=0; s < used_count && used[s] != sec; s++);
+			if (s < used_count)
+				continue;
+			if (used_count == used_max)
+			{
+				used_max = used_max ? used_max * 2 : 16;
+				used = mem_realloc(MEM_WORK, used, used_max * sizeof(backend_section*));
+			}
+			used[used_count++] = sec;
+		}
+	}
+
+	if (!used_count)
+		return 0;
+
+	if (inc)
+	{
+		int params[2] = { output_target, config.shared_data };
+		unsigned long h = hash_buffer(params, sizeof(params), HASH_INIT);
+		for (unsigned int s=0; s < used_count; s++)
+		{
+			unsigned long dh = hash_data_section(inc, used[s]);
+			h = hash_buffer(used[s]->name, strlen(used[s]->name) + 1, h);
+			h = hash_buffer(&dh, sizeof(dh), h);
+		}
+		char* path = output_path(output_dir, SHARED_DATA_FILENAME);
+		int unchanged = incremental_object_unchanged(inc, SHARED_DATA_FILENAME, path, h);
+		mem_free(MEM_STRINGS, path);
+		if (unchanged)
+		{
+			mem_free(MEM_WORK, used);
+			return 0;
+		}
+	}
+
+	stats_timer t;
+	trace_span span;
+	trace_begin(&span);
+	stats_start(&t);
+	backend_object* oo = set_up_output_file(obj, SHARED_DATA_FILENAME, output_target);
+	if (!oo)
+	{
+		mem_free(MEM_WORK, used);
+		return -10;
+	}
+
+	for (unsigned int s=0; s < used_count; s++)
+	{
+		backend_section* insec = used[s];
+		char* data = NULL;
+		if (insec->data && !(insec->flags & SECTION_FLAG_UNINIT_DATA))
+		{
+			data = mem_alloc(MEM_DATA, insec->size);
+			memcpy(data, insec->data, insec->size);
+		}
+		backend_section* outsec = backend_add_section(oo, insec->name, insec->size, 0, data, 0, insec->alignment, insec->flags);
+
+		anchor_name(name, sizeof(name), insec->name);
+		backend_add_symbol(oo, name, 0, SYMBOL_TYPE_OBJECT, insec->size, SYMBOL_FLAG_GLOBAL, outsec);
+	}
+	mem_free(MEM_WORK, used);
+
+	stats_stop(&t, STATS_PHASE_COPY);
+	trace_end(&span, "copy_data", SHARED_DATA_FILENAME, "sections", (unsigned long)used_count, NULL);
+
+	trace_begin(&span);
+	stats_start(&t);
+	unsigned long symbols = backend_symbol_count(oo);
+	char* path = output_path(output_dir, SHARED_DATA_FILENAME);
+	if (backend_write(oo, path))
+		log_error("error writing file\n");
+	else
+		stats_add_file(path);
+	mem_free(MEM_STRINGS, path);
+	backend_destructor(oo);
+	stats_stop(&t, STATS_PHASE_WRITE);
+	trace_end(&span, "backend_write", SHARED_DATA_FILENAME, "symbols", symbols, "relocations", 0UL, NULL);
+
+	return 0;
+}
+
+int delinker_init(void)
+{
+	return backend_init();
+}
+
+backend_object* delinker_read(const char* input_filename)
+{
+	stats_timer t;
+	trace_span span;
+
+	trace_begin(&span);
+	stats_start(&t);
+   backend_object* obj = backend_read(input_filename);
+	stats_stop(&t, STATS_PHASE_READ);
+	trace_end(&span, "backend_read", input_filename, NULL);
+
+	if (!obj)
+		return NULL;
+
+	backend_section* sec_text = backend_get_section_by_name(obj, ".text");
+	if (sec_text)
+		stats_add(STATS_TEXT_BYTES, sec_text->size);
+
+	return obj;
+}
+
+int delinker_analyze(backend_object* obj)
+{
+	stats_timer t;
+	trace_span span;
+
+	// check for symbols, and rebuild if necessary
+	if (backend_symbol_count(obj) == 0 && config.reconstruct_symbols == 0)
+		return -ERR_NO_SYMS;
+
+	code_analysis analysis;
+	stats_start(&t);
+	int ret = analyze_code(obj, config.reconstruct_symbols, &analysis);
+	stats_stop(&t, STATS_PHASE_ANALYZE);
+
+	if (config.reconstruct_symbols)
+	{
+		trace_begin(&span);
+		stats_start(&t);
+		if (ret == 0)
+			reconstruct_symbols(obj, analysis.funcs, analysis.func_count, 1);
+		stats_stop(&t, STATS_PHASE_RECONSTRUCT);
+		trace_end(&span, "reconstruct_symbols", NULL, "symbols", (unsigned long)backend_symbol_count(obj), NULL);
+		if (backend_symbol_count(obj) == 0)
+		{
+			release_analysis(&analysis);
+			return -ERR_NO_SYMS_AFTER_RECONSTRUCT;
+		}
+	}
+
+	// convert any absolute addresses into symbols (loads of data, calls of functions, etc.)
+	// make sure any relative jumps are still accurate
+	trace_begin(&span);
+	stats_start(&t);
+	if (ret == 0)
+		ret = build_relocations(obj, analysis.sites, analysis.site_count);
+	stats_stop(&t, STATS_PHASE_RELOCATIONS);
+	trace_end(&span, "build_relocations", NULL, "sites", (unsigned long)analysis.site_count,
+		"relocations", (unsigned long)backend_relocation_count(obj), NULL);
+	if (ret < 0)
+	{
+		log_error("Can't build relocations: %i\n", ret);
+		if (ret == -ERR_BAD_FORMAT)
+			log_error("Unknown code type!\n");
+	}
+	release_analysis(&analysis);
+
+	// sort the symbol table after reconstruction and building relocations
+	trace_begin(&span);
+	stats_start(&t);
+	backend_sort_symbols(obj);
+	stats_stop(&t, STATS_PHASE_SORT);
+	trace_end(&span, "sort_symbols", NULL, "symbols", (unsigned long)backend_symbol_count(obj), NULL);
+	stats_add(STATS_SYMBOLS, backend_symbol_count(obj));
+	stats_add(STATS_RELOCATIONS, backend_relocation_count(obj));
+
+	return ret < 0 ? ret : 0;
+}
+
+// write the objects, and add the name of every file that makes up the output to outputs (unless it is NULL)
+static int emit_objects(backend_object* obj, const char* output_dir, backend_type output_target, manifest* outputs, unsigned long max_memory)
+{
+	stats_timer t;
+	trace_span span;
+	int ret = 0;
+
+   // if the output target is not specified, use the input target
+	if (output_target == OBJECT_TYPE_NONE)
+	{
+		output_target = backend_get_type(obj);
+		//printf("Setting output type to match input: %i\n", output_target);
+	}
+
+	// the manifest belongs with the objects it describes
+	incremental* inc = NULL;
+	char* manifest = NULL;
+	if (config.manifest)
+	{
+		manifest = output_path(output_dir, config.manifest);
+		inc = incremental_init(obj, manifest);
+	}
+
+	// divide the functions and relocations between the output files
+	unsigned int unit_count;
+	trace_begin(&span);
+	stats_start(&t);
+	comp_unit* units = build_units(obj, &unit_count);
+	for (unsigned int i=0; i < unit_count; i++)
+		units[i].path = output_path(output_dir, units[i].filename);
+	partition_relocations(obj, units, unit_count);
+
+	data_layout* layout = NULL;
+	if (config.slice_data && !config.shared_data)
+		layout = build_data_layout(obj);
+	stats_stop(&t, STATS_PHASE_PARTITION);
+	trace_end(&span, "partition", NULL, "objects", (unsigned long)unit_count, NULL);
+
+	// when streaming, the shared data is written first so the units don't have to keep it around
+	stream* st = NULL;
+	if (config.stream)
+	{
+		qsort(units, unit_count, sizeof(comp_unit), cmp_unit_address);
+		if (config.shared_data)
+			ret = emit_shared_data(obj, units, unit_count, output_target, inc, output_dir);
+		st = stream_init(obj, units, unit_count, max_memory);
+	}
+
+	if (ret >= 0)
+		ret = emit_units(obj, units, unit_count, output_target, inc, layout, st, config.jobs);
+	free_data_layout(layout);
+	stream_finish(st);
+
+	if (config.shared_data && !config.stream && ret >= 0)
+		ret = emit_shared_data(obj, units, unit_count, output_target, inc, output_dir);
+
+	if (inc)
+		incremental_finish(inc, manifest);
+	mem_free(MEM_STRINGS, manifest);
+
+	if (outputs && ret >= 0)
+	{
+		for (unsigned int i=0; i < unit_count; i++)
+			manifest_add(outputs, MANIFEST_OBJECT, units[i].filename, 0);
+		if (config.shared_data)
+			manifest_add(outputs, MANIFEST_OBJECT, SHARED_DATA_FILENAME, 0);
+		if (config.manifest)
+			manifest_add(outputs, MANIFEST_OBJECT, config.manifest, 0);
+	}
+	free_units(units, unit_count);
+
+	return ret < 0 ? ret : 0;
+}
+
+int delinker_emit(backend_object* obj, const char* output_dir, backend_type output_target)
+{
+	return emit_objects(obj, output_dir, output_target, NULL, config.max_memory);
+}
+
+// list = the outputs the caller asked for (or NULL)
+static int unlink_file_list(const char* input_filename, const char* output_dir, backend_type output_target, unsigned long max_memory, manifest* list)
+{
+	result_key key;
+	int cached = 0;
+	manifest* outputs = list;
+	trace_span span;
+
+	// the whole run is skipped when its output is already in the result cache
+	if (config.result_cache)
+	{
+		outputs = manifest_init();
+		trace_begin(&span);
+		cached = (results_key(input_filename, output_target, &key) == 0);
+		int found = (cached && results_lookup(config.result_cache, &key, output_dir, outputs) == 0);
+		trace_end(&span, "result_cache_lookup", input_filename, "hit", (unsigned long)found, NULL);
+		if (found)
+		{
+			for (unsigned int i=0; list && i < outputs->count; i++)
+				manifest_add(list, MANIFEST_OBJECT, outputs->entries[i].name, 0);
+			manifest_free(outputs);
+			return 0;
+		}
+		// a lookup that fails part of the way may have listed some of the files
+		manifest_free(outputs);
+		outputs = manifest_init();
+	}
+
+	int ret = -ERR_BAD_FORMAT;
+	backend_object* obj = delinker_read(input_filename);
+	if (obj)
+	{
+		ret = delinker_analyze(obj);
+		if (ret == 0)
+			ret = emit_objects(obj, output_dir, output_target, outputs, max_memory);
+		backend_destructor(obj);
+	}
+
+	if (ret == 0 && cached)
+	{
+		trace_begin(&span);
+		results_store(config.result_cache, &key, output_dir, outputs);
+		trace_end(&span, "result_cache_store", input_filename, "files", (unsigned long)outputs->count, NULL);
+		for (unsigned int i=0; list && i < outputs->count; i++)
+			manifest_add(list, MANIFEST_OBJECT, outputs->entries[i].name, 0);
+	}
+	if (outputs != list)
+		manifest_free(outputs);
+
+	return ret;
+}
+
+int unlink_file(const char* input_filename, const char* output_dir, backend_type output_target)
+{
+	return unlink_file_list(input_filename, output_dir, output_target, config.max_memory, NULL);
+}
+
+int unlink_file_limit(const char* input_filename, const char* output_dir, backend_type output_target, unsigned long max_memory)
+{
+	return unlink_file_list(input_filename, output_dir, output_target, max_memory, NULL);
+}
+
+int unlink_file_outputs(const char* input_filename, const char* output_dir, backend_type output_target, struct manifest* outputs)
+{
+	return unlink_file_list(input_filename, output_dir, output_target, config.max_memory, outputs);
+}
+
+const char* delinker_error_name(int ret)
+{
+	switch (ret)
+	{
+	case 0: return "ok";
+	case -ERR_BAD_FILE: return "can't open input file";
+	case -ERR_BAD_FORMAT: return "unhandled file format";
+	case -ERR_NO_SYMS: return "no symbols";
+	case -ERR_NO_SYMS_AFTER_RECONSTRUCT: return "no symbols after reconstruct";
+	case -ERR_NO_TEXT_SECTION: return "no .text section";
+	case -ERR_NO_PLT_SECTION: return "no .plt section";
+	}
+	return "unknown error";
+}